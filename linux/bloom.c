@@ -0,0 +1,133 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "bloom.h"
+
+/*
+64 bit hash used to place keys in the filter. FNV-1a over the string,
+followed by the murmur3 finalizer so the high and low bits are both usable.
+*/
+uint64_t bloom_hash(char* str)
+{
+	uint64_t h = 14695981039346656037ULL;
+	int i;
+	for (i = 0; str[i] != 0; i++) {
+		h ^= (unsigned char)str[i];
+		h *= 1099511628211ULL;
+	}
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ULL;
+	h ^= h >> 33;
+	return h;
+}
+
+/*
+Sizes the filter for expected keys at BLOOM_BITS_PER_KEY bits each (about a
+1% false positive rate) and allocates it zeroed and cache line aligned.
+*/
+void bloom_init(bloom_filter* filter, long expected)
+{
+	unsigned long bits;
+	if (expected < 1) {
+		expected = 1;
+	}
+	bits = (unsigned long)expected * BLOOM_BITS_PER_KEY;
+	filter->nblocks = (bits + 511) / 512;
+	if (posix_memalign((void**)&filter->blocks, 64,
+			   filter->nblocks * BLOOM_BLOCK_WORDS * sizeof(uint64_t)) != 0) {
+		filter->blocks = NULL;
+		filter->nblocks = 0;
+		return;
+	}
+	memset(filter->blocks, 0, filter->nblocks * BLOOM_BLOCK_WORDS * sizeof(uint64_t));
+	filter->queries = 0;
+	filter->positives = 0;
+	filter->hits = 0;
+	filter->false_positives = 0;
+}
+
+/*
+Picks the block for h and the BLOOM_K bit positions inside it. The block
+comes from the high half of h, the positions from 9 bit slices of a remix.
+*/
+static uint64_t* bloom_block(bloom_filter* filter, uint64_t h, uint64_t* mix)
+{
+	unsigned long block = (unsigned long)(((h >> 32) * filter->nblocks) >> 32);
+	*mix = h * 0x9e3779b97f4a7c15ULL;
+	return filter->blocks + block * BLOOM_BLOCK_WORDS;
+}
+
+/*
+Returns 1 if the key hashing to h may have been added, 0 if it definitely
+has not. Never blocks.
+*/
+int bloom_query(bloom_filter* filter, uint64_t h)
+{
+	uint64_t mix;
+	uint64_t* block;
+	int i;
+	if (filter->nblocks == 0) {
+		return 1;
+	}
+	block = bloom_block(filter, h, &mix);
+	__atomic_fetch_add(&filter->queries, 1, __ATOMIC_RELAXED);
+	for (i = 0; i < BLOOM_K; i++) {
+		unsigned int bit = (mix >> (i * 9)) & 511;
+		uint64_t word = __atomic_load_n(&block[bit >> 6], __ATOMIC_ACQUIRE);
+		if (!(word & (1ULL << (bit & 63)))) {
+			return 0;
+		}
+	}
+	__atomic_fetch_add(&filter->positives, 1, __ATOMIC_RELAXED);
+	return 1;
+}
+
+/*
+Sets the bits for h. Uses atomic or so concurrent adds to the same block are
+never lost; the release ordering publishes whatever the caller inserted into
+the exact set before calling this.
+*/
+void bloom_add(bloom_filter* filter, uint64_t h)
+{
+	uint64_t mix;
+	uint64_t* block;
+	int i;
+	if (filter->nblocks == 0) {
+		return;
+	}
+	block = bloom_block(filter, h, &mix);
+	for (i = 0; i < BLOOM_K; i++) {
+		unsigned int bit = (mix >> (i * 9)) & 511;
+		__atomic_fetch_or(&block[bit >> 6], 1ULL << (bit & 63), __ATOMIC_RELEASE);
+	}
+}
+
+void bloom_get_stats(bloom_filter* filter, bloom_stats* out)
+{
+	unsigned long set = 0;
+	unsigned long i;
+	double p = 1.0;
+	int k;
+
+	out->nbits = filter->nblocks * 512;
+	out->queries = __atomic_load_n(&filter->queries, __ATOMIC_RELAXED);
+	out->positives = __atomic_load_n(&filter->positives, __ATOMIC_RELAXED);
+	out->hits = __atomic_load_n(&filter->hits, __ATOMIC_RELAXED);
+	out->false_positives = __atomic_load_n(&filter->false_positives, __ATOMIC_RELAXED);
+	for (i = 0; i < filter->nblocks * BLOOM_BLOCK_WORDS; i++) {
+		set += __builtin_popcountll(__atomic_load_n(&filter->blocks[i], __ATOMIC_RELAXED));
+	}
+	out->fill = out->nbits ? (double)set / out->nbits : 0.0;
+	for (k = 0; k < BLOOM_K; k++) {
+		p *= out->fill;
+	}
+	out->est_fp_rate = p;
+	/* Negatives are always true negatives, so they count as new keys too. */
+	if (out->queries - out->hits > 0) {
+		out->fp_rate = (double)out->false_positives / (out->queries - out->hits);
+	} else {
+		out->fp_rate = 0.0;
+	}
+}
@@ -0,0 +1,53 @@
+#ifndef __BLOOM_H
+#define __BLOOM_H
+
+#include <stdint.h>
+
+/*
+A blocked Bloom filter. Every key maps to a single 512 bit block (one cache
+line) and sets BLOOM_K bits inside that block, so a lookup touches one line.
+Bits are only ever set, never cleared, so readers and writers can share the
+filter without a lock.
+*/
+#define BLOOM_BLOCK_WORDS 8
+#define BLOOM_BITS_PER_KEY 10
+#define BLOOM_K 7
+#define BLOOM_DEFAULT_URLS 65536
+
+typedef struct bloom_filter bloom_filter;
+typedef struct bloom_stats bloom_stats;
+
+struct bloom_filter {
+	uint64_t* blocks;
+	unsigned long nblocks;
+	unsigned long queries;
+	unsigned long positives;
+	unsigned long hits;
+	unsigned long false_positives;
+};
+
+/*
+Counters exported by crawl_bloom_stats(). positives are lookups where the
+filter answered "maybe seen"; hits are the positives confirmed by the exact
+visited set without taking its lock, false_positives are the rest.
+fill is the fraction of bits set, est_fp_rate the rate predicted from it and
+fp_rate the rate actually observed over the crawl so far.
+*/
+struct bloom_stats {
+	unsigned long nbits;
+	unsigned long queries;
+	unsigned long positives;
+	unsigned long hits;
+	unsigned long false_positives;
+	double fill;
+	double est_fp_rate;
+	double fp_rate;
+};
+
+uint64_t bloom_hash(char* str);
+void bloom_init(bloom_filter* filter, long expected);
+int bloom_query(bloom_filter* filter, uint64_t h);
+void bloom_add(bloom_filter* filter, uint64_t h);
+void bloom_get_stats(bloom_filter* filter, bloom_stats* out);
+
+#endif
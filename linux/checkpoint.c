@@ -0,0 +1,308 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include "checkpoint.h"
+
+uint64_t checkpoint_now_us(void)
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+static void checkpoint_path(char* dir, char* name, char* buf, size_t size)
+{
+	snprintf(buf, size, "%s/%s", dir, name);
+}
+
+/*
+Opens the state directory and its visited journal. The journal is cut back
+to keep bytes: anything past the last checkpoint was visited by work that
+was lost, and must be found again on resume. Pass 0 to start fresh.
+
+@return:
+int, 0 on success, -1 on failure
+*/
+int checkpoint_open(checkpoint* ck, char* dir, uint64_t keep)
+{
+	char path[4096];
+	int fd;
+
+	if (mkdir(dir, 0755) < 0 && errno != EEXIST) {
+		perror("checkpoint: mkdir");
+		return -1;
+	}
+	checkpoint_path(dir, "visited.log", path, sizeof(path));
+	fd = open(path, O_WRONLY | O_CREAT, 0644);
+	if (fd < 0 || ftruncate(fd, keep) < 0 || lseek(fd, keep, SEEK_SET) < 0) {
+		perror("checkpoint: journal");
+		if (fd >= 0) {
+			close(fd);
+		}
+		return -1;
+	}
+	ck->journal = fdopen(fd, "w");
+	if (ck->journal == NULL) {
+		perror("checkpoint: journal");
+		close(fd);
+		return -1;
+	}
+	ck->journal_len = keep;
+	ck->staged = NULL;
+	ck->staged_len = 0;
+	ck->staged_size = 0;
+	ck->spare = NULL;
+	ck->spare_size = 0;
+	ck->journal_failed = 0;
+	ck->dir = strdup(dir);
+	ck->lock = malloc(sizeof(pthread_mutex_t));
+	pthread_mutex_init(ck->lock, NULL);
+	ck->prof = NULL;
+	ck->write_lock = malloc(sizeof(pthread_mutex_t));
+	pthread_mutex_init(ck->write_lock, NULL);
+	memset(&ck->stats, 0, sizeof(ck->stats));
+	return 0;
+}
+
+static void put_string(FILE* file, char* str, uint64_t* len)
+{
+	uint32_t n = strlen(str);
+	fwrite(&n, sizeof(n), 1, file);
+	fwrite(str, 1, n, file);
+	*len += sizeof(n) + n;
+}
+
+/*
+Reads one length prefixed string into a fresh buffer.
+
+@return:
+char*, the string, or NULL at end of file or on a short read
+*/
+static char* get_string(FILE* file)
+{
+	uint32_t n;
+	char* str;
+	if (fread(&n, sizeof(n), 1, file) != 1) {
+		return NULL;
+	}
+	str = malloc(n + 1);
+	if (fread(str, 1, n, file) != n) {
+		free(str);
+		return NULL;
+	}
+	str[n] = '\0';
+	return str;
+}
+
+/*
+Records newly visited URLs. They are only staged in memory; nothing reaches
+the journal until the next checkpoint_journal_sync. If the stage cannot grow
+the journal is marked failed and the URLs are dropped.
+*/
+void checkpoint_journal_add(checkpoint* ck, char** links, int n)
+{
+	int i;
+	LOCKPROF_LOCK(ck->prof, ck->lock);
+	for (i = 0; i < n && !ck->journal_failed; i++) {
+		uint32_t len = strlen(links[i]);
+		if (ck->staged_len + sizeof(len) + len > ck->staged_size) {
+			size_t size = ck->staged_size ? ck->staged_size : 4096;
+			char* staged;
+			while (size < ck->staged_len + sizeof(len) + len) {
+				size *= 2;
+			}
+			staged = realloc(ck->staged, size);
+			if (staged == NULL) {
+				ck->journal_failed = 1;
+				break;
+			}
+			ck->staged = staged;
+			ck->staged_size = size;
+		}
+		memcpy(ck->staged + ck->staged_len, &len, sizeof(len));
+		memcpy(ck->staged + ck->staged_len + sizeof(len), links[i], len);
+		ck->staged_len += sizeof(len) + len;
+		ck->journal_len += sizeof(len) + len;
+	}
+	LOCKPROF_UNLOCK(ck->prof, ck->lock);
+}
+
+/*
+@return:
+uint64_t, the length of the journal so far, written out or not
+*/
+uint64_t checkpoint_journal_len(checkpoint* ck)
+{
+	uint64_t len;
+	LOCKPROF_LOCK(ck->prof, ck->lock);
+	len = ck->journal_len;
+	LOCKPROF_UNLOCK(ck->prof, ck->lock);
+	return len;
+}
+
+/*
+Writes everything staged so far to the journal and flushes it to the
+kernel. Only the buffer swap happens under ck->lock. Callers must hold
+ck->write_lock.
+
+@return:
+int, 0 on success, -1 if this or an earlier journal write failed
+*/
+int checkpoint_journal_sync(checkpoint* ck)
+{
+	char* buf;
+	size_t len;
+	size_t size;
+	int failed;
+
+	LOCKPROF_LOCK(ck->prof, ck->lock);
+	buf = ck->staged;
+	len = ck->staged_len;
+	size = ck->staged_size;
+	ck->staged = ck->spare;
+	ck->staged_size = ck->spare_size;
+	ck->staged_len = 0;
+	LOCKPROF_UNLOCK(ck->prof, ck->lock);
+	ck->spare = buf;
+	ck->spare_size = size;
+
+	failed = fwrite(buf, 1, len, ck->journal) != len || fflush(ck->journal) != 0;
+	if (failed) {
+		perror("checkpoint: journal write");
+	}
+	LOCKPROF_LOCK(ck->prof, ck->lock);
+	ck->journal_failed |= failed;
+	failed = ck->journal_failed;
+	LOCKPROF_UNLOCK(ck->prof, ck->lock);
+	return failed ? -1 : 0;
+}
+
+/*
+Writes a checkpoint: hdr followed by hdr->ninflight + hdr->nfrontier URLs
+from urls, in that order. The journal is written out and fsync'd first, and
+the checkpoint fails if it cannot be; then the snapshot goes to a temporary
+file that is fsync'd and renamed over the old one, so a crash leaves either
+the old or the new checkpoint, never a torn one.
+Callers must hold ck->write_lock.
+
+@return:
+int, bytes written, or -1 on failure
+*/
+int checkpoint_write(checkpoint* ck, checkpoint_header* hdr, char** urls)
+{
+	char tmp[4096];
+	char path[4096];
+	uint64_t len = sizeof(*hdr);
+	uint64_t i;
+	FILE* file;
+	int failed;
+
+	if (checkpoint_journal_sync(ck) < 0) {
+		return -1;
+	}
+	if (fsync(fileno(ck->journal)) < 0) {
+		perror("checkpoint: journal fsync");
+		return -1;
+	}
+	checkpoint_path(ck->dir, "checkpoint.tmp", tmp, sizeof(tmp));
+	checkpoint_path(ck->dir, "checkpoint", path, sizeof(path));
+	file = fopen(tmp, "w");
+	if (file == NULL) {
+		perror("checkpoint: create");
+		return -1;
+	}
+	hdr->magic = CHECKPOINT_MAGIC;
+	hdr->version = CHECKPOINT_VERSION;
+	fwrite(hdr, sizeof(*hdr), 1, file);
+	for (i = 0; i < hdr->ninflight + hdr->nfrontier; i++) {
+		put_string(file, urls[i], &len);
+	}
+	fflush(file);
+	failed = ferror(file) || fsync(fileno(file)) < 0;
+	if (fclose(file) != 0 || failed || rename(tmp, path) < 0) {
+		perror("checkpoint: write");
+		unlink(tmp);
+		return -1;
+	}
+	return (int)len;
+}
+
+/*
+Loads the last checkpoint in dir. urls receives a malloc'd array of the
+in-flight URLs followed by the frontier.
+
+@return:
+int, 0 on success, -1 if there is no usable checkpoint
+*/
+int checkpoint_read(char* dir, checkpoint_header* hdr, char*** urls)
+{
+	char path[4096];
+	FILE* file;
+	uint64_t i;
+	uint64_t n;
+
+	checkpoint_path(dir, "checkpoint", path, sizeof(path));
+	file = fopen(path, "r");
+	if (file == NULL) {
+		perror("checkpoint: open");
+		return -1;
+	}
+	if (fread(hdr, sizeof(*hdr), 1, file) != 1 || hdr->magic != CHECKPOINT_MAGIC ||
+	    hdr->version != CHECKPOINT_VERSION) {
+		fprintf(stderr, "checkpoint: %s is not a checkpoint\n", path);
+		fclose(file);
+		return -1;
+	}
+	n = hdr->ninflight + hdr->nfrontier;
+	*urls = malloc(sizeof(char*) * (n ? n : 1));
+	for (i = 0; i < n; i++) {
+		(*urls)[i] = get_string(file);
+		if ((*urls)[i] == NULL) {
+			fprintf(stderr, "checkpoint: %s is truncated\n", path);
+			fclose(file);
+			return -1;
+		}
+	}
+	fclose(file);
+	return 0;
+}
+
+/*
+Feeds the first len bytes of the visited journal to fn.
+
+@return:
+int, 0 on success, -1 if the journal is missing or shorter than len
+*/
+int checkpoint_replay(char* dir, uint64_t len, int (*fn)(char* link))
+{
+	char path[4096];
+	FILE* file;
+	uint64_t pos = 0;
+
+	checkpoint_path(dir, "visited.log", path, sizeof(path));
+	file = fopen(path, "r");
+	if (file == NULL) {
+		perror("checkpoint: open journal");
+		return -1;
+	}
+	while (pos < len) {
+		char* link = get_string(file);
+		if (link == NULL) {
+			fprintf(stderr, "checkpoint: journal shorter than checkpoint\n");
+			fclose(file);
+			return -1;
+		}
+		pos += sizeof(uint32_t) + strlen(link);
+		fn(link);
+		free(link);
+	}
+	fclose(file);
+	return 0;
+}
@@ -0,0 +1,86 @@
+#ifndef __CHECKPOINT_H
+#define __CHECKPOINT_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "lockprof.h"
+
+/*
+On-disk crawl state, kept in one directory:
+
+  visited.log  append-only journal of every URL added to the visited set
+  checkpoint   the last consistent snapshot, replaced atomically by rename
+
+The visited set is journaled as it grows, so a checkpoint never has to copy
+it: the snapshot only records how much of the journal it covers, plus the
+counters, the in-flight URLs (handed to a worker but not yet parsed) and the
+frontier. Strings in both files are stored as a uint32 length followed by
+the bytes, without a terminator.
+*/
+#define CHECKPOINT_MAGIC 0x43524157434b5031ULL
+#define CHECKPOINT_VERSION 1
+
+typedef struct checkpoint_header checkpoint_header;
+typedef struct checkpoint checkpoint;
+typedef struct checkpoint_stats checkpoint_stats;
+
+struct checkpoint_header {
+	uint64_t magic;
+	uint64_t version;
+	uint64_t work_count;
+	uint64_t work_completed;
+	uint64_t journal_len;
+	uint64_t ninflight;
+	uint64_t nfrontier;
+	uint64_t elapsed_us;
+};
+
+/*
+Cost of checkpointing so far. pause_us is the time the crawl was stopped
+while the snapshot was taken, write_us the time spent writing it out in the
+background; elapsed_us and pages put them in proportion to the crawl.
+*/
+struct checkpoint_stats {
+	unsigned long checkpoints;
+	unsigned long bytes;
+	unsigned long pause_us;
+	unsigned long write_us;
+	unsigned long elapsed_us;
+	unsigned long pages;
+};
+
+/*
+New journal entries are staged in memory under lock, which queue holders
+take, and only written out by checkpoint_journal_sync: it swaps staged for
+spare under lock and writes the old buffer with no lock held. journal_failed
+is set once a write fails and fails every checkpoint after it, since the
+journal on disk then has a gap. prof, NULL after checkpoint_open, is where
+lock is profiled.
+*/
+struct checkpoint {
+	char* dir;
+	FILE* journal;
+	uint64_t journal_len;
+	char* staged;
+	size_t staged_len;
+	size_t staged_size;
+	char* spare;
+	size_t spare_size;
+	int journal_failed;
+	pthread_mutex_t* lock;
+	lockprof* prof;
+	pthread_mutex_t* write_lock;
+	checkpoint_stats stats;
+};
+
+int checkpoint_open(checkpoint* ck, char* dir, uint64_t keep);
+void checkpoint_journal_add(checkpoint* ck, char** links, int n);
+uint64_t checkpoint_journal_len(checkpoint* ck);
+int checkpoint_journal_sync(checkpoint* ck);
+int checkpoint_write(checkpoint* ck, checkpoint_header* hdr, char** urls);
+int checkpoint_read(char* dir, checkpoint_header* hdr, char*** urls);
+int checkpoint_replay(char* dir, uint64_t len, int (*fn)(char* link));
+uint64_t checkpoint_now_us(void);
+
+#endif
@@ -0,0 +1,411 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <math.h>
+#include "crawler.h"
+#include "memfetch.h"
+
+/*
+Crawler benchmark. Crawls a page directory (see gen_graph) once for every
+combination of download workers, parse workers and queue size, each run in
+its own child process so peak RSS is per run, and prints one CSV row per
+run for regression tracking.
+
+With -m, pages come from an in-memory corpus of that many generated pages
+instead, and -l injects fetch latency (see memfetch.h), so the numbers show
+how well the pipeline hides I/O as the worker counts change.
+
+-b sweeps frontier batch sizes, as push:pop pairs (see crawl_set_batch).
+
+-S sweeps the spin count before parking (see crawl_set_spin).
+
+-A sweeps worker placement policies: any of none, compact and paired (see
+crawl_set_affinity).
+
+-u sweeps content dedup off and on, as 0 and 1 (see crawl_set_dedup), and
+-D makes that fraction of the in-memory pages have a mirror (see
+webgraph.h), to give it duplicates to find.
+
+-f sweeps execution modes too: any of split, fused and auto (see
+crawl_set_mode).
+
+-T writes a Chrome trace of each run to the given file; with a sweep, the
+last run's trace is what remains.
+
+-H crawls HTML pages with the HTML link extractor (see extract.h): a
+generated corpus with -m, otherwise whatever the directory holds.
+
+-c sweeps streaming with -m: pages are handed to the crawler in pieces of
+that many bytes as they "arrive", the fetch delay spread evenly over the
+pieces, and parsed as they come (see crawl_set_streaming); 0 fetches pages
+whole.
+
+-N sweeps the number of shard processes (see crawl_set_shards); each shard
+runs the given numbers of workers, and the row adds up all the shards.
+
+-g generates each in-memory page as it is fetched instead of holding the
+whole corpus, so peak RSS is the crawler's own; it cannot be combined
+with -c.
+
+-V sweeps the memory budget of the visited set in bytes (see
+crawl_set_visited_store), with its runs in visited_runs under the
+current directory; 0 keeps it all in memory.
+
+-E sweeps the expected number of URLs the visited set is sized for (see
+crawl_set_expected_urls); 0 leaves the default. Each row gives the Bloom
+filter's fill, its measured false positive rate and the rate predicted
+from the fill.
+
+-K sweeps the checkpoint interval in milliseconds (see crawl_set_checkpoint),
+with the checkpoints in bench_checkpoint under the current directory; 0
+does not checkpoint. Each row gives the checkpoints taken and the time the
+crawl stood still for them and spent writing them.
+
+usage: crawl_bench [-d 1,2,4] [-p 1,2,4] [-q 1,16,256] [-f split,fused] [-b 1:1,32:8] [-S 0,200] [-A none,paired] [-u 0,1] [-N 1,4] [-V 0,4194304] [-E 0,20000] [-K 0,100] [-r reps] [-H] dir start
+       crawl_bench -m pages [-g] [-l latency] [-D mirror_fraction] [-d ...] [-p ...] [-q ...] [-f ...] [-b ...] [-S ...] [-A ...] [-u ...] [-c ...] [-N ...] [-V ...] [-E ...] [-K ...] [-r reps] [-H] start
+*/
+
+#define MAX_SWEEP 32
+
+char *mode_names[] = { "split", "fused", "auto" };
+char *affinity_names[] = { "none", "compact", "paired" };
+
+/* Filled in by the child through a shared mapping. */
+typedef struct {
+  unsigned long elapsed_us;
+  unsigned long pages;
+  unsigned long edges;
+  unsigned long frontier_locks;
+  unsigned long parks;
+  unsigned long dup_pages;
+  unsigned long dup_bytes;
+  unsigned long bloom_bits;
+  unsigned long bloom_set;
+  unsigned long bloom_queries;
+  unsigned long bloom_hits;
+  unsigned long bloom_false_positives;
+  unsigned long visited_flushes;
+  unsigned long checkpoints;
+  unsigned long checkpoint_pause_us;
+  unsigned long checkpoint_write_us;
+} bench_result;
+
+bench_result *result;
+char *latency_spec = "none";
+char *trace_file = NULL;
+char *visited_runs;
+char *checkpoint_runs;
+int html = 0;
+long chunk = 0;
+
+void *Malloc(size_t size) {
+  void *r = malloc(size);
+  assert(r);
+  return r;
+}
+
+char *fetch(char *link) {
+  int fd = open(link, O_RDONLY);
+  if (fd < 0) {
+    perror("failed to open file");
+    return NULL;
+  }
+  int size = lseek(fd, 0, SEEK_END);
+  assert(size >= 0);
+  char *buf = Malloc(size+1);
+  buf[size] = '\0';
+  lseek(fd, 0, SEEK_SET);
+  char *pos = buf;
+  while(pos < buf+size) {
+    int rv = read(fd, pos, buf+size-pos);
+    assert(rv > 0);
+    pos += rv;
+  }
+  close(fd);
+  return buf;
+}
+
+/*
+fetch_fn for -c: streams the in-memory page chunk bytes at a time, sleeping
+the share of the fetch delay each piece stands for before handing it over.
+*/
+char *stream_fetch(char *link) {
+  double delay;
+  long length, off;
+  char *page;
+
+  if (!crawl_fetch_streaming())
+    return memfetch_fetch(link);
+  delay = memfetch_delay_us();
+  page = memfetch_page(link, &length);
+  if (page == NULL) {
+    memfetch_sleep_us(delay);
+    return NULL;
+  }
+  for (off = 0; off < length; off += chunk) {
+    long n = length - off < chunk ? length - off : chunk;
+    memfetch_sleep_us(delay * n / length);
+    crawl_fetch_chunk(page + off, n);
+  }
+  return CRAWL_STREAMED;
+}
+
+void edge(char *from, char *to) {
+}
+
+/* Every shard of a sharded crawl records, so the counts are summed. */
+void record(crawl_stats *stats) {
+  checkpoint_stats ck;
+  unsigned long elapsed = result->elapsed_us;
+  while (stats->elapsed_us > elapsed &&
+	 !__atomic_compare_exchange_n(&result->elapsed_us, &elapsed, stats->elapsed_us, 0, __ATOMIC_SEQ_CST,
+				      __ATOMIC_SEQ_CST))
+    ;
+  __atomic_add_fetch(&result->pages, stats->pages_parsed, __ATOMIC_SEQ_CST);
+  __atomic_add_fetch(&result->edges, stats->links_seen, __ATOMIC_SEQ_CST);
+  __atomic_add_fetch(&result->frontier_locks, stats->frontier_locks, __ATOMIC_SEQ_CST);
+  __atomic_add_fetch(&result->parks, stats->parks, __ATOMIC_SEQ_CST);
+  __atomic_add_fetch(&result->dup_pages, stats->dup_pages, __ATOMIC_SEQ_CST);
+  __atomic_add_fetch(&result->dup_bytes, stats->dup_bytes, __ATOMIC_SEQ_CST);
+  __atomic_add_fetch(&result->bloom_bits, stats->bloom.nbits, __ATOMIC_SEQ_CST);
+  __atomic_add_fetch(&result->bloom_set, (unsigned long)(stats->bloom.fill * stats->bloom.nbits), __ATOMIC_SEQ_CST);
+  __atomic_add_fetch(&result->bloom_queries, stats->bloom.queries, __ATOMIC_SEQ_CST);
+  __atomic_add_fetch(&result->bloom_hits, stats->bloom.hits, __ATOMIC_SEQ_CST);
+  __atomic_add_fetch(&result->bloom_false_positives, stats->bloom.false_positives, __ATOMIC_SEQ_CST);
+  __atomic_add_fetch(&result->visited_flushes, stats->visited_flushes, __ATOMIC_SEQ_CST);
+  crawl_checkpoint_stats(&ck);
+  __atomic_add_fetch(&result->checkpoints, ck.checkpoints, __ATOMIC_SEQ_CST);
+  __atomic_add_fetch(&result->checkpoint_pause_us, ck.pause_us, __ATOMIC_SEQ_CST);
+  __atomic_add_fetch(&result->checkpoint_write_us, ck.write_us, __ATOMIC_SEQ_CST);
+}
+
+int parse_names(char *arg, char **names, int nnames, int *list) {
+  int n = 0;
+  char *save;
+  char *tok = strtok_r(arg, ",", &save);
+  while (tok != NULL && n < MAX_SWEEP) {
+    int m;
+    for (m = 0; m < nnames && strcmp(tok, names[m]); m++)
+      ;
+    assert(m < nnames);
+    list[n++] = m;
+    tok = strtok_r(NULL, ",", &save);
+  }
+  return n;
+}
+
+int parse_batches(char *arg, int *push, int *pop) {
+  int n = 0;
+  char *save;
+  char *tok = strtok_r(arg, ",", &save);
+  while (tok != NULL && n < MAX_SWEEP) {
+    if (sscanf(tok, "%d:%d", &push[n], &pop[n]) != 2) {
+      fprintf(stderr, "bad batch %s\n", tok);
+      exit(1);
+    }
+    n++;
+    tok = strtok_r(NULL, ",", &save);
+  }
+  return n;
+}
+
+int parse_list(char *arg, int *list) {
+  int n = 0;
+  char *save;
+  char *tok = strtok_r(arg, ",", &save);
+  while (tok != NULL && n < MAX_SWEEP) {
+    list[n++] = atoi(tok);
+    tok = strtok_r(NULL, ",", &save);
+  }
+  return n;
+}
+
+/*
+Runs one crawl in a child process and prints its CSV row.
+*/
+void run(char *start, int d, int p, int q, int mode, int push, int pop, int spin,
+	 int affinity, int dedup, long chunk_bytes, int nshards, long budget, long expected, int checkpoint_ms, char * (*fetch_fn)(char *url)) {
+  struct rusage ru;
+  int status;
+  double fill, negatives;
+  memset(result, 0, sizeof(*result));
+  fflush(stdout);
+  pid_t pid = fork();
+  assert(pid >= 0);
+  if (pid == 0) {
+    crawl_set_stats(0, record);
+    crawl_set_mode(mode);
+    crawl_set_batch(push, pop);
+    crawl_set_spin(spin);
+    crawl_set_affinity(affinity);
+    crawl_set_dedup(dedup);
+    chunk = chunk_bytes;
+    crawl_set_streaming(chunk > 0);
+    crawl_set_shards(nshards);
+    crawl_set_expected_urls(expected);
+    if (budget > 0)
+      crawl_set_visited_store(visited_runs, budget);
+    if (checkpoint_ms > 0)
+      crawl_set_checkpoint(checkpoint_runs, checkpoint_ms);
+    if (trace_file != NULL)
+      crawl_set_trace(trace_file, 0);
+    if (html)
+      crawl_set_extractor(extract_html_hrefs);
+    exit(crawl(start, d, p, q, fetch_fn, edge) == 0 ? 0 : 1);
+  }
+  if (wait4(pid, &status, 0, &ru) != pid) {
+    perror("wait4");
+    exit(1);
+  }
+  double secs = result->elapsed_us / 1e6;
+  long csw = ru.ru_nvcsw + ru.ru_nivcsw;
+  /* Negatives are always new URLs, so new URLs are all the queries but the hits. */
+  fill = result->bloom_bits ? (double)result->bloom_set / result->bloom_bits : 0.0;
+  negatives = result->bloom_queries - result->bloom_hits;
+  printf("%d,%d,%d,%s,%d,%d,%d,%s,%d,%ld,%d,%ld,%ld,%d,%s,%lu,%lu,%.6f,%.1f,%.1f,%.2f,%ld,%ld,%.3f,%.3f,%lu,%lu,%.4f,%.6f,%.6f,%lu,%lu,%.3f,%.3f,%d\n", d, p, q,
+	 mode_names[mode], push, pop, spin, affinity_names[affinity], dedup, chunk_bytes, nshards, budget, expected, checkpoint_ms, latency_spec,
+	 result->pages, result->edges, secs,
+	 secs > 0 ? result->pages / secs : 0.0, secs > 0 ? result->edges / secs : 0.0,
+	 result->pages ? (double)result->frontier_locks / result->pages : 0.0,
+	 ru.ru_maxrss, csw, result->pages ? (double)csw / result->pages : 0.0,
+	 result->pages ? (double)result->parks / result->pages : 0.0,
+	 result->dup_pages, result->dup_bytes, fill,
+	 negatives > 0 ? result->bloom_false_positives / negatives : 0.0, pow(fill, BLOOM_K), result->visited_flushes,
+	 result->checkpoints, result->checkpoint_pause_us / 1e3, result->checkpoint_write_us / 1e3,
+	 WIFEXITED(status) ? WEXITSTATUS(status) : -1);
+  fflush(stdout);
+}
+
+int main(int argc, char *argv[]) {
+  int dws[MAX_SWEEP] = {1, 2, 4, 8};
+  int pws[MAX_SWEEP] = {1, 2, 4, 8};
+  int qs[MAX_SWEEP] = {1, 16, 256};
+  int modes[MAX_SWEEP] = {CRAWL_SPLIT};
+  int pushes[MAX_SWEEP] = {CRAWL_DEFAULT_PUSH_BATCH};
+  int pops[MAX_SWEEP] = {CRAWL_DEFAULT_POP_BATCH};
+  int spins[MAX_SWEEP] = {-1};
+  int affinities[MAX_SWEEP] = {CRAWL_AFFINITY_NONE};
+  int dedups[MAX_SWEEP] = {0};
+  int chunks[MAX_SWEEP] = {0};
+  int shard_counts[MAX_SWEEP] = {1};
+  int budgets[MAX_SWEEP] = {0};
+  int expecteds[MAX_SWEEP] = {0};
+  int intervals[MAX_SWEEP] = {0};
+  int nd = 4, np = 4, nq = 3, nm = 1, nb = 1, ns = 1, na = 1, nu = 1, nc = 1, nn = 1, nv = 1, ne = 1, nk = 1, reps = 1;
+  int lazy = 0;
+  char cwd[4096];
+  char ck_dir[4096];
+  long mem_pages = 0;
+  double mirror_fraction = 0;
+  memfetch_latency latency;
+  char * (*fetch_fn)(char *url) = fetch;
+  int c, i, j, k, m, b, sp, a, u, ch, n, v, e, ck, r, rc;
+
+  memfetch_parse_latency(latency_spec, &latency);
+  while ((c = getopt(argc, argv, "d:p:q:f:b:S:A:u:c:N:V:E:K:r:m:gl:D:T:H")) != -1) {
+    switch (c) {
+    case 'd': nd = parse_list(optarg, dws); break;
+    case 'p': np = parse_list(optarg, pws); break;
+    case 'q': nq = parse_list(optarg, qs); break;
+    case 'S': ns = parse_list(optarg, spins); break;
+    case 'b': nb = parse_batches(optarg, pushes, pops); break;
+    case 'f': nm = parse_names(optarg, mode_names, 3, modes); break;
+    case 'A': na = parse_names(optarg, affinity_names, 3, affinities); break;
+    case 'u': nu = parse_list(optarg, dedups); break;
+    case 'c': nc = parse_list(optarg, chunks); break;
+    case 'N': nn = parse_list(optarg, shard_counts); break;
+    case 'V': nv = parse_list(optarg, budgets); break;
+    case 'E': ne = parse_list(optarg, expecteds); break;
+    case 'K': nk = parse_list(optarg, intervals); break;
+    case 'D': mirror_fraction = atof(optarg); break;
+    case 'r': reps = atoi(optarg); break;
+    case 'T': trace_file = optarg; break;
+    case 'H': html = 1; break;
+    case 'm': mem_pages = atol(optarg); break;
+    case 'g': lazy = 1; break;
+    case 'l':
+      latency_spec = optarg;
+      if (memfetch_parse_latency(optarg, &latency) < 0) {
+	fprintf(stderr, "bad latency %s\n", optarg);
+	return 1;
+      }
+      break;
+    default:
+      fprintf(stderr, "usage: %s [-d list] [-p list] [-q list] [-f modes] [-b batches] [-S spins] [-A policies] [-u dedups] [-N shards] [-V bytes] [-E urls] [-K ms] [-r reps] [-H] dir start\n"
+	      "       %s -m pages [-g] [-l latency] [-D mirror_fraction] [-d list] [-p list] [-q list] [-f modes] [-b batches]\n"
+	      "       [-S spins] [-A policies] [-u dedups] [-c chunks] [-N shards] [-V bytes] [-E urls] [-K ms] [-r reps] [-H] start\n",
+	      argv[0], argv[0]);
+      return 1;
+    }
+  }
+  if (getcwd(cwd, sizeof(cwd) - 32) == NULL) {
+    perror("getcwd");
+    return 1;
+  }
+  strcpy(ck_dir, cwd);
+  strcat(cwd, "/visited_runs");
+  visited_runs = cwd;
+  strcat(ck_dir, "/bench_checkpoint");
+  checkpoint_runs = ck_dir;
+  if (mem_pages > 0) {
+    webgraph_params params;
+    webgraph_defaults(&params);
+    params.pages = mem_pages;
+    params.mirror_fraction = mirror_fraction;
+    params.html = html;
+    assert(optind == argc - 1);
+    if (lazy) {
+      for (ch = 0; ch < nc; ch++)
+	assert(chunks[ch] == 0);
+      rc = memfetch_init_lazy(&params, &latency);
+    } else {
+      rc = memfetch_init(&params, &latency);
+    }
+    if (rc < 0) {
+      fprintf(stderr, "cannot generate %ld pages\n", mem_pages);
+      return 1;
+    }
+    fetch_fn = stream_fetch;
+  } else {
+    assert(optind == argc - 2);
+    if (chdir(argv[optind]) < 0) {
+      perror(argv[optind]);
+      return 1;
+    }
+    optind++;
+  }
+  result = mmap(NULL, sizeof(bench_result), PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  assert(result != MAP_FAILED);
+
+  printf("download_workers,parse_workers,queue_size,mode,push_batch,pop_batch,spin,affinity,dedup,chunk,shards,visited_budget,expected_urls,checkpoint_ms,latency,pages,edges,"
+	 "seconds,pages_per_s,edges_per_s,locks_per_page,peak_rss_kb,context_switches,"
+	 "switches_per_page,parks_per_page,dup_pages,dup_bytes,bloom_fill,bloom_fp_rate,bloom_est_fp_rate,visited_flushes,"
+	 "checkpoints,checkpoint_pause_ms,checkpoint_write_ms,status\n");
+  for (i = 0; i < nd; i++)
+    for (j = 0; j < np; j++)
+      for (k = 0; k < nq; k++)
+	for (m = 0; m < nm; m++)
+	  for (b = 0; b < nb; b++)
+	    for (sp = 0; sp < ns; sp++)
+	      for (a = 0; a < na; a++)
+		for (u = 0; u < nu; u++)
+		  for (ch = 0; ch < nc; ch++)
+		    for (n = 0; n < nn; n++)
+		      for (v = 0; v < nv; v++)
+			for (e = 0; e < ne; e++)
+			  for (ck = 0; ck < nk; ck++)
+			    for (r = 0; r < reps; r++)
+			      run(argv[optind], dws[i], pws[j], qs[k], modes[m], pushes[b], pops[b], spins[sp],
+				  affinities[a], dedups[u], chunks[ch], shard_counts[n], budgets[v], expecteds[e],
+				  intervals[ck], fetch_fn);
+  return 0;
+}
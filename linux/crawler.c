@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <stdlib.h>
 #include <unistd.h>
 #include <stdio.h>
@@ -5,58 +6,114 @@
 #include <assert.h>
 #include <stdint.h>
 #include <pthread.h>
+#include <time.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include "crawler.h"
+#include "bloom.h"
+#include "hashtable.h"
+#include "visited.h"
+#include "checkpoint.h"
+#include "stats.h"
+#include "trace.h"
+#include "wake.h"
+#include "topo.h"
+#include "dedup.h"
+#include "recrawl.h"
+#include "graph.h"
+#include "urlnorm.h"
+#include "urlfilter.h"
+#include "extract.h"
+#include "lockprof.h"
+#include "shard.h"
 
 //Forward declarations:
 struct u_queue_node;
-struct bucket;
-struct hashtable;
 struct u_queue;
 struct b_queue;
+struct page_meta;
+struct parse_state;
 
 typedef struct u_queue_node u_queue_node;
-typedef struct bucket bucket;
-typedef struct hashtable hashtable;
 typedef struct u_queue u_queue;
 typedef struct b_queue b_queue;
+typedef struct page_meta page_meta;
+typedef struct parse_state parse_state;
 
-int interrupted_u_enqueue = 0;
+/*
+Lock profiles, see lockprof.h. Every mutex the workers share is taken
+through LOCK and UNLOCK with the index of its profile here; with
+CRAWL_LOCK_PROFILE compiled in, the profiles are printed to stderr when
+the crawl ends. The visited store and checkpoint take their own mutexes and
+are pointed at their profiles here; each shard ring's send lock has its own
+profile in send_profs.
+*/
+#define PROF_FRONTIER 0
+#define PROF_PARSE_QUEUE 1
+#define PROF_VISITED 2
+#define PROF_DONE 3
+#define PROF_SAMPLES 4
+#define PROF_CHECKPOINT 5
+#define PROF_CHECKPOINT_WRITE 6
+#define PROF_VISITED_STORE 7
+#define NPROFS 8
+
+lockprof lock_profiles[NPROFS] = {
+    LOCKPROF_INIT("download_queue->lock"),
+    LOCKPROF_INIT("parse_queue->lock"),
+    LOCKPROF_INIT("links_visited->lock"),
+    LOCKPROF_INIT("lock (not_done)"),
+    LOCKPROF_INIT("samples_lock"),
+    LOCKPROF_INIT("crawl_ck->lock"),
+    LOCKPROF_INIT("crawl_ck->write_lock"),
+    LOCKPROF_INIT("visited_spill->lock"),
+};
+
+#define LOCK(mutex, prof) LOCKPROF_LOCK(&lock_profiles[prof], mutex)
+#define UNLOCK(mutex, prof) LOCKPROF_UNLOCK(&lock_profiles[prof], mutex)
 
 void u_queue_init(u_queue* initqueue);
 void b_queue_init(b_queue* queue, int queue_size);
-unsigned long hash(char *str);
-void hash_init(hashtable *tbl, int size);
-int hash_find_insert(hashtable *tbl, char* link);
-int u_enqueue(u_queue* queue, char* url, char* page);
+int u_enqueue(u_queue* queue, char* url, char* page, page_meta* meta);
+char* u_load(u_queue* queue, u_queue_node* node);
 void b_enqueue(b_queue* queue, char* url);
 u_queue_node* u_dequeue(u_queue* queue);
 int u_isempty(u_queue* queue);
 int b_isfull(b_queue* queue);
 
+/*
+What the fetcher learned about a page besides its body: the fingerprint
+(only computed with dedup or recrawl on), the validators fetch_fn reported,
+malloc'd or NULL, and, for a page unchanged since the last crawl, that
+crawl's record of it in reuse. Travels with the page to whoever parses it.
+*/
+struct page_meta {
+    dedup_fp fp;
+    char* etag;
+    char* last_modified;
+    recrawl_record* reuse;
+};
+
 /*
 This is a single node for the unbounded queue type. Has two members:
 char* content
 and
 u_queue_node* next
 A string that contains the content of that node and a pointer to the next node in the queue.
+length is the size of the content; when the page was spilled to disk content is NULL
+and spill_off gives its position in the spill file. meta is what the downloader
+learned about the page.
 */
 struct u_queue_node {
     char* content;
     char* from_link;
+    long length;
+    long spill_off;
+    page_meta meta;
     u_queue_node* next;
     u_queue_node* prev;
 };
 
-struct bucket {
-    bucket* next;
-    char* link;
-};
-
-struct hashtable {
-    bucket** table;
-    int max;
-    pthread_mutex_t* lock;
-};
-
 /*
 In the specification for the problem, there is an unbounded queue for downloaders to send work
 to parers. The parse_queue implements this unbounded queue. All of the unbounded queue functions
@@ -69,14 +126,30 @@ This is the unbounded queue type. Use to send work from downloaders to parsers.
 Contains two pointers to nodes, one to point to the front of the queue and one
 to point to the end of the queue (back);
 Also contains a int size in order to show whether or not the queue is empty or not.
-It also contains a single mutex and two condition variables for thread messaging.
+It also contains a single mutex and two wait queues (see wake.h) for thread messaging.
+
+bytes counts the page bytes held in memory. When max_bytes is set, downloaders wait
+on full while bytes is over it, or, if spill_fd is open, append the page to the spill
+file instead and the parser reads it back when the node reaches the front.
+spill_pending counts spilled pages not yet read back; the file is truncated when it
+drops to zero.
 */
 struct u_queue {
 	u_queue_node* front;
 	u_queue_node* back;
 	int size;
+	long bytes;
+	long max_bytes;
+	long peak_bytes;
+	int spill_fd;
+	long spill_end;
+	int spill_pending;
+	unsigned long spilled;
+	unsigned long spilled_bytes;
+	unsigned long full_waits;
 	pthread_mutex_t* lock;
-	pthread_cond_t* empty;
+	waitq* empty;
+	waitq* full;
 } ;
 
 /*
@@ -84,7 +157,7 @@ This is the struct for the bounded queue, which is used by download_queue. It al
 to send work to the downloaders.
 It has an array that functions as the bounded queue and two integers to track position
 int size determines whether or not the queue is empty or full.
-It contains a mutex, lock, and two condition variables, full and empty.
+It contains a mutex, lock, and two wait queues, full and empty.
 */
 struct b_queue {
 	char** array;
@@ -93,8 +166,8 @@ struct b_queue {
 	int max;
 	int size;
 	pthread_mutex_t* lock;
-	pthread_cond_t* empty;
-	pthread_cond_t* full;
+	waitq* empty;
+	waitq* full;
 };
 
 /*
@@ -104,23 +177,34 @@ void u_queue_init: Given an pointer to an uninitialized queue, inits it.
 u_queue* initqueue, The queue to be initialized.
 Sets all initial pointers to NULL,
 Sets size to 0,
-Initializes the lock and condition variables it contains.
+Initializes the lock and wait queues it contains.
 */
 void u_queue_init(u_queue* initqueue)
 {
 	initqueue->front = NULL;
 	initqueue->back = NULL;
 	initqueue->size = 0;
+	initqueue->bytes = 0;
+	initqueue->max_bytes = 0;
+	initqueue->peak_bytes = 0;
+	initqueue->spill_fd = -1;
+	initqueue->spill_end = 0;
+	initqueue->spill_pending = 0;
+	initqueue->spilled = 0;
+	initqueue->spilled_bytes = 0;
+	initqueue->full_waits = 0;
 	initqueue->lock = malloc(sizeof(pthread_mutex_t));
 	pthread_mutex_init(initqueue->lock, NULL);
-	initqueue->empty = malloc(sizeof(pthread_cond_t));
-	pthread_cond_init(initqueue->empty, NULL);
+	initqueue->empty = malloc(sizeof(waitq));
+	waitq_init(initqueue->empty);
+	initqueue->full = malloc(sizeof(waitq));
+	waitq_init(initqueue->full);
 }
 
 /*
 Initializes a b_queue by setting both front and back positions to 0, size to 0,
 allocating the array used as the queue and initializing
-the mutex and condition variables using the pthread functions.
+the mutex and wait queues.
 */
 void b_queue_init(b_queue* queue, int queue_size)
 {
@@ -131,119 +215,95 @@ void b_queue_init(b_queue* queue, int queue_size)
 	queue->array = malloc(sizeof(char*) * queue_size);
 	queue->lock = malloc(sizeof(pthread_mutex_t));
 	pthread_mutex_init(queue->lock, NULL);
-	queue->empty = malloc(sizeof(pthread_cond_t));
-	pthread_cond_init(queue->empty, NULL);
-	queue->full = malloc(sizeof(pthread_cond_t));
-	pthread_cond_init(queue->full, NULL);
-}
-
-void hash_init(hashtable* tbl, int size) {
-	tbl->max = size;
-	tbl->table = malloc(sizeof(bucket) * size);
-	tbl->lock = malloc(sizeof(pthread_mutex_t));
-	pthread_mutex_init(tbl->lock, NULL);
+	queue->empty = malloc(sizeof(waitq));
+	waitq_init(queue->empty);
+	queue->full = malloc(sizeof(waitq));
+	waitq_init(queue->full);
 }
 
 /*
-The function for the hash table.
-
-@params:
-unsigned char *str, the string to be hashed (url)
-@return:
-unsigned long, the computed key
-
-**NOTE: this is the djb2 function created by Dan Bernstein for strings.**
-Source: http://www.cse.yorku.ca/~oz/hash.html
-*/
-unsigned long hash(char *str)
-{
-        unsigned long hash = 5381;
-        int c;
-        int i;
-        for (i = 0; str[i] != 0; i++)
-        {
-            c = str[i];
-            hash = ((hash << 5) + hash) + c; /* hash * 33 + c */
-        }
-
-        return hash;
-}
-
-int hash_find_insert(hashtable *tbl, char* link) {
-	
-        unsigned long key = hash(link) % (tbl->max);
-        int found = 0;
-        int insert = 0;
-        
-        if(tbl->table[key] == NULL) {
-        	tbl->table[key] = malloc(sizeof(bucket));
-        	(tbl->table[key])->next = NULL;
-        	(tbl->table[key])->link = malloc(sizeof(char) * (int)strlen(link));
-        	(tbl->table[key])->link = strcpy((tbl->table[key])->link, link);
-        	if( *((tbl->table[key])->link + (int)strlen(link) - 1) != '\0') {
-        		*((tbl->table[key])->link + (int)strlen(link) - 1) = '\0';
-        	} 
-        }
-        else {
-        	bucket* copy = tbl->table[key];
-                while(!insert && !found) {
-                       if(strcmp(copy->link, link) == 0) {
-                               found = 1;
-                       }
-                       else if(copy->next == NULL) {
-                               bucket* new_b = malloc(sizeof(bucket));
-                               new_b->next = NULL;
-                               new_b->link = link;
-                               copy->next = new_b;
-                               insert = 1;
-                        }
-                        else {
-                               copy = copy->next;
-                        }
-                }
-        }
-        return found;
-}
-
-/*
-void u_enqueue: Adds a new node to the end of the queue
+void u_enqueue: Adds a new node to the end of the queue. The queue takes ownership of
+both strings. If the queue is over its byte budget and has a spill file, the page is
+written there and freed instead of being kept in memory.
 
 @params:
 struct u_queue* queue, the queue to be operated on.
 char* url, the url used to find the page contents.
 char* page, the page contents that will be parsed.
+page_meta* meta, copied into the node.
 */
-int u_enqueue(struct u_queue* queue, char* url, char* page)
+int u_enqueue(struct u_queue* queue, char* url, char* page, page_meta* meta)
 {
     if(queue == NULL || url == NULL) { return -1; }
     struct u_queue_node* newnode;
     newnode = (struct u_queue_node*)malloc(sizeof(struct u_queue_node));
-    newnode->content = malloc(sizeof(char) * (int)strlen(page) + 1);
-    newnode->from_link = malloc(sizeof(char) * (int)strlen(url) + 1);
-    newnode->next = malloc(sizeof(u_queue_node));
-    newnode->prev = malloc(sizeof(u_queue_node));
     if (newnode == NULL) {
     	fprintf(stderr, "Malloc failed\n");
     	return -1;
     }
+    newnode->content = page;
+    newnode->from_link = url;
+    newnode->length = strlen(page);
+    newnode->spill_off = -1;
+    newnode->meta = *meta;
+    if(queue->max_bytes > 0 && queue->spill_fd >= 0 && queue->bytes > 0 &&
+       queue->bytes + newnode->length > queue->max_bytes) {
+    	if(pwrite(queue->spill_fd, page, newnode->length, queue->spill_end) == newnode->length) {
+    		newnode->spill_off = queue->spill_end;
+    		newnode->content = NULL;
+    		queue->spill_end += newnode->length;
+    		queue->spill_pending++;
+    		queue->spilled++;
+    		queue->spilled_bytes += newnode->length;
+    		free(page);
+    	}
+    }
+    if(newnode->content != NULL) {
+    	queue->bytes += newnode->length;
+    	if(queue->bytes > queue->peak_bytes) {
+    		queue->peak_bytes = queue->bytes;
+    	}
+    }
     queue->size++;
-    newnode->content = strcpy(newnode->content, page);
-    newnode->from_link = strcpy(newnode->from_link, url);
-    if(queue->size == 1 || (queue->size == 2 && interrupted_u_enqueue) ) {
-    	 newnode->next = NULL;
-    	 newnode->prev = NULL;
-    	 queue->front = newnode;
-    	 queue->back = newnode;
+    newnode->next = queue->back;
+    newnode->prev = NULL;
+    if(queue->back != NULL) {
+    	queue->back->prev = newnode;
     }
     else {
-    	newnode->next = queue->back;
-    	queue->back->prev = newnode;
-    	newnode->prev = NULL;
-    	queue->back = newnode;
+    	queue->front = newnode;
     }
+    queue->back = newnode;
     return 0;
 }
 
+/*
+char* u_load: Returns the content of a dequeued node, reading it back from the spill
+file if it was spilled. Called without the queue lock held.
+*/
+char* u_load(struct u_queue* queue, u_queue_node* node)
+{
+    if(node->content != NULL) {
+    	return node->content;
+    }
+    node->content = malloc(node->length + 1);
+    if(pread(queue->spill_fd, node->content, node->length, node->spill_off) != node->length) {
+    	fprintf(stderr, "Failed to read spilled page %s\n", node->from_link);
+    	node->length = 0;
+    }
+    node->content[node->length] = '\0';
+    LOCK(queue->lock, PROF_PARSE_QUEUE);
+    queue->spill_pending--;
+    if(queue->spill_pending == 0) {
+    	queue->spill_end = 0;
+    	if(ftruncate(queue->spill_fd, 0) < 0) {
+    		perror("ftruncate");
+    	}
+    }
+    UNLOCK(queue->lock, PROF_PARSE_QUEUE);
+    return node->content;
+}
+
 /*
 Adds a new node to the end of the b_queue.
 
@@ -278,9 +338,29 @@ u_queue_node* u_dequeue(struct u_queue* queue)
     if(u_isempty(queue)) {
     	queue->back = NULL;
     }
+    if(copy->content != NULL) {
+    	queue->bytes -= copy->length;
+    }
     return copy;
 }
 
+/*
+Doubles the capacity of a b_queue, unrolling the ring into the new array.
+*/
+void b_grow(struct b_queue* queue)
+{
+    char** array = malloc(sizeof(char*) * queue->max * 2);
+    int i;
+    for(i = 0; i < queue->size; i++) {
+    	array[i] = queue->array[(queue->front + i) % queue->max];
+    }
+    free(queue->array);
+    queue->array = array;
+    queue->front = 0;
+    queue->back = queue->size;
+    queue->max *= 2;
+}
+
 char* b_dequeue(struct b_queue* queue)
 {
     char* url = queue->array[queue->front];
@@ -320,171 +400,2203 @@ int b_isfull(struct b_queue* queue)
 u_queue* parse_queue;
 b_queue* download_queue;
 hashtable* links_visited;
+bloom_filter* links_seen;
+visited_store* visited_spill = NULL;
+long expected_urls = 0;
+char* visited_dir = NULL;
+long visited_max_resident = 0;
+
+/*
+Checkpoint state. worker_urls holds, per worker thread, the URLs it has
+taken off a queue and not yet handed on (downloaders) or finished parsing
+(parsers); each worker owns worker_url_slots consecutive entries, one per
+URL of a batch it dequeued. Entries only change under the lock of the queue
+involved, so holding both queue locks gives a consistent view of in-flight
+work.
+
+The checkpointer copies only the pointers in those entries, and walks the
+parse queue after dropping the locks. While it runs, checkpoint_pinned is
+set and pinned_free() parks any URL or parse queue node a worker is done
+with in pinned instead of freeing it; the checkpointer frees them once the
+checkpoint is written. Both are guarded by crawl_ck->lock. The copies go to
+checkpoint_urls, which only the checkpointer touches and which is kept
+between checkpoints so none is allocated under the queue locks.
+*/
+checkpoint* crawl_ck = NULL;
+char* checkpoint_dir = NULL;
+int checkpoint_interval_ms = 0;
+int checkpoint_pinned = 0;
+void** pinned = NULL;
+int npinned = 0;
+int pinned_size = 0;
+char** checkpoint_urls = NULL;
+int checkpoint_urls_size = 0;
+char** worker_urls;
+int worker_url_slots = 1;
+int next_worker_slot = 0;
+__thread int worker_slot;
+uint64_t crawl_start_us;
+
+#define MY_URLS (&worker_urls[worker_slot * worker_url_slots])
+
+/*
+Frontier batching, see crawl_set_batch(). Parsers stage up to push_batch
+new URLs and add them with one lock acquisition; downloaders take up to
+pop_batch URLs per acquisition.
+*/
+int push_batch = CRAWL_DEFAULT_PUSH_BATCH;
+int pop_batch = CRAWL_DEFAULT_POP_BATCH;
+
+/*
+Metrics. thread_stats has one padded entry per worker, indexed by
+worker_slot. The sampler records queue depths every sample_interval_ms.
+*/
+stats_thread* thread_stats = NULL;
+int nthread_stats = 0;
+stats_sample* depth_samples = NULL;
+int ndepth_samples = 0;
+int sample_interval_ms = 10;
+pthread_mutex_t samples_lock = PTHREAD_MUTEX_INITIALIZER;
+void (*stats_fn)(crawl_stats* stats) = NULL;
+
+#define MY_STATS (&thread_stats[worker_slot])
+
+/* Takes the frontier lock from a worker thread, counting the acquisition. */
+#define FRONTIER_LOCK() do { \
+    LOCK(download_queue->lock, PROF_FRONTIER); \
+    MY_STATS->frontier_locks++; \
+} while(0)
+
+/*
+Tracing, off unless crawl_set_trace() names a file. trace_rings has one
+ring per worker, indexed by worker_slot like thread_stats.
+*/
+trace_ring* trace_rings = NULL;
+char* trace_path = NULL;
+int trace_events = 0;
+uint64_t trace_base_ns;
+
+#define TRACE_NOW() (trace_rings != NULL ? stats_now_ns() : 0)
+#define TRACE(type, t0, url) do { \
+    if(trace_rings != NULL) { \
+    	trace_add(&trace_rings[worker_slot], type, t0, stats_now_ns(), url); \
+    } \
+} while(0)
+
+/*
+Worker placement policy, see crawl_set_affinity().
+*/
+int affinity_policy = CRAWL_AFFINITY_NONE;
+
+/*
+Spin iterations before a waiter parks, see crawl_set_spin(). -1 picks
+WAKE_DEFAULT_SPIN with more than one CPU online and 0 otherwise.
+*/
+int wake_spin = -1;
+
+/*
+Content dedup, see crawl_set_dedup(). page_fingerprints holds the
+fingerprint of every page fetched so far, NULL unless dedup is on.
+*/
+int dedup_on = 0;
+dedup_set* page_fingerprints = NULL;
+
+/*
+Recrawl, see crawl_set_recrawl(). recrawl holds the last crawl's records
+and collects this one's. While a worker is in fetch_fn, fetch_prev is the
+last crawl's record for the URL (NULL if none) and fetch_etag and
+fetch_last_modified are the validators fetch_fn reported, if any.
+crawl_not_modified is only used for its address.
+*/
+char* recrawl_path = NULL;
+recrawl_store* recrawl = NULL;
+__thread recrawl_record* fetch_prev;
+__thread char* fetch_etag;
+__thread char* fetch_last_modified;
+char crawl_not_modified[1];
+
+/*
+CRAWL_AUTO's first fetch of the start URL, see crawl_probe_mode(): the page,
+the validators fetch_fn reported for it and how long it took. The worker
+that takes probe_url off the frontier uses them instead of fetching it
+again.
+*/
+char* probe_url = NULL;
+char* probe_page = NULL;
+char* probe_etag = NULL;
+char* probe_last_modified = NULL;
+uint64_t probe_fetch_ns = 0;
+
+/*
+Link graph, see crawl_set_graph(). link_graph collects every link found on
+a parsed page, by worker_slot, NULL unless graph_path names a file.
+*/
+char* graph_path = NULL;
+graph_sink* link_graph = NULL;
+
+/*
+URL normalization, see crawl_set_normalize(). On unless turned off.
+*/
+int normalize_urls = 1;
+
+/*
+URL filter, see crawl_set_filter(). url_filter is NULL unless filter_path
+names a rules file.
+*/
+char* filter_path = NULL;
+urlfilter* url_filter = NULL;
+
+/*
+Link extractor, see crawl_set_extractor().
+*/
+extract_fn link_extractor = extract_link_tokens;
+
+/*
+Streaming, see crawl_set_streaming(). While a worker is in fetch_fn on a
+page that may be streamed, fetch_stream is where crawl_fetch_chunk() sends
+the pieces, NULL otherwise. crawl_streamed is only used for its address.
+*/
+int streaming = 0;
+__thread parse_state* fetch_stream;
+char crawl_streamed[1];
+
+/*
+Retries, see crawl_set_retries(). retry_heap is a binary min-heap, on
+due_ns, of the URLs waiting to be tried again, protected by
+download_queue->lock like the frontier. url_attempts has how many times
+each URL in this worker's slots was tried before, and retry_rng draws the
+backoff jitter. crawl_retry is only used for its address.
+*/
+typedef struct retry_entry {
+    uint64_t due_ns;
+    int attempt;
+    char* url;
+} retry_entry;
+
+int retry_max = 0;
+int retry_base_ms = 100;
+int retry_max_ms = 10000;
+retry_entry* retry_heap = NULL;
+int nretries = 0;
+int retry_size = 0;
+__thread int url_attempts[CRAWL_MAX_BATCH];
+__thread uint64_t retry_rng;
+char crawl_retry[1];
+
+/*
+Hedging, see crawl_set_hedge(). hedge_ns is the current hedge delay, 0
+until CRAWL_HEDGE_MIN_FETCHES fetches have been timed. Every worker
+recomputes it from all the fetch histograms every HEDGE_REFRESH fetches of
+its own.
+*/
+#define HEDGE_REFRESH 64
+double hedge_percentile = 0;
+unsigned long hedge_ns = 0;
+
+/*
+Sharding, see crawl_set_shards(). shards is the shared map (see shard.h),
+NULL unless this process is shard number shard_index of nshards. A thread
+adding to a ring holds the send lock for the ring's shard, so that each
+ring has one producer at a time. shard_start is the crawl's start URL,
+which CRAWL_AUTO probes with, since a shard may start with an empty
+frontier. exchanger is set in the thread that takes links off the rings.
+*/
+int nshards = 1;
+int shard_index = 0;
+shard_map* shards = NULL;
+pthread_mutex_t* send_locks = NULL;
+lockprof* send_profs = NULL;
+char* shard_start = NULL;
+__thread int exchanger;
+
+/*
+Waits on the wait queue q, adds the time spent to hist and traces it as type.
+mutex is released meanwhile, so its profile prof stops counting it held.
+*/
+#define TIMED_WAIT(hist, type, q, mutex, prof) do { \
+    uint64_t _t0 = stats_now_ns(); \
+    uint64_t _t1; \
+    LOCKPROF_WAIT_BEGIN(&lock_profiles[prof]); \
+    waitq_wait(q, mutex, wake_spin); \
+    LOCKPROF_WAIT_END(&lock_profiles[prof]); \
+    _t1 = stats_now_ns(); \
+    stats_hist_add(hist, _t1 - _t0); \
+    if(trace_rings != NULL) { \
+    	trace_add(&trace_rings[worker_slot], type, _t0, _t1, NULL); \
+    } \
+} while(0)
 int work_count = 0;
 int work_completed = 0;
+int crawl_done = 0;
+int parsers_blocked = 0;
+int downloaders_waiting = 0;
+int download_workers_total = 0;
+long parse_max_bytes = 0;
+int parse_spill = 0;
+
+/*
+Execution mode, see crawl_set_mode(). In fused mode every worker fetches and
+parses its own pages and the parse queue is not used; edge_fn is kept here
+since a fused worker needs both callbacks.
+*/
+int crawl_mode = CRAWL_SPLIT;
+int fused = 0;
+void (*crawl_edge_fn)(char *from, char *to);
 
 pthread_mutex_t* lock;
 pthread_cond_t* not_done;
 
-void parse_page(u_queue_node* node, void (*_edge_fn)(char *from, char *to))
+/*
+Sets the expected number of distinct URLs. Used to size the Bloom filter and
+the visited hash table; a good guess keeps both at their design load.
+*/
+void crawl_set_expected_urls(long n)
 {
-    char* search = "link:";
-    char* save;
-    char* found;
-    int hash_result;
-    int ever_interrupted = 0;
-    int offset = 0;
-    int prev = parse_queue->size;
-    char* copy;
-    
-    do {
-    	copy = malloc(sizeof(char) * ( (int)strlen(node->content) - offset + 1) );
-    	copy = strcpy(copy, node->content + offset);
-    	char* token = strtok_r(copy, " \n", &save);
-    	interrupted_u_enqueue = 0;
-    	
-    	while(token != NULL && !interrupted_u_enqueue) {
-    		if(strncmp(token, search, 5) == 0) {
-    			while(download_queue->size >= download_queue->max) {
-    				if(prev >= parse_queue->size) {
-    					parse_queue->size++;
-    				}
-    				ever_interrupted = 1;
-    				interrupted_u_enqueue = 1;
-    				pthread_cond_signal(parse_queue->empty);
-    				pthread_cond_signal(download_queue->empty);
-    				pthread_cond_wait(download_queue->full, download_queue->lock);
-    			}
-    			if(!interrupted_u_enqueue) {
-    				found = malloc(sizeof(char) * ((int)strlen(token) - 4) );
-    				found = strcpy(found, token + 5);
-    				pthread_mutex_lock(links_visited->lock);
-    				hash_result = hash_find_insert(links_visited, found);
-    				pthread_mutex_unlock(links_visited->lock);
-    				if(!hash_result) {
-    					work_count++;
-    				        b_enqueue(download_queue, found);
-    				        _edge_fn(node->from_link, found);
-    				}
-    			}
-    		
-    		}
-    		if(!interrupted_u_enqueue) {
-    			token = strtok_r(NULL, " \n", &save);
-    			if(token != NULL) {
-    				offset += (int)strlen(token);
-    			}
-    		}
-    		
-    	}
-    } while(interrupted_u_enqueue);
-    
-    if(ever_interrupted) {
-    	parse_queue->size--;
-    }
-    
-    work_completed++;
+    expected_urls = n;
 }
 
-void downloader(char* (*_fetch_fn)(char *url))
+/*
+Keeps the visited set in dir once it grows past max_resident bytes of keys,
+instead of holding every URL in memory. Pair with crawl_set_expected_urls so
+the Bloom filter can keep most lookups off the disk.
+*/
+void crawl_set_visited_store(char* dir, long max_resident)
 {
-    
-    while(work_count != work_completed)
-    {
-        pthread_mutex_lock(download_queue->lock);
-        while(b_isempty(download_queue)) {
-        	if(u_isempty(parse_queue)) {
-        		pthread_cond_signal(not_done);
-        	}
-        	pthread_cond_wait(download_queue->empty, download_queue->lock);
-        }
-        char* url = b_dequeue(download_queue);
-        char* page = _fetch_fn(url);
-        u_enqueue(parse_queue, url, page);
+    visited_dir = dir;
+    visited_max_resident = max_resident;
+}
 
-        if(u_isempty(parse_queue) && b_isempty(download_queue)) {
-        	pthread_cond_signal(not_done);
-        }
+/*
+Limits the page bytes held in the parse queue to max_bytes. Downloaders wait for
+parsers to catch up, or with spill set, write overflow pages to a temporary file
+that parsers read back in order.
+*/
+void crawl_set_parse_budget(long max_bytes, int spill)
+{
+    parse_max_bytes = max_bytes;
+    parse_spill = spill;
+}
 
-        pthread_cond_signal(parse_queue->empty);
-        pthread_cond_signal(download_queue->full);
-        pthread_mutex_unlock(download_queue->lock);
-    }
+/*
+Journals the visited set to dir and snapshots the frontier and in-flight
+URLs there every interval_ms milliseconds (0 for only a final snapshot when
+the crawl completes). crawl_resume() picks the crawl up from dir.
+*/
+void crawl_set_checkpoint(char* dir, int interval_ms)
+{
+    checkpoint_dir = dir;
+    checkpoint_interval_ms = interval_ms;
 }
 
-void parser(void (*_edge_fn)(char *from, char *to))
+/*
+Picks the split downloader/parser pipeline, fused workers that parse what
+they fetch, or CRAWL_AUTO to decide from a few probe fetches of the first
+URL when the crawl starts.
+*/
+void crawl_set_mode(int mode)
 {
-    while(work_count != work_completed) {
-        pthread_mutex_lock(parse_queue->lock);
-        while(u_isempty(parse_queue)) {
-        	pthread_cond_signal(download_queue->empty);
-        	pthread_cond_wait(parse_queue->empty, parse_queue->lock);
-        }
-        u_queue_node* node = u_dequeue(parse_queue);
-        pthread_mutex_unlock(parse_queue->lock);
-        
-        pthread_mutex_lock(download_queue->lock);
-        while(b_isfull(download_queue)) {
-    	    pthread_cond_wait(download_queue->full, download_queue->lock);
-        }
-        parse_page(node, _edge_fn);
+    crawl_mode = mode;
+}
 
-        if(u_isempty(parse_queue) && b_isempty(download_queue)) {
-        	pthread_cond_signal(not_done);
-        }
+/*
+Sets how long a worker that finds its queue empty (or full) spins before
+parking on the wait queue: iters polls, 0 to park right away, -1 for the
+default.
+*/
+void crawl_set_spin(int iters)
+{
+    wake_spin = iters;
+}
 
-        pthread_cond_signal(download_queue->empty);
-        pthread_mutex_unlock(download_queue->lock);
-    }
+/*
+Pins workers to CPUs by policy when the crawl starts. CRAWL_AFFINITY_NONE
+leaves placement to the scheduler.
+*/
+void crawl_set_affinity(int policy)
+{
+    affinity_policy = policy;
 }
 
-int crawl(char *start_url,
-	  int download_workers,
-	  int parse_workers,
-	  int queue_size,
-	  char * (*_fetch_fn)(char *url),
-	  void* (*_edge_fn)(char *from, char *to))
+/*
+Turns content fingerprinting of fetched pages on or off. With it on, a page
+whose body matches one fetched before is not parsed.
+*/
+void crawl_set_dedup(int on)
 {
-    pthread_t* downloaders = malloc(sizeof(pthread_t) * download_workers);
-    pthread_t* parsers = malloc(sizeof(pthread_t) * parse_workers);
-    parse_queue = malloc(sizeof(u_queue));
-    download_queue = (b_queue*)malloc(sizeof(b_queue));
-    links_visited = malloc(sizeof(hashtable));
-    
-    lock = malloc(sizeof(pthread_mutex_t));
-    pthread_mutex_init(lock, NULL);
-    not_done = malloc(sizeof(pthread_cond_t));
-    pthread_cond_init(not_done, NULL);
+    dedup_on = on;
+}
 
-    u_queue_init(parse_queue);
-    b_queue_init(download_queue, queue_size);
-    b_enqueue(download_queue, start_url);
-    work_count++;
-    hash_init(links_visited, queue_size);
-    hash_find_insert(links_visited, start_url);
+/*
+Loads the per-URL validators and links of the last crawl from path, if it
+exists, and writes this crawl's there when it completes.
+*/
+void crawl_set_recrawl(char* path)
+{
+    recrawl_path = path;
+}
 
-    int i = 0;
-    for(; i < download_workers; i++) {
-    	pthread_create(&downloaders[i], NULL, (void*)downloader, (void*)_fetch_fn);
+/*
+Resolves every link against the page it was found on and normalizes it
+before the visited set sees it (see urlnorm.h); on by default.
+*/
+void crawl_set_normalize(int on)
+{
+    normalize_urls = on;
+}
+
+/*
+Sets how links are found in pages; extract_link_tokens unless changed.
+*/
+void crawl_set_extractor(extract_fn fn)
+{
+    link_extractor = fn;
+}
+
+/*
+Lets fetch_fn hand pages over in pieces, parsed as they arrive; off by
+default.
+*/
+void crawl_set_streaming(int on)
+{
+    streaming = on;
+}
+
+int crawl_fetch_streaming(void)
+{
+    return fetch_stream != NULL;
+}
+
+/*
+Tries URLs that fail with CRAWL_RETRY again, up to max_retries times, with
+a backoff starting at base_ms and capped at max_ms; 0 turns retries off.
+*/
+void crawl_set_retries(int max_retries, int base_ms, int max_ms)
+{
+    retry_max = max_retries > 0 ? max_retries : 0;
+    retry_base_ms = base_ms > 0 ? base_ms : 1;
+    retry_max_ms = max_ms > retry_base_ms ? max_ms : retry_base_ms;
+}
+
+/*
+Hedges fetches slower than percentile of the fetches so far; 0 turns
+hedging off.
+*/
+void crawl_set_hedge(double percentile)
+{
+    hedge_percentile = percentile > 0 && percentile < 1 ? percentile : 0;
+}
+
+unsigned long crawl_fetch_hedge_ns(void)
+{
+    return __atomic_load_n(&hedge_ns, __ATOMIC_RELAXED);
+}
+
+void crawl_fetch_report(int event)
+{
+    if(thread_stats == NULL) {
+    	/* A probe fetch, before the crawl starts counting. */
+    	return;
     }
-    for(i = 0; i < parse_workers; i++) {
-    	pthread_create(&parsers[i], NULL, (void*)parser, (void*)_edge_fn);
+    switch(event) {
+    case CRAWL_FETCH_TIMEOUT:
+    	MY_STATS->fetch_timeouts++;
+    	break;
+    case CRAWL_FETCH_HEDGED:
+    	MY_STATS->fetch_hedges++;
+    	break;
+    case CRAWL_FETCH_HEDGE_WON:
+    	MY_STATS->hedge_wins++;
+    	break;
     }
-    
-    if(work_count != work_completed) {
-    	pthread_mutex_lock(lock);
-    	pthread_cond_wait(not_done, lock);
-    	pthread_cond_signal(parse_queue->empty);
-    	pthread_cond_signal(download_queue->empty);
-    	pthread_cond_signal(download_queue->full);
-    	pthread_mutex_unlock(lock);
+}
+
+/*
+Runs the crawl as n processes, each owning a share of the URLs.
+*/
+void crawl_set_shards(int n)
+{
+    nshards = n > 1 ? n : 1;
+}
+
+/*
+Loads URL exclusion rules from path when the crawl starts.
+*/
+void crawl_set_filter(char* path)
+{
+    filter_path = path;
+}
+
+/*
+Writes every link found during the crawl to path as a compressed sparse
+row graph (see graph.h) when the crawl completes.
+*/
+void crawl_set_graph(char* path)
+{
+    graph_path = path;
+}
+
+int crawl_fetch_validators(char** etag, char** last_modified)
+{
+    if(fetch_prev == NULL) {
+    	return 0;
     }
-    
-    /*for(i = 0; i < download_workers; i++) {
-    	pthread_join(downloaders[i], NULL);
+    *etag = fetch_prev->etag[0] != '\0' ? fetch_prev->etag : NULL;
+    *last_modified = fetch_prev->last_modified[0] != '\0' ? fetch_prev->last_modified : NULL;
+    return 1;
+}
+
+void crawl_fetch_set_validators(char* etag, char* last_modified)
+{
+    free(fetch_etag);
+    free(fetch_last_modified);
+    fetch_etag = etag != NULL ? strdup(etag) : NULL;
+    fetch_last_modified = last_modified != NULL ? strdup(last_modified) : NULL;
+}
+
+/*
+Sets how many new URLs a parser stages before adding them to the frontier
+in one go, and the most URLs a downloader takes per lock acquisition. Both
+are clamped to 1 .. CRAWL_MAX_BATCH.
+*/
+void crawl_set_batch(int push, int pop)
+{
+    push_batch = push < 1 ? 1 : push > CRAWL_MAX_BATCH ? CRAWL_MAX_BATCH : push;
+    pop_batch = pop < 1 ? 1 : pop > CRAWL_MAX_BATCH ? CRAWL_MAX_BATCH : pop;
+}
+
+void crawl_checkpoint_stats(checkpoint_stats* out)
+{
+    memset(out, 0, sizeof(*out));
+    if(crawl_ck != NULL) {
+    	LOCK(crawl_ck->lock, PROF_CHECKPOINT);
+    	*out = crawl_ck->stats;
+    	UNLOCK(crawl_ck->lock, PROF_CHECKPOINT);
     }
-    for(i = 0; i < parse_workers; i++) {
-    	pthread_join(parsers[i], NULL);
+    out->elapsed_us = checkpoint_now_us() - crawl_start_us;
+    out->pages = work_completed;
+}
+
+/*
+Sets how often queue depths are sampled (0 turns sampling off) and a
+function to hand the final stats to when the crawl completes.
+*/
+void crawl_set_stats(int interval_ms, void (*fn)(crawl_stats* stats))
+{
+    sample_interval_ms = interval_ms;
+    stats_fn = fn;
+}
+
+void waitq_add_stats(waitq* q, crawl_stats* out)
+{
+    out->parks += q->parks;
+    out->spin_wakes += q->spin_wakes;
+    out->wake_signals += q->signals;
+}
+
+/*
+Fills out with the counters so far. Can be called from any thread while the
+crawl runs; out->samples must be freed by the caller.
+*/
+void crawl_get_stats(crawl_stats* out)
+{
+    memset(out, 0, sizeof(*out));
+    out->elapsed_us = checkpoint_now_us() - crawl_start_us;
+    if(thread_stats != NULL) {
+    	stats_merge(thread_stats, nthread_stats, out);
+    }
+    out->shard = shard_index;
+    out->nshards = nshards;
+    out->expected_urls = expected_urls > 0 ? expected_urls : BLOOM_DEFAULT_URLS;
+    if(links_seen != NULL) {
+    	bloom_get_stats(links_seen, &out->bloom);
+    }
+    if(visited_spill != NULL) {
+    	LOCK(visited_spill->lock, PROF_VISITED_STORE);
+    	out->visited_budget = visited_spill->max_resident;
+    	out->visited_keys = visited_spill->nkeys;
+    	out->visited_runs = visited_spill->nruns;
+    	out->visited_flushes = visited_spill->flushes;
+    	out->visited_merges = visited_spill->merges;
+    	UNLOCK(visited_spill->lock, PROF_VISITED_STORE);
+    	out->visited_run_lookups = __atomic_load_n(&visited_spill->run_lookups, __ATOMIC_RELAXED);
+    }
+    if(download_queue != NULL) {
+    	LOCK(download_queue->lock, PROF_FRONTIER);
+    	out->frontier = download_queue->size;
+    	waitq_add_stats(download_queue->empty, out);
+    	waitq_add_stats(download_queue->full, out);
+    	UNLOCK(download_queue->lock, PROF_FRONTIER);
+    	LOCK(parse_queue->lock, PROF_PARSE_QUEUE);
+    	out->parse_queue = parse_queue->size;
+    	out->parse_bytes = parse_queue->bytes;
+    	out->parse_peak_bytes = parse_queue->peak_bytes;
+    	out->parse_spilled = parse_queue->spilled;
+    	waitq_add_stats(parse_queue->empty, out);
+    	waitq_add_stats(parse_queue->full, out);
+    	UNLOCK(parse_queue->lock, PROF_PARSE_QUEUE);
+    }
+    LOCK(&samples_lock, PROF_SAMPLES);
+    out->nsamples = ndepth_samples;
+    out->sample_interval_ms = sample_interval_ms;
+    out->samples = malloc(sizeof(stats_sample) * (ndepth_samples + 1));
+    memcpy(out->samples, depth_samples, sizeof(stats_sample) * ndepth_samples);
+    UNLOCK(&samples_lock, PROF_SAMPLES);
+}
+
+/*
+Samples the queue depths every sample_interval_ms. When the buffer is full
+every other sample is dropped and the interval doubles.
+*/
+void sampler()
+{
+    stats_sample sample;
+    struct timespec ts;
+
+    while(!crawl_done) {
+    	ts.tv_sec = sample_interval_ms / 1000;
+    	ts.tv_nsec = (long)(sample_interval_ms % 1000) * 1000000;
+    	nanosleep(&ts, NULL);
+
+    	sample.t_us = checkpoint_now_us() - crawl_start_us;
+    	LOCK(download_queue->lock, PROF_FRONTIER);
+    	sample.frontier = download_queue->size;
+    	UNLOCK(download_queue->lock, PROF_FRONTIER);
+    	LOCK(parse_queue->lock, PROF_PARSE_QUEUE);
+    	sample.parse_queue = parse_queue->size;
+    	sample.parse_bytes = parse_queue->bytes;
+    	UNLOCK(parse_queue->lock, PROF_PARSE_QUEUE);
+
+    	LOCK(&samples_lock, PROF_SAMPLES);
+    	if(ndepth_samples == STATS_MAX_SAMPLES) {
+    		int i;
+    		for(i = 0; i < STATS_MAX_SAMPLES / 2; i++) {
+    			depth_samples[i] = depth_samples[2 * i + 1];
+    		}
+    		ndepth_samples = STATS_MAX_SAMPLES / 2;
+    		sample_interval_ms *= 2;
+    	}
+    	depth_samples[ndepth_samples++] = sample;
+    	UNLOCK(&samples_lock, PROF_SAMPLES);
+    }
+}
+
+/*
+Records a timeline of every worker (queue operations, fetches, parses,
+condition variable waits and visited set lock waits) and writes it to path
+in Chrome trace format when the crawl completes. Each worker keeps its
+last events_per_thread events (0: TRACE_DEFAULT_EVENTS).
+*/
+void crawl_set_trace(char* path, int events_per_thread)
+{
+    trace_path = path;
+    trace_events = events_per_thread > 0 ? events_per_thread : TRACE_DEFAULT_EVENTS;
+}
+
+void crawl_bloom_stats(bloom_stats* out)
+{
+    if(links_seen == NULL) {
+    	memset(out, 0, sizeof(*out));
+    	return;
+    }
+    bloom_get_stats(links_seen, out);
+}
+
+/*
+Checks whether link has been seen and records it if not. With a visited
+store, the store does all of this itself (see visited_find_insert) with the
+same Bloom filter. Otherwise the Bloom filter is asked first: a negative means the link is new, a positive is confirmed
+against the visited table without its lock. Only new links (and Bloom false
+positives) take links_visited->lock.
+
+@return:
+int, 1 if link was already visited, 0 if this call inserted it
+*/
+int visited_check(char* link)
+{
+    uint64_t h;
+    int result;
+
+    if(visited_spill != NULL) {
+    	return visited_find_insert(visited_spill, link);
+    }
+    h = bloom_hash(link);
+    if(bloom_query(links_seen, h)) {
+    	if(hash_find(links_visited, link)) {
+    		__atomic_fetch_add(&links_seen->hits, 1, __ATOMIC_RELAXED);
+    		return 1;
+    	}
+    	__atomic_fetch_add(&links_seen->false_positives, 1, __ATOMIC_RELAXED);
+    }
+    uint64_t t0 = TRACE_NOW();
+    LOCK(links_visited->lock, PROF_VISITED);
+    TRACE(TRACE_LOCK_VISITED, t0, NULL);
+    result = hash_find_insert(links_visited, link);
+    UNLOCK(links_visited->lock, PROF_VISITED);
+    if(!result) {
+    	bloom_add(links_seen, h);
+    }
+    return result;
+}
+
+/*
+Frees a URL or parse queue node a worker has finished with. If a checkpoint
+is being taken it may be in the snapshot, so it is parked until the
+checkpoint is written.
+*/
+void pinned_free(void* ptr)
+{
+    if(__atomic_load_n(&checkpoint_pinned, __ATOMIC_ACQUIRE)) {
+    	LOCK(crawl_ck->lock, PROF_CHECKPOINT);
+    	if(checkpoint_pinned) {
+    		if(npinned == pinned_size) {
+    			pinned_size = pinned_size ? pinned_size * 2 : 64;
+    			pinned = realloc(pinned, sizeof(void*) * pinned_size);
+    		}
+    		pinned[npinned++] = ptr;
+    		ptr = NULL;
+    	}
+    	UNLOCK(crawl_ck->lock, PROF_CHECKPOINT);
+    }
+    free(ptr);
+}
+
+/*
+Takes a checkpoint. The crawl only stops while the URL pointers held by
+workers and the frontier are copied under both queue locks. Those pointers,
+and the parse queue nodes from the front back to its length then, stay
+valid until the checkpoint is written: everything leaves the queues under
+one of the locks and is then freed through pinned_free(), and the links
+between those nodes do not change. New links are journaled as they enter the
+frontier, under the download lock, so the journal length taken here matches
+the frontier exactly; checkpoint_write writes the journal out up to at least
+that length once the locks are dropped.
+
+@return:
+int, 0 if the checkpoint was written, -1 otherwise
+*/
+int checkpoint_take()
+{
+    checkpoint_header hdr;
+    uint64_t t0;
+    uint64_t t1;
+    uint64_t t2;
+    u_queue_node* node;
+    int queued;
+    int ninflight;
+    void** parked;
+    int nparked;
+    int n;
+    int i;
+    int rc;
+
+    LOCK(crawl_ck->write_lock, PROF_CHECKPOINT_WRITE);
+    LOCK(crawl_ck->lock, PROF_CHECKPOINT);
+    __atomic_store_n(&checkpoint_pinned, 1, __ATOMIC_RELEASE);
+    UNLOCK(crawl_ck->lock, PROF_CHECKPOINT);
+
+    t0 = checkpoint_now_us();
+    while(1) {
+    	LOCK(download_queue->lock, PROF_FRONTIER);
+    	LOCK(parse_queue->lock, PROF_PARSE_QUEUE);
+    	n = next_worker_slot * worker_url_slots + parse_queue->size + download_queue->size + nretries + 1;
+    	if(n <= checkpoint_urls_size) {
+    		break;
+    	}
+    	UNLOCK(parse_queue->lock, PROF_PARSE_QUEUE);
+    	UNLOCK(download_queue->lock, PROF_FRONTIER);
+    	checkpoint_urls_size = n * 2;
+    	free(checkpoint_urls);
+    	checkpoint_urls = malloc(sizeof(char*) * checkpoint_urls_size);
+    }
+    n = 0;
+    for(i = 0; i < next_worker_slot * worker_url_slots; i++) {
+    	if(worker_urls[i] != NULL) {
+    		checkpoint_urls[n++] = worker_urls[i];
+    	}
+    }
+    node = parse_queue->front;
+    queued = parse_queue->size;
+    n += queued;
+    ninflight = n;
+    /* The frontier is a ring: at most two runs of pointers. */
+    i = download_queue->max - download_queue->front;
+    if(i > download_queue->size) {
+    	i = download_queue->size;
+    }
+    memcpy(checkpoint_urls + n, download_queue->array + download_queue->front, sizeof(char*) * i);
+    memcpy(checkpoint_urls + n + i, download_queue->array, sizeof(char*) * (download_queue->size - i));
+    n += download_queue->size;
+    /* URLs waiting to be retried start over on restore. */
+    for(i = 0; i < nretries; i++) {
+    	checkpoint_urls[n++] = retry_heap[i].url;
+    }
+    hdr.ninflight = ninflight;
+    hdr.nfrontier = n - ninflight;
+    hdr.work_completed = work_completed;
+    hdr.work_count = work_completed + n;
+    hdr.journal_len = checkpoint_journal_len(crawl_ck);
+    UNLOCK(parse_queue->lock, PROF_PARSE_QUEUE);
+    UNLOCK(download_queue->lock, PROF_FRONTIER);
+
+    t1 = checkpoint_now_us();
+    for(i = ninflight - queued; i < ninflight; i++) {
+    	checkpoint_urls[i] = node->from_link;
+    	if(i + 1 < ninflight) {
+    		node = node->prev;
+    	}
+    }
+    hdr.elapsed_us = t1 - crawl_start_us;
+    rc = checkpoint_write(crawl_ck, &hdr, checkpoint_urls);
+    t2 = checkpoint_now_us();
+
+    LOCK(crawl_ck->lock, PROF_CHECKPOINT);
+    __atomic_store_n(&checkpoint_pinned, 0, __ATOMIC_RELEASE);
+    parked = pinned;
+    nparked = npinned;
+    pinned = NULL;
+    npinned = 0;
+    pinned_size = 0;
+    if(rc >= 0) {
+    	crawl_ck->stats.checkpoints++;
+    	crawl_ck->stats.bytes += rc;
+    }
+    crawl_ck->stats.pause_us += t1 - t0;
+    crawl_ck->stats.write_us += t2 - t1;
+    UNLOCK(crawl_ck->lock, PROF_CHECKPOINT);
+    UNLOCK(crawl_ck->write_lock, PROF_CHECKPOINT_WRITE);
+    for(i = 0; i < nparked; i++) {
+    	free(parked[i]);
+    }
+    free(parked);
+    return rc < 0 ? -1 : 0;
+}
+
+void checkpointer()
+{
+    struct timespec ts;
+    pthread_mutex_t sleep_lock = PTHREAD_MUTEX_INITIALIZER;
+    pthread_cond_t sleep_cond = PTHREAD_COND_INITIALIZER;
+
+    pthread_mutex_lock(&sleep_lock);
+    while(1) {
+    	clock_gettime(CLOCK_REALTIME, &ts);
+    	ts.tv_sec += checkpoint_interval_ms / 1000;
+    	ts.tv_nsec += (long)(checkpoint_interval_ms % 1000) * 1000000;
+    	if(ts.tv_nsec >= 1000000000) {
+    		ts.tv_sec++;
+    		ts.tv_nsec -= 1000000000;
+    	}
+    	while(pthread_cond_timedwait(&sleep_cond, &sleep_lock, &ts) == 0);
+    	checkpoint_take();
+    }
+}
+
+/*
+Marks the crawl finished and wakes everybody up. Called with
+download_queue->lock held once the last outstanding page is done.
+*/
+void crawl_finish()
+{
+    crawl_done = 1;
+    waitq_wake_all(download_queue->empty);
+    waitq_wake_all(download_queue->full);
+    LOCK(parse_queue->lock, PROF_PARSE_QUEUE);
+    waitq_wake_all(parse_queue->empty);
+    waitq_wake_all(parse_queue->full);
+    UNLOCK(parse_queue->lock, PROF_PARSE_QUEUE);
+    LOCK(lock, PROF_DONE);
+    pthread_cond_signal(not_done);
+    UNLOCK(lock, PROF_DONE);
+}
+
+/*
+Counts one more page done, under download_queue->lock. The last
+outstanding one ends the crawl or, with shards, takes this shard out of
+the shared count, which ends the crawl everywhere if it was the last.
+*/
+void work_done()
+{
+    work_completed++;
+    if(work_completed == work_count) {
+    	if(shards != NULL) {
+    		shard_work_done(shards, 1);
+    	}
+    	else {
+    		crawl_finish();
+    	}
+    }
+}
+
+/*
+Records that the page for the URL in entry i of this worker's slots is
+done, and ends the crawl if it was the last outstanding one.
+*/
+void page_done(int i)
+{
+    FRONTIER_LOCK();
+    MY_URLS[i] = NULL;
+    work_done();
+    UNLOCK(download_queue->lock, PROF_FRONTIER);
+}
+
+/*
+Adds n newly discovered URLs to the frontier under one lock acquisition,
+waiting while it is full. With done >= 0, also records that the page in
+entry done of this worker's slots is finished, which saves parsers a
+second trip through the lock per page; it has to happen after its links
+are counted in, or the crawl could look finished early.
+
+The one exception to waiting is when every downloader is parked on the
+parse queue budget: nobody would ever make room, so the frontier grows
+instead. Downloaders waiting on the budget are woken so they can tell
+whether that is the case. Fused workers are their own downloaders, so one
+waiting here counts as a parked downloader, and the last one to get stuck
+grows the frontier. So does a downloader pushing the links of a page it
+is streaming, and so does the shard exchanger, which must keep the rings
+moving whatever this shard is waiting for.
+*/
+void frontier_push_batch(char** urls, int n, int done)
+{
+    int fetcher = fused || fetch_stream != NULL;
+    int journaled = 0;
+    int i;
+    FRONTIER_LOCK();
+    for(i = 0; i < n; i++) {
+    	while(b_isfull(download_queue)) {
+    		/*
+    		 * Downloaders must hear about the URLs added so far before anybody
+    		 * waits, and a checkpoint taken meanwhile must find them journaled.
+    		 */
+    		if(i > 0) {
+    			waitq_wake(download_queue->empty, i);
+    		}
+    		if(crawl_ck != NULL && i > journaled) {
+    			checkpoint_journal_add(crawl_ck, urls + journaled, i - journaled);
+    			journaled = i;
+    		}
+    		if(exchanger ||
+    		   __atomic_load_n(&downloaders_waiting, __ATOMIC_SEQ_CST) + fetcher == download_workers_total) {
+    			b_grow(download_queue);
+    			waitq_wake_all(download_queue->full);
+    			break;
+    		}
+    		if(fetcher) {
+    			__atomic_add_fetch(&downloaders_waiting, 1, __ATOMIC_SEQ_CST);
+    			TIMED_WAIT(&MY_STATS->wait_frontier_full, TRACE_WAIT_FRONTIER_FULL, download_queue->full, download_queue->lock, PROF_FRONTIER);
+    			__atomic_sub_fetch(&downloaders_waiting, 1, __ATOMIC_SEQ_CST);
+    			continue;
+    		}
+    		__atomic_add_fetch(&parsers_blocked, 1, __ATOMIC_SEQ_CST);
+    		LOCK(parse_queue->lock, PROF_PARSE_QUEUE);
+    		waitq_wake_all(parse_queue->full);
+    		UNLOCK(parse_queue->lock, PROF_PARSE_QUEUE);
+    		TIMED_WAIT(&MY_STATS->wait_frontier_full, TRACE_WAIT_FRONTIER_FULL, download_queue->full, download_queue->lock, PROF_FRONTIER);
+    		__atomic_sub_fetch(&parsers_blocked, 1, __ATOMIC_SEQ_CST);
+    	}
+    	if(shards != NULL && work_count == work_completed) {
+    		/* Busy again: counts in the shared total until done. */
+    		shard_work_add(shards, 1);
+    	}
+    	work_count++;
+    	b_enqueue(download_queue, urls[i]);
+    }
+    if(crawl_ck != NULL && n > journaled) {
+    	checkpoint_journal_add(crawl_ck, urls + journaled, n - journaled);
+    }
+    if(done >= 0) {
+    	MY_URLS[done] = NULL;
+    	work_done();
+    }
+    if(n > 0) {
+    	waitq_wake(download_queue->empty, n);
+    }
+    UNLOCK(download_queue->lock, PROF_FRONTIER);
+}
+
+/*
+Sends link to the shard that owns it, unless that is this one, waiting
+for room in the ring if need be. The link counts in the shared total from
+before it is in the ring until the owner has taken it in. A URL too long
+for a ring is kept by the shard that found it, so at worst it is crawled
+by two shards.
+
+@return:
+int, 1 if link went to another shard, 0 if it is this one's to handle
+*/
+int shard_send(char* from, char* link)
+{
+    int owner = shard_of(link, nshards);
+    shard_ring* ring = shard_ring_between(shards, shard_index, owner);
+    useconds_t backoff = 1;
+
+    if(owner == shard_index || strlen(from) >= SHARD_MAX_URL || strlen(link) >= SHARD_MAX_URL) {
+    	return 0;
+    }
+    shard_work_add(shards, 1);
+    LOCKPROF_LOCK(&send_profs[owner], &send_locks[owner]);
+    while(shard_ring_put(ring, from, link) < 0) {
+    	MY_STATS->shard_ring_waits++;
+    	usleep(backoff);
+    	backoff = backoff < 1000 ? backoff * 2 : 1000;
+    }
+    LOCKPROF_UNLOCK(&send_profs[owner], &send_locks[owner]);
+    MY_STATS->shard_links_out++;
+    return 1;
+}
+
+/*
+Reports one link found on the page from: the link is normalized, unless
+that is off or it does not fit in URLNORM_MAX, and if the URL filter lets
+it through and it was not seen before, goes to _edge_fn and is staged for
+the frontier, which takes the staged URLs push_batch at a time. A link
+that normalizes to nothing is dropped.
+*/
+void found_link(char* from, char* link, void (*_edge_fn)(char *from, char *to), char** staged, int* nstaged)
+{
+    char norm[URLNORM_MAX];
+    char* found;
+    int length;
+
+    MY_STATS->links_seen++;
+    if(normalize_urls && (length = url_normalize(from, link, norm, sizeof(norm))) >= 0) {
+    	if(length == 0) {
+    		return;
+    	}
+    	if(strcmp(norm, link) != 0) {
+    		MY_STATS->links_rewritten++;
+    		link = norm;
+    	}
+    }
+    if(url_filter != NULL && urlfilter_match(url_filter, link)) {
+    	MY_STATS->links_filtered++;
+    	return;
+    }
+    if(link_graph != NULL) {
+    	graph_sink_add(link_graph, worker_slot, from, link);
+    }
+    if(shards != NULL && shard_send(from, link)) {
+    	return;
+    }
+    found = strdup(link);
+    if(!visited_check(found)) {
+    	MY_STATS->links_new++;
+    	_edge_fn(from, found);
+    	staged[(*nstaged)++] = found;
+    	if(*nstaged == push_batch) {
+    		frontier_push_batch(staged, *nstaged, -1);
+    		*nstaged = 0;
+    	}
+    }
+    else {
+    	free(found);
+    }
+}
+
+/*
+Reports the links the last crawl found on a page that has not changed
+since, and records them again for the next crawl, with the new validators
+if the server sent any. Marks entry slot of this worker's URLs done.
+*/
+void reuse_links(u_queue_node* node, void (*_edge_fn)(char *from, char *to), int slot)
+{
+    recrawl_record* prev = node->meta.reuse;
+    char* staged[CRAWL_MAX_BATCH];
+    int nstaged = 0;
+    uint32_t i;
+
+    for(i = 0; i < prev->nlinks; i++) {
+    	found_link(node->from_link, prev->links[i], _edge_fn, staged, &nstaged);
+    }
+    recrawl_put(recrawl, node->from_link,
+    	    node->meta.etag != NULL ? node->meta.etag : prev->etag,
+    	    node->meta.last_modified != NULL ? node->meta.last_modified : prev->last_modified,
+    	    &prev->fp, prev->links, prev->nlinks);
+    frontier_push_batch(staged, nstaged, slot);
+}
+
+/*
+What parse_page hands the link extractor to pass back to parse_link. A
+page being streamed also has its extract_stream here, the number of pieces
+it has arrived in so far and the time spent extracting from them.
+*/
+struct parse_state {
+    char* from;
+    void (*edge_fn)(char *from, char *to);
+    char* staged[CRAWL_MAX_BATCH];
+    int nstaged;
+    char** links;
+    int nlinks;
+    int max_links;
+    extract_stream stream;
+    long chunks;
+    uint64_t parse_ns;
+};
+
+void parse_state_init(parse_state* state, char* from, void (*_edge_fn)(char *from, char *to))
+{
+    state->from = from;
+    state->edge_fn = _edge_fn;
+    state->nstaged = 0;
+    state->links = NULL;
+    state->nlinks = 0;
+    state->max_links = 0;
+    state->chunks = 0;
+    state->parse_ns = 0;
+}
+
+/*
+Called by the link extractor for each link on the page being parsed. The
+raw links are kept for the recrawl store; they point into the page.
+*/
+void parse_link(char* link, int length, void* arg)
+{
+    parse_state* state = arg;
+    found_link(state->from, link, state->edge_fn, state->staged, &state->nstaged);
+    if(recrawl != NULL) {
+    	if(state->nlinks == state->max_links) {
+    		state->max_links = state->max_links ? state->max_links * 2 : 64;
+    		state->links = realloc(state->links, sizeof(char*) * state->max_links);
+    	}
+    	state->links[state->nlinks++] = link;
+    }
+}
+
+/*
+Scans a page for links and reports each one (see found_link). The page is
+accounted as parsed (timed from t0) and the last batch marks entry slot of
+this worker's URLs done. With recrawl on, the page's validators and every
+link on it are recorded for the next crawl before that, and a page the
+fetcher found unchanged is not scanned at all (see reuse_links).
+*/
+void parse_page(u_queue_node* node, void (*_edge_fn)(char *from, char *to), int slot, uint64_t t0)
+{
+    parse_state state;
+
+    if(node->meta.reuse != NULL) {
+    	reuse_links(node, _edge_fn, slot);
+    	return;
+    }
+    parse_state_init(&state, node->from_link, _edge_fn);
+    extract_page(link_extractor, node->content, node->length, parse_link, &state);
+    stats_hist_add(&MY_STATS->parse, stats_now_ns() - t0);
+    TRACE(TRACE_PARSE, t0, node->from_link);
+    MY_STATS->pages_parsed++;
+    if(recrawl != NULL) {
+    	recrawl_put(recrawl, node->from_link, node->meta.etag, node->meta.last_modified,
+    		    &node->meta.fp, state.links, state.nlinks);
+    	free(state.links);
+    }
+    frontier_push_batch(state.staged, state.nstaged, slot);
+}
+
+/*
+Extracts the links from the next piece of the page fetch_fn is streaming
+and adds the new ones to the frontier before fetch_fn reads on. Does
+nothing unless crawl_fetch_streaming() says the page may be streamed.
+*/
+void crawl_fetch_chunk(char* data, long length)
+{
+    uint64_t t0;
+
+    if(fetch_stream == NULL) {
+    	return;
+    }
+    t0 = stats_now_ns();
+    fetch_stream->chunks++;
+    if(extract_stream_push(&fetch_stream->stream, data, length) < 0) {
+    	fprintf(stderr, "Malloc failed\n");
+    }
+    if(fetch_stream->nstaged > 0) {
+    	frontier_push_batch(fetch_stream->staged, fetch_stream->nstaged, -1);
+    	fetch_stream->nstaged = 0;
+    }
+    fetch_stream->parse_ns += stats_now_ns() - t0;
+}
+
+/*
+Finishes a page fetch_fn streamed, ok unless the fetch failed partway:
+the links in the last of it are extracted and, failed or not, the page is
+marked done along with the last batch (entry slot of this worker's URLs).
+*/
+void stream_done(parse_state* state, int ok, int slot)
+{
+    uint64_t t0 = stats_now_ns();
+
+    if(ok) {
+    	extract_stream_end(&state->stream);
+    	state->parse_ns += stats_now_ns() - t0;
+    	stats_hist_add(&MY_STATS->parse, state->parse_ns);
+    	MY_STATS->pages_parsed++;
+    	MY_STATS->pages_streamed++;
+    }
+    extract_stream_free(&state->stream);
+    frontier_push_batch(state->staged, state->nstaged, slot);
+}
+
+/*
+Adds url to the retry heap, due at due_ns. Called with
+download_queue->lock held.
+
+@return:
+int, 0 on success, -1 on allocation failure
+*/
+int retry_push(char* url, int attempt, uint64_t due_ns)
+{
+    int i;
+
+    if(nretries == retry_size) {
+    	int size = retry_size > 0 ? retry_size * 2 : 64;
+    	retry_entry* heap = realloc(retry_heap, sizeof(retry_entry) * size);
+    	if(heap == NULL) {
+    		return -1;
+    	}
+    	retry_heap = heap;
+    	retry_size = size;
+    }
+    for(i = nretries++; i > 0 && retry_heap[(i - 1) / 2].due_ns > due_ns; i = (i - 1) / 2) {
+    	retry_heap[i] = retry_heap[(i - 1) / 2];
+    }
+    retry_heap[i].due_ns = due_ns;
+    retry_heap[i].attempt = attempt;
+    retry_heap[i].url = url;
+    return 0;
+}
+
+/*
+Removes the earliest entry from the retry heap. Called with
+download_queue->lock held and the heap not empty.
+*/
+retry_entry retry_pop()
+{
+    retry_entry top = retry_heap[0];
+    retry_entry last = retry_heap[--nretries];
+    int i = 0;
+
+    while(2 * i + 1 < nretries) {
+    	int child = 2 * i + 1;
+    	if(child + 1 < nretries && retry_heap[child + 1].due_ns < retry_heap[child].due_ns) {
+    		child++;
+    	}
+    	if(last.due_ns <= retry_heap[child].due_ns) {
+    		break;
+    	}
+    	retry_heap[i] = retry_heap[child];
+    	i = child;
+    }
+    retry_heap[i] = last;
+    return top;
+}
+
+/*
+@return:
+int, 1 if the earliest retry is due, 0 if there is none or it is not yet
+*/
+int retry_due()
+{
+    return nretries > 0 && retry_heap[0].due_ns <= stats_now_ns();
+}
+
+/*
+@return:
+uint64_t, the backoff before retry number attempt: a random time between
+half and all of retry_base_ms * 2^(attempt-1), at most retry_max_ms
+*/
+uint64_t retry_backoff_ns(int attempt)
+{
+    int shift = attempt - 1 < 30 ? attempt - 1 : 30;
+    uint64_t ms = (uint64_t)retry_base_ms << shift;
+    uint64_t half;
+
+    if(ms > (uint64_t)retry_max_ms) {
+    	ms = retry_max_ms;
+    }
+    half = ms * 1000000 / 2;
+    if(retry_rng == 0) {
+    	retry_rng = (worker_slot + 1) * 0x9e3779b97f4a7c15ULL;
+    }
+    retry_rng ^= retry_rng << 13;
+    retry_rng ^= retry_rng >> 7;
+    retry_rng ^= retry_rng << 17;
+    return half + retry_rng % (half + 1);
+}
+
+/*
+Puts the URL in entry slot of this worker's slots on the retry heap for
+another try after a backoff. The URL stays outstanding, so the crawl does
+not end while it waits, and belongs to the heap from here on.
+
+@return:
+int, 0 on success, -1 on allocation failure, when the URL was not taken
+*/
+int retry_later(char* url, int attempt, int slot)
+{
+    uint64_t due_ns = stats_now_ns() + retry_backoff_ns(attempt);
+
+    FRONTIER_LOCK();
+    if(retry_push(url, attempt, due_ns) < 0) {
+    	UNLOCK(download_queue->lock, PROF_FRONTIER);
+    	return -1;
+    }
+    MY_URLS[slot] = NULL;
+    /* A downloader asleep on an empty frontier has to wait for this one too. */
+    waitq_wake(download_queue->empty, 1);
+    UNLOCK(download_queue->lock, PROF_FRONTIER);
+    return 0;
+}
+
+/*
+Waits on the empty frontier until the earliest retry is due, or until
+woken. Called with download_queue->lock held and the retry heap not empty.
+*/
+void retry_wait()
+{
+    uint64_t t0 = stats_now_ns();
+    uint64_t wait_ns = retry_heap[0].due_ns > t0 ? retry_heap[0].due_ns - t0 : 0;
+    uint64_t t1;
+    struct timespec deadline;
+
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += wait_ns / 1000000000;
+    deadline.tv_nsec += wait_ns % 1000000000;
+    if(deadline.tv_nsec >= 1000000000) {
+    	deadline.tv_sec++;
+    	deadline.tv_nsec -= 1000000000;
+    }
+    LOCKPROF_WAIT_BEGIN(&lock_profiles[PROF_FRONTIER]);
+    waitq_timedwait(download_queue->empty, download_queue->lock, wake_spin, &deadline);
+    LOCKPROF_WAIT_END(&lock_profiles[PROF_FRONTIER]);
+    t1 = stats_now_ns();
+    stats_hist_add(&MY_STATS->wait_frontier_empty, t1 - t0);
+    if(trace_rings != NULL) {
+    	trace_add(&trace_rings[worker_slot], TRACE_WAIT_FRONTIER_EMPTY, t0, t1, NULL);
+    }
+}
+
+/*
+Recomputes hedge_ns from every worker's fetch times. The counters are read
+while the workers write them, so the result is approximate.
+*/
+void hedge_refresh()
+{
+    stats_hist all;
+    int i;
+
+    memset(&all, 0, sizeof(all));
+    for(i = 0; i < nthread_stats; i++) {
+    	stats_hist_merge(&all, &thread_stats[i].fetch);
+    }
+    if(all.count >= CRAWL_HEDGE_MIN_FETCHES) {
+    	__atomic_store_n(&hedge_ns, stats_hist_percentile(&all, hedge_percentile), __ATOMIC_RELAXED);
+    }
+}
+
+void page_meta_free(page_meta* meta)
+{
+    free(meta->etag);
+    free(meta->last_modified);
+}
+
+/*
+Fetches url, timing and counting the fetch. With recrawl on, fetch_prev is
+the last crawl's record for url while fetch_fn runs, which is what
+crawl_fetch_validators() hands out. With streaming on (and neither dedup
+nor recrawl, which need whole pages), fetch_fn may stream the page, which
+is then parsed by the time it returns and marked done in entry slot of
+this worker's URLs; the time spent parsing it is not counted as fetching.
+A URL fetch_fn says to retry is put on the retry heap while it has tries
+left, and then belongs to the heap.
+
+@return:
+char*, the page, CRAWL_NOT_MODIFIED, CRAWL_STREAMED once a streamed page is
+done with, CRAWL_RETRY once url is waiting to be retried, or NULL if the
+fetch failed
+*/
+char* worker_fetch(char* url, char* (*_fetch_fn)(char *url), int slot)
+{
+    uint64_t t0 = stats_now_ns();
+    parse_state stream;
+    char* page;
+
+    fetch_prev = recrawl != NULL ? recrawl_find(recrawl, url) : NULL;
+    stream.parse_ns = 0;
+    stream.chunks = 0;
+    if(streaming && !dedup_on && recrawl == NULL) {
+    	parse_state_init(&stream, url, crawl_edge_fn);
+    	extract_stream_init(&stream.stream, link_extractor, parse_link, &stream);
+    	fetch_stream = &stream;
+    }
+    if(__atomic_load_n(&probe_page, __ATOMIC_ACQUIRE) != NULL && strcmp(url, probe_url) == 0 &&
+       (page = __atomic_exchange_n(&probe_page, NULL, __ATOMIC_ACQ_REL)) != NULL) {
+    	free(fetch_etag);
+    	free(fetch_last_modified);
+    	fetch_etag = probe_etag;
+    	fetch_last_modified = probe_last_modified;
+    	t0 -= probe_fetch_ns;
+    }
+    else {
+    	page = _fetch_fn(url);
+    }
+    fetch_stream = NULL;
+    stats_hist_add(&MY_STATS->fetch, stats_now_ns() - t0 - stream.parse_ns);
+    TRACE(TRACE_FETCH, t0, url);
+    MY_STATS->pages_fetched++;
+    if(hedge_percentile > 0 && MY_STATS->pages_fetched % HEDGE_REFRESH == 0) {
+    	hedge_refresh();
+    }
+    if(page == CRAWL_RETRY) {
+    	/* The links in a partly streamed page are already in; no going back. */
+    	if(url_attempts[slot] < retry_max && stream.chunks == 0 &&
+    	   retry_later(url, url_attempts[slot] + 1, slot) == 0) {
+    		MY_STATS->fetch_retries++;
+    		if(streaming && !dedup_on && recrawl == NULL) {
+    			extract_stream_free(&stream.stream);
+    		}
+    		crawl_fetch_set_validators(NULL, NULL);
+    		return CRAWL_RETRY;
+    	}
+    	if(retry_max > 0) {
+    		MY_STATS->fetch_gave_up++;
+    	}
+    	page = NULL;
+    }
+    if(streaming && !dedup_on && recrawl == NULL) {
+    	if(page == CRAWL_STREAMED || stream.chunks > 0) {
+    		/* Sent in pieces: a whole page on top of them is ignored. */
+    		if(page == NULL) {
+    			MY_STATS->fetch_errors++;
+    		}
+    		else if(page != CRAWL_STREAMED) {
+    			free(page);
+    		}
+    		stream_done(&stream, page != NULL, slot);
+    		crawl_fetch_set_validators(NULL, NULL);
+    		return CRAWL_STREAMED;
+    	}
+    	extract_stream_free(&stream.stream);
+    }
+    if(page == CRAWL_NOT_MODIFIED && fetch_prev == NULL) {
+    	/* Nothing to reuse, so the answer is no use either. */
+    	page = NULL;
+    }
+    if(page == NULL) {
+    	MY_STATS->fetch_errors++;
+    	crawl_fetch_set_validators(NULL, NULL);
+    }
+    return page;
+}
+
+/*
+Looks at a page fresh from worker_fetch, while it is still in cache, and
+fills in meta. A page the server says is not modified, or whose
+fingerprint matches the last crawl's, is replaced by an empty one with
+meta->reuse set, so whoever parses it reuses the last crawl's links
+instead. A copy of a page already fetched in this crawl is dropped and
+entry slot of this worker's URLs marked done (see crawl_set_dedup).
+
+@return:
+int, 1 if the page was dropped, 0 if *page still has to be parsed
+*/
+int page_triage(char** page, int slot, page_meta* meta)
+{
+    long length;
+
+    meta->etag = fetch_etag;
+    meta->last_modified = fetch_last_modified;
+    meta->reuse = NULL;
+    fetch_etag = NULL;
+    fetch_last_modified = NULL;
+    if(*page == CRAWL_NOT_MODIFIED) {
+    	MY_STATS->not_modified++;
+    	meta->fp = fetch_prev->fp;
+    	meta->reuse = fetch_prev;
+    	if(page_fingerprints != NULL) {
+    		dedup_insert(page_fingerprints, &meta->fp);
+    	}
+    	*page = strdup("");
+    	return 0;
+    }
+    if(page_fingerprints == NULL && recrawl == NULL) {
+    	return 0;
+    }
+    length = strlen(*page);
+    dedup_hash(*page, length, &meta->fp);
+    if(fetch_prev != NULL && fetch_prev->fp.lo == meta->fp.lo && fetch_prev->fp.hi == meta->fp.hi) {
+    	MY_STATS->unchanged++;
+    	meta->reuse = fetch_prev;
+    	if(page_fingerprints != NULL) {
+    		dedup_insert(page_fingerprints, &meta->fp);
+    	}
+    	free(*page);
+    	*page = strdup("");
+    	return 0;
+    }
+    if(page_fingerprints != NULL && dedup_insert(page_fingerprints, &meta->fp)) {
+    	MY_STATS->dup_pages++;
+    	MY_STATS->dup_bytes += length;
+    	page_meta_free(meta);
+    	free(*page);
+    	page_done(slot);
+    	return 1;
+    }
+    return 0;
+}
+
+/*
+Waits until the parse queue is under its byte budget, so a downloader does
+not fetch pages parsers cannot keep up with. Never waits when spilling or
+for an empty queue. If this makes every downloader wait while a parser is
+stuck on a full frontier, the parser is woken so it can overflow the
+frontier instead (see frontier_push); URLs are far smaller than pages.
+Called with parse_queue->lock held.
+*/
+void parse_budget_wait()
+{
+    while(parse_queue->max_bytes > 0 && parse_queue->spill_fd < 0 &&
+          parse_queue->bytes > 0 && parse_queue->bytes >= parse_queue->max_bytes &&
+          !crawl_done) {
+    	if(__atomic_add_fetch(&downloaders_waiting, 1, __ATOMIC_SEQ_CST) == download_workers_total &&
+    	   __atomic_load_n(&parsers_blocked, __ATOMIC_SEQ_CST) > 0) {
+    		/* Lock order is download before parse, so let go of parse first. */
+    		UNLOCK(parse_queue->lock, PROF_PARSE_QUEUE);
+    		LOCK(download_queue->lock, PROF_FRONTIER);
+    		waitq_wake_all(download_queue->full);
+    		UNLOCK(download_queue->lock, PROF_FRONTIER);
+    		LOCK(parse_queue->lock, PROF_PARSE_QUEUE);
+    		if(parse_queue->bytes < parse_queue->max_bytes || crawl_done) {
+    			__atomic_sub_fetch(&downloaders_waiting, 1, __ATOMIC_SEQ_CST);
+    			break;
+    		}
+    	}
+    	parse_queue->full_waits++;
+    	TIMED_WAIT(&MY_STATS->wait_parse_full, TRACE_WAIT_PARSE_FULL, parse_queue->full, parse_queue->lock, PROF_PARSE_QUEUE);
+    	__atomic_sub_fetch(&downloaders_waiting, 1, __ATOMIC_SEQ_CST);
+    }
+}
+
+/*
+Takes up to pop_batch URLs off the frontier, waiting while it is empty, and
+records them in this worker's slots. Leaves at least an even share of the
+frontier for the other downloaders, so batching never starves them. Due
+retries are taken first, and while retries are waiting an empty frontier
+is only waited on until the earliest is due.
+
+@return:
+int, the number of URLs taken, 0 once the crawl is done
+*/
+int frontier_pop_batch(char** urls)
+{
+    uint64_t t_deq = TRACE_NOW();
+    int take;
+    int n = 0;
+
+    FRONTIER_LOCK();
+    while(b_isempty(download_queue) && !retry_due() && !crawl_done) {
+    	if(nretries > 0) {
+    		retry_wait();
+    	}
+    	else {
+    		TIMED_WAIT(&MY_STATS->wait_frontier_empty, TRACE_WAIT_FRONTIER_EMPTY, download_queue->empty, download_queue->lock, PROF_FRONTIER);
+    	}
+    }
+    if(crawl_done) {
+    	UNLOCK(download_queue->lock, PROF_FRONTIER);
+    	return 0;
+    }
+    while(n < pop_batch && retry_due()) {
+    	retry_entry entry = retry_pop();
+    	urls[n] = entry.url;
+    	MY_URLS[n] = urls[n];
+    	url_attempts[n] = entry.attempt;
+    	n++;
+    }
+    if(n == 0) {
+    	take = download_queue->size / download_workers_total;
+    	take = take > pop_batch ? pop_batch : take < 1 ? 1 : take;
+    	while(n < take) {
+    		urls[n] = b_dequeue(download_queue);
+    		MY_URLS[n] = urls[n];
+    		url_attempts[n] = 0;
+    		n++;
+    	}
+    	waitq_wake(download_queue->full, n);
+    }
+    UNLOCK(download_queue->lock, PROF_FRONTIER);
+    TRACE(TRACE_DEQUEUE_FRONTIER, t_deq, urls[0]);
+    return n;
+}
+
+void downloader(char* (*_fetch_fn)(char *url))
+{
+    worker_slot = __atomic_fetch_add(&next_worker_slot, 1, __ATOMIC_RELAXED);
+    if(trace_rings != NULL) {
+    	snprintf(trace_rings[worker_slot].name, sizeof(trace_rings[worker_slot].name), "%s %d", "downloader", worker_slot);
+    }
+    while(1)
+    {
+        char* urls[CRAWL_MAX_BATCH];
+        int n = frontier_pop_batch(urls);
+        int k;
+        if(n == 0) {
+        	break;
+        }
+        for(k = 0; k < n; k++) {
+        	char* url = urls[k];
+        	LOCK(parse_queue->lock, PROF_PARSE_QUEUE);
+        	parse_budget_wait();
+        	UNLOCK(parse_queue->lock, PROF_PARSE_QUEUE);
+
+        	page_meta meta;
+        	char* page = worker_fetch(url, _fetch_fn, k);
+        	if(page == NULL) {
+        		page_done(k);
+        		pinned_free(url);
+        		continue;
+        	}
+        	if(page == CRAWL_RETRY) {
+        		continue;
+        	}
+        	if(page == CRAWL_STREAMED) {
+        		pinned_free(url);
+        		continue;
+        	}
+        	if(page_triage(&page, k, &meta)) {
+        		pinned_free(url);
+        		continue;
+        	}
+
+        	LOCK(parse_queue->lock, PROF_PARSE_QUEUE);
+        	u_enqueue(parse_queue, url, page, &meta);
+        	MY_URLS[k] = NULL;
+        	waitq_wake(parse_queue->empty, 1);
+        	UNLOCK(parse_queue->lock, PROF_PARSE_QUEUE);
+        }
+    }
+}
+
+void parser(void (*_edge_fn)(char *from, char *to))
+{
+    worker_slot = __atomic_fetch_add(&next_worker_slot, 1, __ATOMIC_RELAXED);
+    if(trace_rings != NULL) {
+    	snprintf(trace_rings[worker_slot].name, sizeof(trace_rings[worker_slot].name), "%s %d", "parser", worker_slot);
+    }
+    while(1) {
+        uint64_t t_deq = TRACE_NOW();
+        LOCK(parse_queue->lock, PROF_PARSE_QUEUE);
+        while(u_isempty(parse_queue) && !crawl_done) {
+        	TIMED_WAIT(&MY_STATS->wait_parse_empty, TRACE_WAIT_PARSE_EMPTY, parse_queue->empty, parse_queue->lock, PROF_PARSE_QUEUE);
+        }
+        if(crawl_done) {
+        	UNLOCK(parse_queue->lock, PROF_PARSE_QUEUE);
+        	break;
+        }
+        u_queue_node* node = u_dequeue(parse_queue);
+        MY_URLS[0] = node->from_link;
+        if(parse_queue->bytes < parse_queue->max_bytes) {
+        	waitq_wake_all(parse_queue->full);
+        }
+        UNLOCK(parse_queue->lock, PROF_PARSE_QUEUE);
+        TRACE(TRACE_DEQUEUE_PARSE, t_deq, node->from_link);
+
+        uint64_t t0 = stats_now_ns();
+        u_load(parse_queue, node);
+        parse_page(node, _edge_fn, 0, t0);
+        page_meta_free(&node->meta);
+        free(node->content);
+        pinned_free(node->from_link);
+        pinned_free(node);
+    }
+}
+
+/*
+A fused worker takes a URL off the frontier, fetches it and parses the page
+straight away on the same thread, while it is still in cache. No parse
+queue hand-off, no second wakeup.
+*/
+void fused_worker(char* (*_fetch_fn)(char *url))
+{
+    worker_slot = __atomic_fetch_add(&next_worker_slot, 1, __ATOMIC_RELAXED);
+    if(trace_rings != NULL) {
+    	snprintf(trace_rings[worker_slot].name, sizeof(trace_rings[worker_slot].name), "%s %d", "worker", worker_slot);
+    }
+    while(1) {
+        char* urls[CRAWL_MAX_BATCH];
+        int n = frontier_pop_batch(urls);
+        int k;
+        if(n == 0) {
+        	break;
+        }
+        for(k = 0; k < n; k++) {
+        	char* url = urls[k];
+        	page_meta meta;
+        	char* page = worker_fetch(url, _fetch_fn, k);
+        	if(page == CRAWL_RETRY) {
+        		continue;
+        	}
+        	if(page == NULL) {
+        		page_done(k);
+        	}
+        	else if(page != CRAWL_STREAMED && !page_triage(&page, k, &meta)) {
+        		u_queue_node node;
+        		node.content = page;
+        		node.length = strlen(page);
+        		node.from_link = url;
+        		node.meta = meta;
+        		parse_page(&node, crawl_edge_fn, k, stats_now_ns());
+        		page_meta_free(&meta);
+        		free(page);
+        	}
+        	pinned_free(url);
+        }
+    }
+}
+
+/*
+The shard exchanger takes the links other shards found for this one off
+the rings and puts the new ones on the frontier, reporting them to
+_edge_fn as if found here. With nothing coming in it sleeps, from 10us up
+to 1ms, and it ends this shard's crawl once the crawl is over everywhere.
+*/
+void shard_exchanger(void (*_edge_fn)(char *from, char *to))
+{
+    char from[SHARD_MAX_URL];
+    char link[SHARD_MAX_URL];
+    char* staged[CRAWL_MAX_BATCH];
+    int nstaged;
+    useconds_t backoff = 10;
+
+    worker_slot = __atomic_fetch_add(&next_worker_slot, 1, __ATOMIC_RELAXED);
+    exchanger = 1;
+    if(trace_rings != NULL) {
+    	snprintf(trace_rings[worker_slot].name, sizeof(trace_rings[worker_slot].name), "%s %d", "exchanger", worker_slot);
+    }
+    while(1) {
+    	long taken = 0;
+    	int i;
+    	for(i = 0; i < nshards; i++) {
+    		shard_ring* ring = shard_ring_between(shards, i, shard_index);
+    		nstaged = 0;
+    		while(nstaged < push_batch && shard_ring_get(ring, from, link)) {
+    			MY_STATS->shard_links_in++;
+    			taken++;
+    			if(!visited_check(link)) {
+    				MY_STATS->links_new++;
+    				staged[nstaged] = strdup(link);
+    				_edge_fn(from, staged[nstaged]);
+    				nstaged++;
+    			}
+    		}
+    		if(nstaged > 0) {
+    			frontier_push_batch(staged, nstaged, -1);
+    		}
+    	}
+    	if(taken > 0) {
+    		/* Only now that the new ones are on the frontier. */
+    		shard_work_done(shards, taken);
+    		backoff = 10;
+    		continue;
+    	}
+    	if(shard_all_done(shards)) {
+    		FRONTIER_LOCK();
+    		crawl_finish();
+    		UNLOCK(download_queue->lock, PROF_FRONTIER);
+    		return;
+    	}
+    	usleep(backoff);
+    	backoff = backoff < 1000 ? backoff * 2 : 1000;
+    }
+}
+
+/*
+Decides CRAWL_AUTO: fetches url CRAWL_PROBE_FETCHES times and fuses if the
+fastest fetch after the first is quick enough that handing the page to
+another thread would cost about as much as fetching it. The first fetch is
+not timed, since it may pay for a connection the others reuse. With keep
+set, url is on this process's frontier and the first fetch is made as a
+worker would make it and kept in probe_page as the crawl's fetch of url;
+the other pages are thrown away.
+
+@return:
+int, CRAWL_FUSED or CRAWL_SPLIT
+*/
+int crawl_probe_mode(char* url, char * (*_fetch_fn)(char *url), int keep)
+{
+    uint64_t best = UINT64_MAX;
+    uint64_t t0 = stats_now_ns();
+    char* page;
+    int i;
+
+    fetch_prev = keep && recrawl != NULL ? recrawl_find(recrawl, url) : NULL;
+    page = _fetch_fn(url);
+    if(page == NULL || page == CRAWL_RETRY) {
+    	crawl_fetch_set_validators(NULL, NULL);
+    	return CRAWL_SPLIT;
+    }
+    if(keep) {
+    	probe_url = strdup(url);
+    	probe_fetch_ns = stats_now_ns() - t0;
+    	probe_etag = fetch_etag;
+    	probe_last_modified = fetch_last_modified;
+    	fetch_etag = NULL;
+    	fetch_last_modified = NULL;
+    	__atomic_store_n(&probe_page, page, __ATOMIC_RELEASE);
+    }
+    else if(page != CRAWL_NOT_MODIFIED) {
+    	free(page);
+    }
+    fetch_prev = NULL;
+    for(i = 1; i < CRAWL_PROBE_FETCHES; i++) {
+    	uint64_t t;
+    	t0 = stats_now_ns();
+    	page = _fetch_fn(url);
+    	t = stats_now_ns() - t0;
+    	crawl_fetch_set_validators(NULL, NULL);
+    	if(page == NULL || page == CRAWL_RETRY) {
+    		return CRAWL_SPLIT;
+    	}
+    	if(page != CRAWL_NOT_MODIFIED) {
+    		free(page);
+    	}
+    	if(t < best) {
+    		best = t;
+    	}
+    }
+    return best <= CRAWL_FUSED_MAX_FETCH_NS ? CRAWL_FUSED : CRAWL_SPLIT;
+}
+
+/*
+Allocates and initializes the queues and the visited set shared by every
+worker. The frontier holds at least queue_size URLs.
+
+@return:
+int, 0 on success, -1 if the visited store cannot be set up
+*/
+int crawl_setup(int queue_size)
+{
+    parse_queue = malloc(sizeof(u_queue));
+    download_queue = (b_queue*)malloc(sizeof(b_queue));
+    links_visited = malloc(sizeof(hashtable));
+    links_seen = malloc(sizeof(bloom_filter));
+    
+    lock = malloc(sizeof(pthread_mutex_t));
+    pthread_mutex_init(lock, NULL);
+    not_done = malloc(sizeof(pthread_cond_t));
+    pthread_cond_init(not_done, NULL);
+    crawl_start_us = checkpoint_now_us();
+
+    u_queue_init(parse_queue);
+    parse_queue->max_bytes = parse_max_bytes;
+    if(parse_max_bytes > 0 && parse_spill) {
+    	FILE* spill = tmpfile();
+    	if(spill == NULL) {
+    		perror("tmpfile");
+    		return -1;
+    	}
+    	parse_queue->spill_fd = dup(fileno(spill));
+    	fclose(spill);
+    }
+    b_queue_init(download_queue, queue_size);
+    bloom_init(links_seen, expected_urls > 0 ? expected_urls : BLOOM_DEFAULT_URLS);
+    if(visited_dir != NULL) {
+    	hash_init(links_visited, queue_size);
+    	visited_spill = malloc(sizeof(visited_store));
+    	if(visited_store_init(visited_spill, visited_dir, visited_max_resident, links_seen) < 0) {
+    		return -1;
+    	}
+    	visited_spill->prof = &lock_profiles[PROF_VISITED_STORE];
+    }
+    else {
+    	hash_init(links_visited, expected_urls > queue_size ? expected_urls : queue_size);
+    }
+    if(filter_path != NULL) {
+    	url_filter = malloc(sizeof(urlfilter));
+    	if(urlfilter_load(url_filter, filter_path) < 0) {
+    		return -1;
+    	}
+    }
+    if(recrawl_path != NULL) {
+    	recrawl = malloc(sizeof(recrawl_store));
+    	if(recrawl_open(recrawl, recrawl_path) < 0) {
+    		return -1;
+    	}
+    }
+    if(dedup_on) {
+    	page_fingerprints = malloc(sizeof(dedup_set));
+    	if(dedup_init(page_fingerprints, expected_urls > 0 ? expected_urls : BLOOM_DEFAULT_URLS) < 0) {
+    		fprintf(stderr, "Failed to allocate the page fingerprint set\n");
+    		return -1;
+    	}
+    }
+    return 0;
+}
+
+/*
+Initializes attr for worker number index of the given role, pinned where
+the affinity policy puts it.
+*/
+void worker_attr(pthread_attr_t* attr, cpu_topology* topo, int role, int index, int ndownloaders)
+{
+    cpu_set_t cpus;
+    pthread_attr_init(attr);
+    if(affinity_policy != CRAWL_AFFINITY_NONE &&
+       topo_place(topo, affinity_policy, role, index, ndownloaders, &cpus) == 0) {
+    	pthread_attr_setaffinity_np(attr, sizeof(cpus), &cpus);
+    }
+}
+
+/*
+Starts the workers (and the checkpoint thread, if enabled) on the state set
+up by crawl_setup and waits for the crawl to finish. Once it has, the final
+checkpoint, recrawl store, trace and link graph are written and the process
+exits, with status 1 if any of them could not be.
+*/
+int crawl_run(int download_workers,
+	  int parse_workers,
+	  char * (*_fetch_fn)(char *url),
+	  void (*_edge_fn)(char *from, char *to))
+{
+    pthread_t* downloaders = malloc(sizeof(pthread_t) * download_workers);
+    pthread_t* parsers = malloc(sizeof(pthread_t) * parse_workers);
+    pthread_t checkpoint_thread;
+    pthread_t sampler_thread;
+    pthread_t exchanger_thread;
+    pthread_attr_t attr;
+    cpu_topology topo;
+    int failed = 0;
+    int i;
+    if(wake_spin < 0) {
+    	wake_spin = sysconf(_SC_NPROCESSORS_ONLN) > 1 ? WAKE_DEFAULT_SPIN : 0;
+    }
+    int mode = crawl_mode;
+    if(mode == CRAWL_AUTO) {
+    	if(shards != NULL) {
+    		mode = crawl_probe_mode(shard_start, _fetch_fn, shard_of(shard_start, nshards) == shard_index);
+    	}
+    	else {
+    		mode = crawl_probe_mode(download_queue->array[download_queue->front], _fetch_fn, 1);
+    	}
+    }
+    fused = mode == CRAWL_FUSED;
+    crawl_edge_fn = _edge_fn;
+    worker_url_slots = pop_batch;
+    worker_urls = calloc((download_workers + parse_workers + 1) * worker_url_slots, sizeof(char*));
+    download_workers_total = fused ? download_workers + parse_workers : download_workers;
+    /* One more for the shard exchanger. */
+    nthread_stats = download_workers + parse_workers + (shards != NULL);
+    thread_stats = stats_alloc(nthread_stats);
+    depth_samples = malloc(sizeof(stats_sample) * STATS_MAX_SAMPLES);
+    if(trace_path != NULL) {
+    	trace_base_ns = stats_now_ns();
+    	trace_rings = trace_alloc(nthread_stats, trace_events);
+    	if(trace_rings == NULL) {
+    		fprintf(stderr, "Failed to allocate trace buffers\n");
+    		return -1;
+    	}
+    }
+    if(graph_path != NULL) {
+    	link_graph = malloc(sizeof(graph_sink));
+    	if(link_graph == NULL || graph_sink_init(link_graph, nthread_stats) < 0) {
+    		fprintf(stderr, "Failed to allocate the link graph\n");
+    		return -1;
+    	}
+    }
+
+    if(affinity_policy != CRAWL_AFFINITY_NONE && topo_load(&topo) < 0) {
+    	affinity_policy = CRAWL_AFFINITY_NONE;
+    }
+    if(fused) {
+    	/* Same thread budget, all of it fused workers, placed like downloaders. */
+    	for(i = 0; i < download_workers + parse_workers; i++) {
+    		worker_attr(&attr, &topo, TOPO_DOWNLOADER, i, download_workers + parse_workers);
+    		pthread_create(i < download_workers ? &downloaders[i] : &parsers[i - download_workers],
+    			       &attr, (void*)fused_worker, (void*)_fetch_fn);
+    		pthread_attr_destroy(&attr);
+    	}
+    }
+    else {
+    	for(i = 0; i < download_workers; i++) {
+    		worker_attr(&attr, &topo, TOPO_DOWNLOADER, i, download_workers);
+    		pthread_create(&downloaders[i], &attr, (void*)downloader, (void*)_fetch_fn);
+    		pthread_attr_destroy(&attr);
+    	}
+    	for(i = 0; i < parse_workers; i++) {
+    		worker_attr(&attr, &topo, TOPO_PARSER, i, download_workers);
+    		pthread_create(&parsers[i], &attr, (void*)parser, (void*)_edge_fn);
+    		pthread_attr_destroy(&attr);
+    	}
+    }
+    if(affinity_policy != CRAWL_AFFINITY_NONE) {
+    	topo_free(&topo);
+    }
+    if(crawl_ck != NULL && checkpoint_interval_ms > 0) {
+    	pthread_create(&checkpoint_thread, NULL, (void*)checkpointer, NULL);
+    }
+    if(sample_interval_ms > 0) {
+    	pthread_create(&sampler_thread, NULL, (void*)sampler, NULL);
+    }
+    if(shards != NULL) {
+    	pthread_create(&exchanger_thread, NULL, (void*)shard_exchanger, (void*)_edge_fn);
+    }
+    
+    LOCK(lock, PROF_DONE);
+    while(!crawl_done && (shards != NULL || work_count != work_completed)) {
+    	LOCKPROF_WAIT_BEGIN(&lock_profiles[PROF_DONE]);
+    	pthread_cond_wait(not_done, lock);
+    	LOCKPROF_WAIT_END(&lock_profiles[PROF_DONE]);
+    }
+    UNLOCK(lock, PROF_DONE);
+    if(crawl_ck != NULL && checkpoint_take() < 0) {
+    	failed = 1;
+    }
+    if(recrawl != NULL && recrawl_commit(recrawl) < 0) {
+    	failed = 1;
+    }
+    if(stats_fn != NULL) {
+    	crawl_stats stats;
+    	crawl_get_stats(&stats);
+    	stats_fn(&stats);
+    	free(stats.samples);
+    }
+#ifdef CRAWL_LOCK_PROFILE
+    {
+    	int nprofs = NPROFS + (shards != NULL ? nshards : 0);
+    	lockprof* profs = malloc(sizeof(lockprof) * nprofs);
+    	memcpy(profs, lock_profiles, sizeof(lockprof) * NPROFS);
+    	if(shards != NULL) {
+    		memcpy(profs + NPROFS, send_profs, sizeof(lockprof) * nshards);
+    	}
+    	lockprof_print(stderr, profs, nprofs, (checkpoint_now_us() - crawl_start_us) * 1000);
+    	free(profs);
+    }
+#endif
+    if(trace_rings != NULL && trace_write(trace_rings, nthread_stats, trace_base_ns, trace_path) < 0) {
+    	failed = 1;
+    }
+    if(link_graph != NULL && graph_sink_write(link_graph, graph_path) < 0) {
+    	failed = 1;
+    }
+    if(visited_spill != NULL) {
+    	visited_store_free(visited_spill);
+    }
+    
+    /*for(i = 0; i < download_workers; i++) {
+    	pthread_join(downloaders[i], NULL);
+    }
+    for(i = 0; i < parse_workers; i++) {
+    	pthread_join(parsers[i], NULL);
     }*/
-    exit(0);
+    exit(failed ? 1 : 0);
+}
+
+/*
+@return:
+char*, path with ".<shard>" appended, or NULL if path is NULL
+*/
+char* shard_path(char* path, int shard)
+{
+    char* out;
+    if(path == NULL) {
+    	return NULL;
+    }
+    out = malloc(strlen(path) + 16);
+    sprintf(out, "%s.%d", path, shard);
+    return out;
+}
+
+/*
+Runs one shard of a sharded crawl in a freshly forked process; never
+returns. The start URL goes on the frontier of the shard that owns it.
+*/
+void shard_main(int shard,
+	  char* start_url,
+	  int download_workers,
+	  int parse_workers,
+	  int queue_size,
+	  char * (*_fetch_fn)(char *url),
+	  void (*_edge_fn)(char *from, char *to))
+{
+    int i;
+
+    shard_index = shard;
+    shard_start = start_url;
+    graph_path = shard_path(graph_path, shard);
+    trace_path = shard_path(trace_path, shard);
+    recrawl_path = shard_path(recrawl_path, shard);
+    visited_dir = shard_path(visited_dir, shard);
+    visited_max_resident /= nshards;
+    if(expected_urls > 0) {
+    	expected_urls = expected_urls / nshards + 1;
+    }
+    /* Placement policies know nothing of the other shards' workers. */
+    affinity_policy = CRAWL_AFFINITY_NONE;
+    /* Whole lines, so edge_fn output from different shards does not mix. */
+    setvbuf(stdout, NULL, _IOLBF, 0);
+    send_locks = malloc(sizeof(pthread_mutex_t) * nshards);
+    send_profs = malloc(sizeof(lockprof) * nshards);
+    for(i = 0; i < nshards; i++) {
+    	char name[32];
+    	lockprof prof = LOCKPROF_INIT(NULL);
+    	pthread_mutex_init(&send_locks[i], NULL);
+    	snprintf(name, sizeof(name), "send_locks[%d]", i);
+    	prof.name = strdup(name);
+    	send_profs[i] = prof;
+    }
+    if(crawl_setup(queue_size) < 0) {
+    	exit(1);
+    }
+    if(shard_of(start_url, nshards) == shard) {
+    	b_enqueue(download_queue, strdup(start_url));
+    	work_count++;
+    	visited_check(start_url);
+    }
+    crawl_run(download_workers, parse_workers, _fetch_fn, _edge_fn);
+    exit(1);
+}
+
+/*
+Forks the nshards shard processes of a sharded crawl (see
+crawl_set_shards) over a fresh shared map and waits for them. If one
+fails, the others are killed, since the crawl cannot finish without it.
+
+@return:
+int, 0 if every shard finished the crawl, -1 otherwise
+*/
+int crawl_sharded(char *start_url,
+	  int download_workers,
+	  int parse_workers,
+	  int queue_size,
+	  char * (*_fetch_fn)(char *url),
+	  void (*_edge_fn)(char *from, char *to))
+{
+    pid_t* pids;
+    int started;
+    int running;
+    int status;
+    int rc = 0;
+    int i;
+
+    if(checkpoint_dir != NULL) {
+    	fprintf(stderr, "Checkpoints are not supported in a sharded crawl\n");
+    	return -1;
+    }
+    shards = shard_map_create(nshards);
+    if(shards == NULL) {
+    	return -1;
+    }
+    /* The start URL's shard is busy from the start. */
+    shards->outstanding = 1;
+    pids = malloc(sizeof(pid_t) * nshards);
+    fflush(stdout);
+    fflush(stderr);
+    for(started = 0; started < nshards; started++) {
+    	pids[started] = fork();
+    	if(pids[started] < 0) {
+    		perror("fork");
+    		rc = -1;
+    		break;
+    	}
+    	if(pids[started] == 0) {
+    		shard_main(started, start_url, download_workers, parse_workers, queue_size, _fetch_fn, _edge_fn);
+    	}
+    }
+    if(rc < 0) {
+    	for(i = 0; i < started; i++) {
+    		kill(pids[i], SIGKILL);
+    	}
+    }
+    for(running = started; running > 0; running--) {
+    	pid_t pid = wait(&status);
+    	if(pid < 0) {
+    		break;
+    	}
+    	for(i = 0; i < started; i++) {
+    		if(pids[i] == pid) {
+    			pids[i] = -1;
+    		}
+    	}
+    	if(rc == 0 && (!WIFEXITED(status) || WEXITSTATUS(status) != 0)) {
+    		fprintf(stderr, "A shard failed, stopping the crawl\n");
+    		rc = -1;
+    		for(i = 0; i < started; i++) {
+    			if(pids[i] > 0) {
+    				kill(pids[i], SIGKILL);
+    			}
+    		}
+    	}
+    }
+    free(pids);
+    shard_map_free(shards);
+    shards = NULL;
+    return rc;
+}
+
+int crawl(char *start_url,
+	  int download_workers,
+	  int parse_workers,
+	  int queue_size,
+	  char * (*_fetch_fn)(char *url),
+	  void (*_edge_fn)(char *from, char *to))
+{
+    if(nshards > 1) {
+    	return crawl_sharded(start_url, download_workers, parse_workers, queue_size, _fetch_fn, _edge_fn);
+    }
+    if(crawl_setup(queue_size) < 0) {
+    	return -1;
+    }
+    if(checkpoint_dir != NULL) {
+    	crawl_ck = malloc(sizeof(checkpoint));
+    	if(checkpoint_open(crawl_ck, checkpoint_dir, 0) < 0) {
+    		return -1;
+    	}
+    	crawl_ck->prof = &lock_profiles[PROF_CHECKPOINT];
+    }
+    b_enqueue(download_queue, strdup(start_url));
+    work_count++;
+    visited_check(start_url);
+    if(crawl_ck != NULL) {
+    	checkpoint_journal_add(crawl_ck, &start_url, 1);
+    }
+    return crawl_run(download_workers, parse_workers, _fetch_fn, _edge_fn);
+}
+
+/*
+Restarts a crawl from the last checkpoint in dir. The visited set is rebuilt
+from the journal and every URL that was in flight or on the frontier is
+queued again; pages that were fully parsed are not fetched again.
+*/
+int crawl_resume(char *dir,
+	  int download_workers,
+	  int parse_workers,
+	  int queue_size,
+	  char * (*_fetch_fn)(char *url),
+	  void (*_edge_fn)(char *from, char *to))
+{
+    checkpoint_header hdr;
+    char** urls;
+    int n;
+    int i;
+
+    if(checkpoint_read(dir, &hdr, &urls) < 0) {
+    	return -1;
+    }
+    n = hdr.ninflight + hdr.nfrontier;
+    if(crawl_setup(n > queue_size ? n : queue_size) < 0) {
+    	return -1;
+    }
+    if(checkpoint_replay(dir, hdr.journal_len, visited_check) < 0) {
+    	return -1;
+    }
+    crawl_ck = malloc(sizeof(checkpoint));
+    if(checkpoint_open(crawl_ck, dir, hdr.journal_len) < 0) {
+    	return -1;
+    }
+    crawl_ck->prof = &lock_profiles[PROF_CHECKPOINT];
+    checkpoint_dir = dir;
+    crawl_start_us -= hdr.elapsed_us;
+    for(i = 0; i < n; i++) {
+    	b_enqueue(download_queue, urls[i]);
+    }
+    free(urls);
+    work_completed = hdr.work_completed;
+    work_count = work_completed + n;
+    return crawl_run(download_workers, parse_workers, _fetch_fn, _edge_fn);
 }
@@ -1,6 +1,11 @@
 #ifndef __CRAWLER_H
 #define __CRAWLER_H
 
+#include "bloom.h"
+#include "checkpoint.h"
+#include "stats.h"
+#include "extract.h"
+
 int crawl(char *start_url,
 	  int download_workers,
 	  int parse_workers,
@@ -8,4 +13,264 @@ int crawl(char *start_url,
 	  char * (*fetch_fn)(char *url),
 	  void (*edge_fn)(char *from, char *to));
 
+/*
+Execution modes for crawl_set_mode(). CRAWL_SPLIT, the default, runs
+download_workers fetching into the parse queue and parse_workers parsing
+out of it. CRAWL_FUSED runs download_workers + parse_workers threads that
+each fetch a page and parse it themselves, which wins when fetches are
+cheap (in memory, mmap, local disk) and the hand-off dominates. CRAWL_AUTO
+fetches the first URL CRAWL_PROBE_FETCHES times and fuses if the fastest
+fetch after the first took at most CRAWL_FUSED_MAX_FETCH_NS. The first
+fetch is the crawl's own fetch of that URL.
+*/
+#define CRAWL_SPLIT 0
+#define CRAWL_FUSED 1
+#define CRAWL_AUTO 2
+#define CRAWL_PROBE_FETCHES 3
+#define CRAWL_FUSED_MAX_FETCH_NS 50000
+
+void crawl_set_mode(int mode);
+
+/*
+Frontier batching. A parser stages up to push new URLs and adds them to the
+frontier under one lock acquisition, the last batch of a page together with
+marking the page done; a downloader takes up to pop URLs at a time, but
+never more than an even share of the frontier. Larger pop batches help
+cheap fetchers and hurt load balance with slow ones. Call before crawl().
+*/
+#define CRAWL_MAX_BATCH 256
+#define CRAWL_DEFAULT_PUSH_BATCH 32
+#define CRAWL_DEFAULT_POP_BATCH 1
+
+void crawl_set_batch(int push, int pop);
+
+/*
+How many times a worker that finds its queue empty or full polls for a
+wakeup before it parks in the kernel (0: park at once; -1, the default:
+spin only with more than one CPU online). Call before crawl().
+*/
+void crawl_set_spin(int iters);
+
+/*
+Worker placement for crawl_set_affinity(). COMPACT pins downloaders to
+consecutive CPUs and parsers after them. PAIRED pins downloader k and
+parser k to neighbouring CPUs (SMT siblings where there are any). These
+only place threads: the parse queue is shared, so a page goes to whichever
+parser takes it next, on any CPU. In fused mode
+every worker is placed like a downloader, and each page is fetched and
+parsed on the same thread.
+*/
+#define CRAWL_AFFINITY_NONE 0
+#define CRAWL_AFFINITY_COMPACT 1
+#define CRAWL_AFFINITY_PAIRED 2
+
+void crawl_set_affinity(int policy);
+
+/*
+Fingerprint every fetched page (128 bit hash of the body, see dedup.h) and
+skip parsing pages identical to one fetched before, such as mirrors of a
+page under another URL. Their links, and edges, were already reported from
+the first copy. Skipped pages and bytes show up in crawl_stats. Call before
+crawl().
+*/
+void crawl_set_dedup(int on);
+
+/*
+Incremental recrawl. The crawl loads what the last crawl stored in path
+(ETag, Last-Modified, content fingerprint and every link on the page, per
+URL) and stores its own there when it completes. While fetch_fn runs on a
+URL the last crawl fetched, crawl_fetch_validators() gives it the stored
+validators, NULL where there were none, to make the request conditional;
+if the server answers "not modified", fetch_fn returns CRAWL_NOT_MODIFIED
+(not to be freed) and the stored links are reused without parsing. A page
+that comes back whole but with the stored fingerprint is not parsed either.
+fetch_fn reports the validators of a full response with
+crawl_fetch_set_validators(), which copies them. Call before crawl().
+*/
+extern char crawl_not_modified[];
+#define CRAWL_NOT_MODIFIED crawl_not_modified
+
+void crawl_set_recrawl(char* path);
+
+/*
+@return:
+int, 1 if the last crawl fetched the URL being fetched, 0 otherwise
+*/
+int crawl_fetch_validators(char** etag, char** last_modified);
+void crawl_fetch_set_validators(char* etag, char* last_modified);
+
+/*
+Resolve links against the URL of the page they are on and normalize them
+(drop fragments, lowercase scheme and host, remove "." and ".." segments;
+see urlnorm.h) before checking whether they were seen, so "pageb",
+"./pageb" and "pageb#x" are one URL. On by default; call before crawl().
+The start URL is used as given.
+*/
+void crawl_set_normalize(int on);
+
+/*
+How links are found in a page: fn is given each page to parse and reports
+every link on it (see extract.h). extract_link_tokens, the default, finds
+"link:" tokens; extract_html_hrefs finds <a href> in HTML. Call before
+crawl().
+*/
+void crawl_set_extractor(extract_fn fn);
+
+/*
+Streaming parse. With it on, fetch_fn may hand a page over in pieces as
+they arrive instead of returning it whole: while crawl_fetch_streaming()
+says it may, it calls crawl_fetch_chunk() with each piece, in order, and
+returns CRAWL_STREAMED (not to be freed). The link extractor runs on each
+piece as it comes, on the fetching thread, and the new links found in it
+enter the frontier before fetch_fn reads on, so a page is parsed while it
+downloads and never has to be in memory whole: besides the piece, at most
+EXTRACT_MAX_CARRY bytes of it are kept (see extract.h). If fetch_fn fails
+after some pieces, the links found in them stay found. Dedup and recrawl
+need whole pages, so with either on pages are never streamed, and
+fetch_fn can always return a page whole instead. Call before crawl().
+*/
+extern char crawl_streamed[];
+#define CRAWL_STREAMED crawl_streamed
+
+void crawl_set_streaming(int on);
+
+/*
+@return:
+int, 1 if the page being fetched may be streamed, 0 otherwise
+*/
+int crawl_fetch_streaming(void);
+void crawl_fetch_chunk(char* data, long length);
+
+/*
+Retries. fetch_fn returns CRAWL_RETRY (not to be freed) for a failure that
+may go away, such as a timeout, a dropped connection or a 5xx answer, and
+NULL for one that will not. A URL that fails that way gets up to
+max_retries more tries, the k-th after a random wait between half and all
+of base_ms * 2^(k-1), at most max_ms, so that URLs that failed together
+do not come back together. The wait is kept by the frontier, not by a
+worker: waiting URLs sit in a queue ordered by when they are due, and
+downloaders take due ones ahead of the frontier and only sleep when there
+is nothing else to fetch. A page that was partly streamed is not retried.
+Without retries (the default) CRAWL_RETRY is a failure like NULL. Call
+before crawl().
+*/
+extern char crawl_retry[];
+#define CRAWL_RETRY crawl_retry
+
+void crawl_set_retries(int max_retries, int base_ms, int max_ms);
+
+/*
+Hedged requests. With percentile set (0 < percentile < 1; 0, the default,
+turns hedging off), crawl_fetch_hedge_ns() gives fetch_fn that percentile
+of the fetch times so far, rounded up to a power of two, once
+CRAWL_HEDGE_MIN_FETCHES fetches have been timed, and 0 before. A fetch
+that has waited that long for an answer should send the same request
+again, on another connection, and keep whichever answers first.
+crawl_fetch_report() counts, for crawl_stats, the fetches fetch_fn timed
+out, the ones it hedged and the hedges that answered first. Call before
+crawl().
+*/
+#define CRAWL_HEDGE_MIN_FETCHES 100
+#define CRAWL_FETCH_TIMEOUT 0
+#define CRAWL_FETCH_HEDGED 1
+#define CRAWL_FETCH_HEDGE_WON 2
+
+void crawl_set_hedge(double percentile);
+unsigned long crawl_fetch_hedge_ns(void);
+void crawl_fetch_report(int event);
+
+/*
+Sharded crawl. With n > 1, crawl() forks n processes and returns when
+they are all done, 0 if the crawl finished. Every shard is a whole crawler
+with the given numbers of workers, for the URLs shard_of() gives it (see
+shard.h): its own frontier, visited set and heap, so nothing is shared
+but the links one shard finds for another, which go through lock-free
+rings in shared memory to a thread in the owner that puts the new ones on
+its frontier. edge_fn runs in the shard that owns the link, with stdout
+line buffered so that lines from different shards do not mix, and the
+stats callback once per shard. The graph, trace and recrawl files get
+the shard number appended (file.0, file.1, ...), and a recrawl needs the
+same number of shards as the crawl before. Affinity policies are ignored
+and checkpoints are not supported. Call before crawl().
+*/
+void crawl_set_shards(int n);
+
+/*
+Skip links that the rules in path exclude before they reach the visited
+set and the frontier: robots.txt style disallow/allow prefixes and exclude
+substrings, all compiled into one automaton when the crawl starts (see
+urlfilter.h). Skipped links are counted in crawl_stats. Call before
+crawl().
+*/
+void crawl_set_filter(char* path);
+
+/*
+Write the link graph to path when the crawl completes, in the compact form
+described in graph.h. Unlike edge_fn, which sees each URL only the first
+time it is found, the graph has every link on every parsed page. Call
+before crawl().
+*/
+void crawl_set_graph(char* path);
+
+/*
+Hint for the number of distinct URLs the crawl will see. Sizes the Bloom
+filter in front of the visited set; call before crawl().
+*/
+void crawl_set_expected_urls(long n);
+
+/*
+Spill the visited set to sorted run files in dir, keeping at most
+max_resident bytes of URLs in memory. Runs left in dir by an earlier crawl
+are deleted when the crawl starts, and this crawl's when it ends. In a
+sharded crawl each shard gets dir.N and an equal share of max_resident.
+Call before crawl().
+*/
+void crawl_set_visited_store(char* dir, long max_resident);
+
+/*
+Cap the page bytes waiting in the parse queue at max_bytes (0: unbounded).
+Downloaders block until parsers catch up or, with spill set, overflow pages
+go to a temporary file and are read back in order.
+*/
+void crawl_set_parse_budget(long max_bytes, int spill);
+
+/*
+Journal the visited set to dir and write a checkpoint of the frontier and
+in-flight URLs there every interval_ms (0: only when the crawl completes).
+*/
+void crawl_set_checkpoint(char* dir, int interval_ms);
+
+/*
+Continue the crawl checkpointed in dir. Pages parsed before the checkpoint
+are not fetched again; checkpointing continues at the configured interval.
+*/
+int crawl_resume(char *dir,
+	  int download_workers,
+	  int parse_workers,
+	  int queue_size,
+	  char * (*fetch_fn)(char *url),
+	  void (*edge_fn)(char *from, char *to));
+
+/* Time and bytes spent checkpointing, next to elapsed time and pages. */
+void crawl_checkpoint_stats(checkpoint_stats* out);
+
+/*
+Sample queue depths every interval_ms (0: never; default 10) and pass the
+final stats to fn, if not NULL, when the crawl completes.
+*/
+void crawl_set_stats(int interval_ms, void (*fn)(crawl_stats* stats));
+
+/* Counters and histograms so far. Safe to call live; free out->samples. */
+void crawl_get_stats(crawl_stats* out);
+
+/*
+Trace every worker's queue operations, fetches, parses and waits, keeping
+the last events_per_thread events each (0: default), and write them to
+path as a Chrome trace when the crawl completes. Call before crawl().
+*/
+void crawl_set_trace(char* path, int events_per_thread);
+
+/* Snapshot of the visited set Bloom filter counters. Safe to call live. */
+void crawl_bloom_stats(bloom_stats* out);
+
 #endif
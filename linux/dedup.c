@@ -0,0 +1,185 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "dedup.h"
+
+static uint64_t rotl64(uint64_t x, int r)
+{
+	return (x << r) | (x >> (64 - r));
+}
+
+static uint64_t fmix64(uint64_t k)
+{
+	k ^= k >> 33;
+	k *= 0xff51afd7ed558ccdULL;
+	k ^= k >> 33;
+	k *= 0xc4ceb9fe1a85ec53ULL;
+	k ^= k >> 33;
+	return k;
+}
+
+/*
+Fingerprints length bytes of data, 16 bytes per round.
+
+**NOTE: this is MurmurHash3_x64_128 by Austin Appleby, seed 0, which is in
+the public domain.** Source: https://github.com/aappleby/smhasher
+The last partial block is zero padded and read like a full one, which gives
+the same result as the reference tail handling on little endian machines.
+*/
+void dedup_hash(char* data, long length, dedup_fp* out)
+{
+	const uint64_t c1 = 0x87c37b91114253d5ULL;
+	const uint64_t c2 = 0x4cf5ad432745937fULL;
+	uint64_t h1 = 0;
+	uint64_t h2 = 0;
+	uint64_t k1;
+	uint64_t k2;
+	unsigned char tail[16];
+	long nblocks = length / 16;
+	long rest = length % 16;
+	long i;
+
+	for (i = 0; i < nblocks; i++) {
+		memcpy(&k1, data + i * 16, 8);
+		memcpy(&k2, data + i * 16 + 8, 8);
+		k1 *= c1;
+		k1 = rotl64(k1, 31);
+		k1 *= c2;
+		h1 ^= k1;
+		h1 = rotl64(h1, 27);
+		h1 += h2;
+		h1 = h1 * 5 + 0x52dce729;
+		k2 *= c2;
+		k2 = rotl64(k2, 33);
+		k2 *= c1;
+		h2 ^= k2;
+		h2 = rotl64(h2, 31);
+		h2 += h1;
+		h2 = h2 * 5 + 0x38495ab5;
+	}
+	if (rest > 0) {
+		memset(tail, 0, sizeof(tail));
+		memcpy(tail, data + nblocks * 16, rest);
+		memcpy(&k1, tail, 8);
+		memcpy(&k2, tail + 8, 8);
+		if (rest > 8) {
+			k2 *= c2;
+			k2 = rotl64(k2, 33);
+			k2 *= c1;
+			h2 ^= k2;
+		}
+		k1 *= c1;
+		k1 = rotl64(k1, 31);
+		k1 *= c2;
+		h1 ^= k1;
+	}
+	h1 ^= (uint64_t)length;
+	h2 ^= (uint64_t)length;
+	h1 += h2;
+	h2 += h1;
+	h1 = fmix64(h1);
+	h2 = fmix64(h2);
+	h1 += h2;
+	h2 += h1;
+	out->lo = h1;
+	out->hi = h2;
+	if (out->lo == 0 && out->hi == 0) {
+		out->lo = 1;
+	}
+}
+
+/*
+Sizes every stripe for its share of expected fingerprints at half load.
+
+@return:
+int, 0 on success, -1 on allocation failure
+*/
+int dedup_init(dedup_set* set, long expected)
+{
+	unsigned long size = 16;
+	int i;
+	while (size < 2 * (unsigned long)expected / DEDUP_STRIPES) {
+		size *= 2;
+	}
+	for (i = 0; i < DEDUP_STRIPES; i++) {
+		dedup_stripe* stripe = &set->stripes[i];
+		pthread_mutex_init(&stripe->lock, NULL);
+		stripe->slots = calloc(size, sizeof(dedup_fp));
+		if (stripe->slots == NULL) {
+			return -1;
+		}
+		stripe->mask = size - 1;
+		stripe->used = 0;
+	}
+	return 0;
+}
+
+static dedup_fp* stripe_slot(dedup_stripe* stripe, dedup_fp* fp)
+{
+	unsigned long i = fp->lo & stripe->mask;
+	while (stripe->slots[i].lo != 0 || stripe->slots[i].hi != 0) {
+		if (stripe->slots[i].lo == fp->lo && stripe->slots[i].hi == fp->hi) {
+			break;
+		}
+		i = (i + 1) & stripe->mask;
+	}
+	return &stripe->slots[i];
+}
+
+/*
+Doubles a stripe's table. Called with the stripe lock held.
+*/
+static int stripe_grow(dedup_stripe* stripe)
+{
+	dedup_fp* old = stripe->slots;
+	unsigned long size = stripe->mask + 1;
+	unsigned long i;
+
+	stripe->slots = calloc(size * 2, sizeof(dedup_fp));
+	if (stripe->slots == NULL) {
+		stripe->slots = old;
+		return -1;
+	}
+	stripe->mask = size * 2 - 1;
+	for (i = 0; i < size; i++) {
+		if (old[i].lo != 0 || old[i].hi != 0) {
+			*stripe_slot(stripe, &old[i]) = old[i];
+		}
+	}
+	free(old);
+	return 0;
+}
+
+/*
+Adds fp to the set unless it is there already. If the table cannot grow the
+fingerprint is dropped, so at worst a later copy of the page is parsed.
+
+@return:
+int, 1 if fp was already in the set, 0 if this call added it
+*/
+int dedup_insert(dedup_set* set, dedup_fp* fp)
+{
+	dedup_stripe* stripe = &set->stripes[fp->hi >> 58];
+	dedup_fp* slot;
+	int found;
+
+	pthread_mutex_lock(&stripe->lock);
+	slot = stripe_slot(stripe, fp);
+	found = slot->lo != 0 || slot->hi != 0;
+	if (!found && (2 * (stripe->used + 1) <= stripe->mask + 1 || stripe_grow(stripe) == 0)) {
+		*stripe_slot(stripe, fp) = *fp;
+		stripe->used++;
+	}
+	pthread_mutex_unlock(&stripe->lock);
+	return found;
+}
+
+void dedup_free(dedup_set* set)
+{
+	int i;
+	for (i = 0; i < DEDUP_STRIPES; i++) {
+		free(set->stripes[i].slots);
+		pthread_mutex_destroy(&set->stripes[i].lock);
+	}
+}
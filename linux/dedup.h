@@ -0,0 +1,46 @@
+#ifndef __DEDUP_H
+#define __DEDUP_H
+
+#include <stdint.h>
+#include <pthread.h>
+
+/*
+Content fingerprints, for spotting a page already fetched under another URL
+(mirrors, copies). A fingerprint is the 128 bit MurmurHash3 of the page
+body; at that width two different pages colliding is not a practical
+concern, so equal fingerprints are taken to mean equal pages without
+comparing any bytes.
+
+The set is split into DEDUP_STRIPES open addressing tables, each with its
+own lock and picked by the top bits of the fingerprint, so concurrent
+inserts rarely meet on a lock. The all zero fingerprint marks an empty slot
+and is never produced by dedup_hash.
+*/
+#define DEDUP_STRIPES 64
+
+typedef struct dedup_fp dedup_fp;
+typedef struct dedup_stripe dedup_stripe;
+typedef struct dedup_set dedup_set;
+
+struct dedup_fp {
+	uint64_t lo;
+	uint64_t hi;
+};
+
+struct dedup_stripe {
+	pthread_mutex_t lock;
+	dedup_fp* slots;
+	unsigned long mask;
+	unsigned long used;
+} __attribute__((aligned(64)));
+
+struct dedup_set {
+	dedup_stripe stripes[DEDUP_STRIPES];
+};
+
+void dedup_hash(char* data, long length, dedup_fp* out);
+int dedup_init(dedup_set* set, long expected);
+int dedup_insert(dedup_set* set, dedup_fp* fp);
+void dedup_free(dedup_set* set);
+
+#endif
@@ -0,0 +1,451 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include "extract.h"
+
+#define TOKEN_TEXT 0
+#define TOKEN_SKIP 1
+
+/*
+Splits text into tokens at spaces and newlines, as strtok(text, " \n")
+would, and emits what follows "link:" in each token that starts with it.
+A token cut off by the end of a piece is left for the next one if it may
+still turn out to be a link.
+*/
+long extract_link_tokens(char* text, long length, int last, int* state, extract_emit_fn emit, void* arg)
+{
+	char* p = text;
+	char* end = text + length;
+
+	if (*state == TOKEN_SKIP) {
+		while (p < end && *p != ' ' && *p != '\n') {
+			p++;
+		}
+		if (p == end) {
+			return length;
+		}
+		*state = TOKEN_TEXT;
+	}
+	while (p < end) {
+		char* token;
+		while (p < end && (*p == ' ' || *p == '\n')) {
+			p++;
+		}
+		token = p;
+		while (p < end && *p != ' ' && *p != '\n') {
+			p++;
+		}
+		if (p == end && !last && p > token) {
+			if (p - token <= EXTRACT_MAX_CARRY && strncmp(token, "link:", p - token < 5 ? p - token : 5) == 0) {
+				return token - text;
+			}
+			*state = TOKEN_SKIP;
+			return length;
+		}
+		if (p - token > 5 && strncmp(token, "link:", 5) == 0) {
+			*p = '\0';
+			emit(token + 5, p - token - 5, arg);
+		}
+		p++;
+	}
+	return length;
+}
+
+static int is_space(char c)
+{
+	return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\f';
+}
+
+/*
+Writes code point cp to s as UTF-8.
+
+@return:
+int, the number of bytes written
+*/
+static int put_utf8(char* s, unsigned long cp)
+{
+	if (cp < 0x80) {
+		s[0] = cp;
+		return 1;
+	}
+	if (cp < 0x800) {
+		s[0] = 0xc0 | (cp >> 6);
+		s[1] = 0x80 | (cp & 0x3f);
+		return 2;
+	}
+	if (cp < 0x10000) {
+		s[0] = 0xe0 | (cp >> 12);
+		s[1] = 0x80 | ((cp >> 6) & 0x3f);
+		s[2] = 0x80 | (cp & 0x3f);
+		return 3;
+	}
+	s[0] = 0xf0 | (cp >> 18);
+	s[1] = 0x80 | ((cp >> 12) & 0x3f);
+	s[2] = 0x80 | ((cp >> 6) & 0x3f);
+	s[3] = 0x80 | (cp & 0x3f);
+	return 4;
+}
+
+/*
+Parses the character reference at s, n bytes long, which starts with '&'.
+The UTF-8 encoding of a reference is never longer than the reference.
+
+@return:
+int, the length of the reference, or 0 if it is not one this knows; *cp is
+set to the code point it stands for
+*/
+static int entity(char* s, int n, unsigned long* cp)
+{
+	static const struct {
+		char* name;
+		int length;
+		char c;
+	} named[] = {
+		{ "&amp;", 5, '&' }, { "&lt;", 4, '<' }, { "&gt;", 4, '>' },
+		{ "&quot;", 6, '"' }, { "&apos;", 6, '\'' },
+	};
+	unsigned int i;
+	int k;
+
+	if (n > 2 && s[1] == '#') {
+		int hex = s[2] == 'x' || s[2] == 'X';
+		*cp = 0;
+		for (k = 2 + hex; k < n && k < 10 && isxdigit((unsigned char)s[k]); k++) {
+			if (!hex && !isdigit((unsigned char)s[k])) {
+				break;
+			}
+			*cp = *cp * (hex ? 16 : 10) + (isdigit((unsigned char)s[k]) ? s[k] - '0' : (tolower((unsigned char)s[k]) - 'a' + 10));
+		}
+		if (k == 2 + hex || k >= n || s[k] != ';' || *cp == 0 || *cp > 0x10ffff ||
+		    (*cp >= 0xd800 && *cp <= 0xdfff)) {
+			return 0;
+		}
+		return k + 1;
+	}
+	for (i = 0; i < sizeof(named) / sizeof(named[0]); i++) {
+		if (n >= named[i].length && strncmp(s, named[i].name, named[i].length) == 0) {
+			*cp = named[i].c;
+			return named[i].length;
+		}
+	}
+	return 0;
+}
+
+/*
+Decodes the n byte attribute value s in place: references are replaced,
+tabs and newlines dropped, surrounding white space trimmed.
+
+@return:
+int, the decoded length
+*/
+static int decode(char* s, int n)
+{
+	unsigned long cp;
+	int r = 0;
+	int w = 0;
+	int used;
+
+	while (r < n && is_space(s[r])) {
+		r++;
+	}
+	while (r < n) {
+		if (s[r] == '&' && (used = entity(s + r, n - r, &cp)) > 0) {
+			w += put_utf8(s + w, cp);
+			r += used;
+		}
+		else if (s[r] == '\t' || s[r] == '\n' || s[r] == '\r') {
+			r++;
+		}
+		else {
+			s[w++] = s[r++];
+		}
+	}
+	while (w > 0 && is_space(s[w - 1])) {
+		w--;
+	}
+	return w;
+}
+
+static int ignored_scheme(char* link)
+{
+	return strncasecmp(link, "javascript:", 11) == 0 || strncasecmp(link, "mailto:", 7) == 0 ||
+	       strncasecmp(link, "tel:", 4) == 0 || strncasecmp(link, "data:", 5) == 0;
+}
+
+/*
+Parses the attributes of an <a> tag starting at p and finds the first
+href. *href is NULL if there is none, otherwise it and *href_end span its
+value, not yet decoded.
+
+@return:
+char*, just after the tag, or NULL if the tag does not end before end
+*/
+static char* anchor(char* p, char* end, char** href, char** href_end)
+{
+	*href = NULL;
+	while (p < end) {
+		char* name;
+		char* value;
+		char* stop;
+		int tag_end = 0;
+		int length;
+
+		while (p < end && (is_space(*p) || *p == '/')) {
+			p++;
+		}
+		if (p >= end) {
+			return NULL;
+		}
+		if (*p == '>') {
+			return p + 1;
+		}
+		name = p;
+		while (p < end && !is_space(*p) && *p != '=' && *p != '>' && *p != '/') {
+			p++;
+		}
+		length = p - name;
+		while (p < end && is_space(*p)) {
+			p++;
+		}
+		if (p >= end || *p != '=') {
+			continue;
+		}
+		for (p++; p < end && is_space(*p); p++)
+			;
+		if (p < end && (*p == '"' || *p == '\'')) {
+			value = p + 1;
+			stop = memchr(value, *p, end - value);
+			if (stop == NULL) {
+				return NULL;
+			}
+		}
+		else {
+			value = p;
+			for (stop = p; stop < end && !is_space(*stop) && *stop != '>'; stop++)
+				;
+			tag_end = stop < end && *stop == '>';
+		}
+		p = stop + 1;
+		if (*href == NULL && length == 4 && strncasecmp(name, "href", 4) == 0) {
+			*href = value;
+			*href_end = stop;
+		}
+		if (tag_end) {
+			return p;
+		}
+	}
+	return NULL;
+}
+
+/*
+Decodes and terminates the href value from value to stop and emits it,
+unless it is empty or has a scheme that is not crawled.
+*/
+static void emit_href(char* value, char* stop, extract_emit_fn emit, void* arg)
+{
+	int length = decode(value, stop - value);
+	value[length] = '\0';
+	if (length > 0 && !ignored_scheme(value)) {
+		emit(value, length, arg);
+	}
+}
+
+/*
+@return:
+int, 1 if the tag at p, just after '<', is named name (lowercase)
+*/
+static int tag_is(char* p, char* end, char* name, int length)
+{
+	return end - p > length && strncasecmp(p, name, length) == 0 &&
+	       (is_space(p[length]) || p[length] == '>' || p[length] == '/');
+}
+
+/*
+Skips the raw text of a <script> or <style> element.
+
+@return:
+char*, just after the '<' of its end tag, or end
+*/
+static char* skip_raw(char* p, char* end, char* name, int length)
+{
+	while ((p = memchr(p, '<', end - p)) != NULL) {
+		p++;
+		if (p < end && *p == '/' && tag_is(p + 1, end, name, length)) {
+			return p;
+		}
+	}
+	return end;
+}
+
+/*
+When what is being skipped may end within the last keep bytes of a piece,
+those are looked at again with the next one.
+
+@return:
+long, how many bytes of text are done with
+*/
+static long resume(char* text, char* p, char* end, long keep, int last)
+{
+	if (last) {
+		return end - text;
+	}
+	return (end - p > keep ? end - keep : p) - text;
+}
+
+#define HTML_TEXT 0
+#define HTML_COMMENT 1
+#define HTML_SCRIPT 2
+#define HTML_STYLE 3
+#define HTML_SKIP_TAG 4
+
+/* Bytes after '<' needed to tell a comment, <a>, <script> and <style> apart. */
+#define HTML_TAG_PEEK 7
+
+long extract_html_hrefs(char* text, long length, int last, int* state, extract_emit_fn emit, void* arg)
+{
+	char* p = text;
+	char* end = text + length;
+	char* tag;
+	char* href;
+	char* href_end;
+
+	while (p < end) {
+		if (*state == HTML_COMMENT) {
+			tag = memmem(p, end - p, "-->", 3);
+			if (tag == NULL) {
+				return resume(text, p, end, 2, last);
+			}
+			p = tag + 3;
+			*state = HTML_TEXT;
+			continue;
+		}
+		if (*state == HTML_SCRIPT || *state == HTML_STYLE) {
+			char* name = *state == HTML_SCRIPT ? "script" : "style";
+			int n = *state == HTML_SCRIPT ? 6 : 5;
+			tag = skip_raw(p, end, name, n);
+			if (tag == end) {
+				return resume(text, p, end, n + 2, last);
+			}
+			p = tag;
+			*state = HTML_TEXT;
+			continue;
+		}
+		if (*state == HTML_SKIP_TAG) {
+			tag = memchr(p, '>', end - p);
+			if (tag == NULL) {
+				return length;
+			}
+			p = tag + 1;
+			*state = HTML_TEXT;
+			continue;
+		}
+		tag = memchr(p, '<', end - p);
+		if (tag == NULL) {
+			return length;
+		}
+		p = tag + 1;
+		if (!last && end - p < HTML_TAG_PEEK) {
+			return tag - text;
+		}
+		if (end - p >= 3 && p[0] == '!' && p[1] == '-' && p[2] == '-') {
+			p += 3;
+			*state = HTML_COMMENT;
+		}
+		else if ((*p == 'a' || *p == 'A') && p + 1 < end && is_space(p[1])) {
+			p = anchor(p + 2, end, &href, &href_end);
+			if (p == NULL) {
+				/* Cut off: wait for the rest, unless it is too long to keep. */
+				if (!last && end - tag <= EXTRACT_MAX_CARRY) {
+					return tag - text;
+				}
+				if (!last) {
+					*state = HTML_SKIP_TAG;
+				}
+				if (href != NULL) {
+					emit_href(href, href_end, emit, arg);
+				}
+				return length;
+			}
+			if (href != NULL) {
+				emit_href(href, href_end, emit, arg);
+			}
+		}
+		else if (tag_is(p, end, "script", 6)) {
+			p += 6;
+			*state = HTML_SCRIPT;
+		}
+		else if (tag_is(p, end, "style", 5)) {
+			p += 5;
+			*state = HTML_STYLE;
+		}
+	}
+	return length;
+}
+
+void extract_page(extract_fn fn, char* page, long length, extract_emit_fn emit, void* arg)
+{
+	int state = 0;
+	fn(page, length, 1, &state, emit, arg);
+}
+
+void extract_stream_init(extract_stream* stream, extract_fn fn, extract_emit_fn emit, void* arg)
+{
+	stream->fn = fn;
+	stream->emit = emit;
+	stream->arg = arg;
+	stream->state = 0;
+	stream->buf = NULL;
+	stream->length = 0;
+	stream->size = 0;
+}
+
+/*
+Appends length bytes of data to what is left of the page and extracts the
+links in it, keeping back what fn is not done with.
+
+@return:
+int, 0 on success, -1 on allocation failure
+*/
+int extract_stream_push(extract_stream* stream, char* data, long length)
+{
+	long used;
+
+	if (stream->length + length + 1 > stream->size) {
+		char* buf = realloc(stream->buf, stream->length + length + 1);
+		if (buf == NULL) {
+			return -1;
+		}
+		stream->buf = buf;
+		stream->size = stream->length + length + 1;
+	}
+	memcpy(stream->buf + stream->length, data, length);
+	stream->length += length;
+	stream->buf[stream->length] = '\0';
+	used = stream->fn(stream->buf, stream->length, 0, &stream->state, stream->emit, stream->arg);
+	memmove(stream->buf, stream->buf + used, stream->length - used);
+	stream->length -= used;
+	return 0;
+}
+
+/*
+Extracts the links in whatever is left once the page has all arrived. The
+stream is then ready for another page.
+*/
+void extract_stream_end(extract_stream* stream)
+{
+	if (stream->length > 0) {
+		stream->buf[stream->length] = '\0';
+		stream->fn(stream->buf, stream->length, 1, &stream->state, stream->emit, stream->arg);
+	}
+	stream->length = 0;
+	stream->state = 0;
+}
+
+void extract_stream_free(extract_stream* stream)
+{
+	free(stream->buf);
+	stream->buf = NULL;
+	stream->size = 0;
+}
@@ -0,0 +1,67 @@
+#ifndef __EXTRACT_H
+#define __EXTRACT_H
+
+/*
+Link extractors. An extractor scans length bytes of text (NUL terminated
+at text[length]) and calls emit once for every link it finds, with the
+link's span: link points into text and link[length] is '\0'. Extractors
+may rewrite text in place to terminate and decode links, so text can be
+scanned only once. arg is passed through to emit.
+
+A page can be scanned whole (see extract_page) or in pieces as it arrives
+(see extract_stream). *state is 0 at the start of a page and carries what
+the extractor needs to know between pieces, such as being inside a
+comment. With last 0 more of the page follows, and the extractor stops
+before a link, tag or token that may continue past length: it returns
+how many bytes it is done with, and the rest is passed again in front of
+the next piece. It never leaves more than EXTRACT_MAX_CARRY bytes; a tag
+or token still unfinished after that many is skipped, links and all.
+With last set the text is the end of the page and all of it is used.
+
+extract_link_tokens finds "link:<url>" tokens separated by spaces and
+newlines, the syntax of the test pages and of webgraph.
+
+extract_html_hrefs finds the href of every <a> tag in HTML in one pass,
+without building a tree: tags are found with memchr, and only <a> tags
+have their attributes parsed. Values may be double quoted, single quoted
+or bare, attribute and tag names are case insensitive, and character
+references (&amp; &lt; &gt; &quot; &apos; &#N; &#xN;) are decoded.
+Leading and trailing white space and embedded tabs and newlines are
+dropped, as browsers do. Comments and the contents of <script> and
+<style> are skipped, as are javascript:, mailto:, tel: and data: links.
+*/
+#define EXTRACT_MAX_CARRY 8192
+
+typedef void (*extract_emit_fn)(char* link, int length, void* arg);
+typedef long (*extract_fn)(char* text, long length, int last, int* state, extract_emit_fn emit, void* arg);
+
+long extract_link_tokens(char* text, long length, int last, int* state, extract_emit_fn emit, void* arg);
+long extract_html_hrefs(char* text, long length, int last, int* state, extract_emit_fn emit, void* arg);
+
+void extract_page(extract_fn fn, char* page, long length, extract_emit_fn emit, void* arg);
+
+/*
+Feeds a page to fn piece by piece, in whatever sizes it arrives, so it
+never has to be held whole. Each piece is copied in after the bytes fn
+left over from the last one, so buf holds at most a piece and
+EXTRACT_MAX_CARRY bytes, and the caller's buffer is not written. Emitted
+links only stay valid until emit returns.
+*/
+typedef struct extract_stream extract_stream;
+
+struct extract_stream {
+	extract_fn fn;
+	extract_emit_fn emit;
+	void* arg;
+	int state;
+	char* buf;
+	long length;
+	long size;
+};
+
+void extract_stream_init(extract_stream* stream, extract_fn fn, extract_emit_fn emit, void* arg);
+int extract_stream_push(extract_stream* stream, char* data, long length);
+void extract_stream_end(extract_stream* stream);
+void extract_stream_free(extract_stream* stream);
+
+#endif
@@ -0,0 +1,251 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include "extract.h"
+#include "webgraph.h"
+
+/*
+Checks extract_html_hrefs on snippets of awkward HTML, and that both
+extractors find the same links in the snippets and in webgraph pages when
+these are streamed in pieces of every size from 1 to 64 bytes as when they
+are scanned whole. Then times both extractors over webgraph pages, text
+and HTML, whole and streamed in pieces of -c bytes, and prints MB/s and
+links/s for each. Extractors write into the page, so every whole pass
+copies the pages to a scratch buffer first; the time of the copies alone
+is measured separately and subtracted. Exits 1 if any check fails or an
+extractor finds a different number of links than webgraph put on the
+pages.
+*/
+
+typedef struct {
+  char *html;
+  char *expect;
+} check;
+
+/* expect is the links found, each followed by a space. */
+check checks[] = {
+  { "<a href=\"p1\">x</a>", "p1 " },
+  { "<A HREF='p1'>x</A><a href=p2>y</a>", "p1 p2 " },
+  { "<a class=\"x\" title='a > b' href=\"p1\">", "p1 " },
+  { "<a\nhref\n=\n\"p1\"\n>", "p1 " },
+  { "<a href=\"  p1\n \">", "p1 " },
+  { "<a href=\"?a=1&amp;b=2\">", "?a=1&b=2 " },
+  { "<a href=\"&#112;1\"><a href=\"&#x70;2\"><a href=\"&bogus;\">", "p1 p2 &bogus; " },
+  { "<a href=\"p1\" href=\"p2\">", "p1 " },
+  { "<a name=\"top\"><a href=\"\"><a href>", "" },
+  { "<abbr href=\"p1\"><area href=\"p2\"><b href=\"p3\">", "" },
+  { "<!-- <a href=\"p1\"> --><a href=\"p2\">", "p2 " },
+  { "<script>x = '<a href=\"p1\">';</script><a href=\"p2\">", "p2 " },
+  { "<SCRIPT type=x>'</script x>'</SCRIPT><a href=p2>", "p2 " },
+  { "<style>/* <a href=\"p1\"> */</style><a href=\"p2\">", "p2 " },
+  { "<a href=\"javascript:go()\"><a href=\"MAILTO:x@y\"><a href=\"tel:1\"><a href=\"p1\">", "p1 " },
+  { "<a href=\"p1", "" },
+  { "<!-- <a href=\"p1\">", "" },
+  { "<a href=p1>", "p1 " },
+  { "<a href=p1", "p1 " },
+};
+
+double now() {
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+/* out collects the links found, each followed by a space, up to size bytes. */
+typedef struct {
+  char *out;
+  long size;
+  long used;
+  long links;
+} sink;
+
+void collect(char *link, int length, void *arg) {
+  sink *s = arg;
+  if ((int)strlen(link) != length)
+    link = "(length)";
+  s->used += snprintf(s->out + s->used, s->size - s->used, "%s ", link);
+  assert(s->used < s->size);
+}
+
+void count(char *link, int length, void *arg) {
+  ((sink *)arg)->links++;
+}
+
+/*
+Streams html to fn in pieces of every size up to 64 bytes and checks that
+each time the links found are expect.
+*/
+int check_stream(extract_fn fn, char *html, char *expect) {
+  long length = strlen(html);
+  long size = strlen(expect) + 64;
+  char *out = malloc(size);
+  sink s = { out, size, 0, 0 };
+  extract_stream stream;
+  int failed = 0;
+  long chunk, off;
+
+  for (chunk = 1; chunk <= 64 && !failed; chunk++) {
+    s.used = 0;
+    out[0] = '\0';
+    extract_stream_init(&stream, fn, collect, &s);
+    for (off = 0; off < length; off += chunk)
+      extract_stream_push(&stream, html + off, length - off < chunk ? length - off : chunk);
+    extract_stream_end(&stream);
+    extract_stream_free(&stream);
+    if (strcmp(out, expect) != 0) {
+      fprintf(stderr, "FAIL %.40s... in %ld byte pieces: got \"%.80s\", want \"%.80s\"\n", html, chunk, out,
+	      expect);
+      failed = 1;
+    }
+  }
+  free(out);
+  return failed;
+}
+
+int check_html() {
+  char page[1024];
+  char out[1024];
+  sink s = { out, sizeof(out), 0, 0 };
+  int failed = 0;
+  size_t i;
+
+  for (i = 0; i < sizeof(checks) / sizeof(checks[0]); i++) {
+    strcpy(page, checks[i].html);
+    s.used = 0;
+    out[0] = '\0';
+    extract_page(extract_html_hrefs, page, strlen(page), collect, &s);
+    if (strcmp(out, checks[i].expect) != 0) {
+      fprintf(stderr, "FAIL %s: got \"%s\", want \"%s\"\n", checks[i].html, out, checks[i].expect);
+      failed = 1;
+    }
+    failed |= check_stream(extract_html_hrefs, checks[i].html, checks[i].expect);
+  }
+  printf("%zu checks %s\n", sizeof(checks) / sizeof(checks[0]), failed ? "FAILED" : "passed");
+  return failed;
+}
+
+/* The first pages of a corpus, streamed, give the links found whole. */
+int check_pages(extract_fn fn, webgraph_params *params) {
+  int failed = 0;
+  long i;
+
+  for (i = 0; i < 20 && i < params->pages && !failed; i++) {
+    long length;
+    char *page = webgraph_page(params, i, &length);
+    char *copy = strdup(page);
+    char *out = malloc(length + 64);
+    sink s = { out, length + 64, 0, 0 };
+    out[0] = '\0';
+    extract_page(fn, copy, length, collect, &s);
+    failed = check_stream(fn, page, out);
+    free(page);
+    free(copy);
+    free(out);
+  }
+  return failed;
+}
+
+/* Every link on a webgraph page is found once by the matching extractor. */
+int bench(char *name, extract_fn fn, webgraph_params *params, int passes, long chunk) {
+  char **pages = malloc(sizeof(char *) * params->pages);
+  long *lengths = malloc(sizeof(long) * params->pages);
+  long bytes = 0, max = 0, edges = 0;
+  char *scratch;
+  sink s = { NULL, 0, 0, 0 };
+  extract_stream stream;
+  double t0, t1, t2, seconds;
+  long off;
+  long i;
+  int k;
+
+  for (i = 0; i < params->pages; i++) {
+    pages[i] = webgraph_page(params, i, &lengths[i]);
+    bytes += lengths[i];
+    if (lengths[i] > max)
+      max = lengths[i];
+  }
+  edges = webgraph_edges(params) + webgraph_mirrors(params);
+  scratch = malloc(max + 1);
+  t0 = now();
+  for (k = 0; k < passes; k++)
+    for (i = 0; i < params->pages; i++) {
+      memcpy(scratch, pages[i], lengths[i] + 1);
+      extract_page(fn, scratch, lengths[i], count, &s);
+    }
+  t1 = now();
+  for (k = 0; k < passes; k++)
+    for (i = 0; i < params->pages; i++) {
+      memcpy(scratch, pages[i], lengths[i] + 1);
+      count(scratch, 0, &s);
+    }
+  t2 = now();
+  s.links -= (long)passes * params->pages;
+  seconds = (t1 - t0) - (t2 - t1);
+  printf("%-12s %-5s %-8s %7.1f MB/s %7.2fM links/s\n", name, params->html ? "html" : "text", "whole",
+	 bytes * (double)passes / seconds / 1e6, s.links / seconds / 1e6);
+  if (s.links != edges * passes) {
+    fprintf(stderr, "FAIL %s: found %ld links, want %ld\n", name, s.links / passes, edges);
+    return 1;
+  }
+
+  /* Streamed pieces are copied into the stream, so need no scratch copy. */
+  s.links = 0;
+  extract_stream_init(&stream, fn, count, &s);
+  t0 = now();
+  for (k = 0; k < passes; k++)
+    for (i = 0; i < params->pages; i++) {
+      for (off = 0; off < lengths[i]; off += chunk)
+	extract_stream_push(&stream, pages[i] + off, lengths[i] - off < chunk ? lengths[i] - off : chunk);
+      extract_stream_end(&stream);
+    }
+  t1 = now();
+  extract_stream_free(&stream);
+  printf("%-12s %-5s %-8ld %7.1f MB/s %7.2fM links/s\n", name, params->html ? "html" : "text", chunk,
+	 bytes * (double)passes / (t1 - t0) / 1e6, s.links / (t1 - t0) / 1e6);
+  for (i = 0; i < params->pages; i++)
+    free(pages[i]);
+  free(pages);
+  free(lengths);
+  free(scratch);
+  if (s.links != edges * passes) {
+    fprintf(stderr, "FAIL %s: streamed, found %ld links, want %ld\n", name, s.links / passes, edges);
+    return 1;
+  }
+  return 0;
+}
+
+int main(int argc, char *argv[]) {
+  webgraph_params params;
+  int passes = 10;
+  long chunk = 1460;
+  int failed = 0;
+  int c;
+
+  webgraph_defaults(&params);
+  params.pages = 5000;
+  while ((c = getopt(argc, argv, "n:s:r:c:")) != -1) {
+    switch (c) {
+    case 'n': params.pages = atol(optarg); break;
+    case 's': params.page_bytes = atol(optarg); break;
+    case 'r': passes = atoi(optarg); break;
+    case 'c': chunk = atol(optarg); break;
+    default:
+      fprintf(stderr, "usage: %s [-n pages] [-s page_bytes] [-r passes] [-c chunk_bytes]\n", argv[0]);
+      return 1;
+    }
+  }
+  failed |= check_html();
+  params.html = 0;
+  failed |= check_pages(extract_link_tokens, &params);
+  params.html = 1;
+  failed |= check_pages(extract_html_hrefs, &params);
+  printf("stream checks %s\n", failed ? "FAILED" : "passed");
+  params.html = 0;
+  failed |= bench("link_tokens", extract_link_tokens, &params, passes, chunk);
+  params.html = 1;
+  failed |= bench("html_hrefs", extract_html_hrefs, &params, passes, chunk);
+  return failed;
+}
@@ -0,0 +1,46 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include "webgraph.h"
+
+/*
+Writes a synthetic web graph to a directory, one file per page, ready for
+file_tester or crawl_bench. Start crawls at p0. -H writes HTML pages.
+*/
+
+void usage(char *prog) {
+  fprintf(stderr, "usage: %s [-n pages] [-a alpha] [-m min_degree] [-M max_degree]\n"
+	  "       [-s page_bytes] [-b back_fraction] [-c cycle_len] [-D mirror_fraction] [-H] [-r seed] dir\n", prog);
+  exit(1);
+}
+
+int main(int argc, char *argv[]) {
+  webgraph_params params;
+  int c;
+
+  webgraph_defaults(&params);
+  while ((c = getopt(argc, argv, "n:a:m:M:s:b:c:D:Hr:")) != -1) {
+    switch (c) {
+    case 'n': params.pages = atol(optarg); break;
+    case 'a': params.alpha = atof(optarg); break;
+    case 'm': params.min_degree = atoi(optarg); break;
+    case 'M': params.max_degree = atoi(optarg); break;
+    case 's': params.page_bytes = atol(optarg); break;
+    case 'b': params.back_fraction = atof(optarg); break;
+    case 'c': params.cycle_len = atol(optarg); break;
+    case 'D': params.mirror_fraction = atof(optarg); break;
+    case 'H': params.html = 1; break;
+    case 'r': params.seed = strtoul(optarg, NULL, 10); break;
+    default: usage(argv[0]);
+    }
+  }
+  if (optind != argc - 1 || params.pages < 1 || params.alpha <= 1.0) {
+    usage(argv[0]);
+  }
+  if (webgraph_write(&params, argv[optind]) < 0) {
+    return 1;
+  }
+  fprintf(stderr, "%ld pages, %ld links, %ld mirrors\n", params.pages, webgraph_edges(&params),
+	  webgraph_mirrors(&params));
+  return 0;
+}
@@ -0,0 +1,422 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "graph.h"
+#include "hashtable.h"
+
+#define GRAPH_INITIAL_EDGES 1024
+
+/* Longest varint of a 33 bit zigzag encoded delta. */
+#define GRAPH_MAX_VARINT 5
+
+/*
+Sizes every stripe for 1024 URLs; they grow as needed.
+
+@return:
+int, 0 on success, -1 on allocation failure
+*/
+int graph_sink_init(graph_sink* sink, int nslots)
+{
+	int i;
+	for (i = 0; i < GRAPH_STRIPES; i++) {
+		graph_stripe* stripe = &sink->stripes[i];
+		pthread_mutex_init(&stripe->lock, NULL);
+		stripe->slots = calloc(2048 / GRAPH_STRIPES, sizeof(graph_name));
+		if (stripe->slots == NULL) {
+			return -1;
+		}
+		stripe->mask = 2048 / GRAPH_STRIPES - 1;
+		stripe->used = 0;
+	}
+	sink->edges = calloc(nslots, sizeof(graph_edges));
+	if (sink->edges == NULL) {
+		return -1;
+	}
+	sink->nslots = nslots;
+	sink->nnodes = 0;
+	return 0;
+}
+
+static graph_name* name_slot(graph_stripe* stripe, unsigned long h, char* url)
+{
+	unsigned long i = (h / GRAPH_STRIPES) & stripe->mask;
+	while (stripe->slots[i].url != NULL &&
+	       (stripe->slots[i].hash != h || strcmp(stripe->slots[i].url, url) != 0)) {
+		i = (i + 1) & stripe->mask;
+	}
+	return &stripe->slots[i];
+}
+
+/*
+Doubles a stripe's table. Called with the stripe lock held.
+*/
+static int stripe_grow(graph_stripe* stripe)
+{
+	graph_name* old = stripe->slots;
+	unsigned long size = stripe->mask + 1;
+	unsigned long i;
+
+	stripe->slots = calloc(size * 2, sizeof(graph_name));
+	if (stripe->slots == NULL) {
+		stripe->slots = old;
+		return -1;
+	}
+	stripe->mask = size * 2 - 1;
+	for (i = 0; i < size; i++) {
+		if (old[i].url != NULL) {
+			*name_slot(stripe, old[i].hash, old[i].url) = old[i];
+		}
+	}
+	free(old);
+	return 0;
+}
+
+/*
+Looks url up, assigning it the next id if it is new. A new URL is not
+taken if its stripe is full and cannot grow: the probe for the next one
+would never end.
+
+@return:
+int, 0 with *id set, -1 if url is new and there is no room for it
+*/
+static int intern(graph_sink* sink, char* url, uint32_t* id)
+{
+	unsigned long h = hash(url);
+	graph_stripe* stripe = &sink->stripes[h % GRAPH_STRIPES];
+	graph_name* name;
+	char* copy;
+
+	pthread_mutex_lock(&stripe->lock);
+	name = name_slot(stripe, h, url);
+	if (name->url == NULL) {
+		if (2 * (stripe->used + 1) > stripe->mask + 1) {
+			if (stripe_grow(stripe) < 0) {
+				pthread_mutex_unlock(&stripe->lock);
+				return -1;
+			}
+			name = name_slot(stripe, h, url);
+		}
+		if ((copy = strdup(url)) == NULL) {
+			pthread_mutex_unlock(&stripe->lock);
+			return -1;
+		}
+		name->hash = h;
+		name->url = copy;
+		name->id = __atomic_fetch_add(&sink->nnodes, 1, __ATOMIC_RELAXED);
+		stripe->used++;
+	}
+	*id = name->id;
+	pthread_mutex_unlock(&stripe->lock);
+	return 0;
+}
+
+/*
+Records a link from the page from to the URL to. Only the thread that owns
+slot may use it. If the slot's buffer cannot grow, or either URL cannot be
+given an id, the link is dropped.
+*/
+void graph_sink_add(graph_sink* sink, int slot, char* from, char* to)
+{
+	graph_edges* edges = &sink->edges[slot];
+	uint32_t to_id;
+
+	if (edges->last_from == NULL || strcmp(edges->last_from, from) != 0) {
+		free(edges->last_from);
+		edges->last_from = NULL;
+		if (intern(sink, from, &edges->last_from_id) < 0) {
+			return;
+		}
+		edges->last_from = strdup(from);
+	}
+	if (edges->n == edges->size) {
+		unsigned long size = edges->size > 0 ? edges->size * 2 : GRAPH_INITIAL_EDGES;
+		uint32_t* pairs = realloc(edges->pairs, sizeof(uint32_t) * 2 * size);
+		if (pairs == NULL) {
+			return;
+		}
+		edges->pairs = pairs;
+		edges->size = size;
+	}
+	if (intern(sink, to, &to_id) < 0) {
+		return;
+	}
+	edges->pairs[2 * edges->n] = edges->last_from_id;
+	edges->pairs[2 * edges->n + 1] = to_id;
+	edges->n++;
+}
+
+static int compare_ids(const void* a, const void* b)
+{
+	uint32_t x = *(const uint32_t*)a;
+	uint32_t y = *(const uint32_t*)b;
+	return x < y ? -1 : x > y;
+}
+
+static int put_varint(unsigned char* buf, uint64_t v)
+{
+	int n = 0;
+	while (v >= 0x80) {
+		buf[n++] = (v & 0x7f) | 0x80;
+		v >>= 7;
+	}
+	buf[n++] = v;
+	return n;
+}
+
+/*
+Sorts and deduplicates the targets of node id and encodes them into buf.
+
+@return:
+long, the number of bytes written to buf; *degree is set to the number of
+distinct targets
+*/
+static long encode_row(uint32_t id, uint32_t* targets, uint64_t n, unsigned char* buf, uint64_t* degree)
+{
+	long length = 0;
+	uint64_t i;
+	int64_t delta;
+
+	*degree = 0;
+	if (n == 0) {
+		return 0;
+	}
+	qsort(targets, n, sizeof(uint32_t), compare_ids);
+	delta = (int64_t)targets[0] - (int64_t)id;
+	length += put_varint(buf, ((uint64_t)delta << 1) ^ (uint64_t)(delta >> 63));
+	*degree = 1;
+	for (i = 1; i < n; i++) {
+		if (targets[i] != targets[i - 1]) {
+			length += put_varint(buf + length, targets[i] - targets[i - 1] - 1);
+			(*degree)++;
+		}
+	}
+	return length;
+}
+
+/*
+Writes the graph collected so far to path, by way of path.tmp so a failed
+write leaves any earlier graph alone. Call once no worker is adding edges.
+
+@return:
+int, 0 on success, -1 on failure
+*/
+int graph_sink_write(graph_sink* sink, char* path)
+{
+	char tmp[4096];
+	graph_header hdr;
+	uint32_t n = sink->nnodes;
+	uint64_t* rows = calloc(n + 1, sizeof(uint64_t));
+	uint64_t* offsets = malloc(sizeof(uint64_t) * (n + 1));
+	char** names = malloc(sizeof(char*) * (n > 0 ? n : 1));
+	uint32_t* targets = NULL;
+	unsigned char* buf = NULL;
+	uint64_t total = 0;
+	uint64_t max_raw = 0;
+	uint64_t pad = 0;
+	uint64_t i;
+	unsigned long j;
+	int s;
+	int failed = 0;
+	FILE* file;
+
+	if (rows == NULL || offsets == NULL || names == NULL) {
+		failed = 1;
+		goto out;
+	}
+	for (s = 0; s < GRAPH_STRIPES; s++) {
+		for (j = 0; j <= sink->stripes[s].mask; j++) {
+			if (sink->stripes[s].slots[j].url != NULL) {
+				names[sink->stripes[s].slots[j].id] = sink->stripes[s].slots[j].url;
+			}
+		}
+	}
+
+	/* Bucket the targets by source: count, prefix sum, place. */
+	for (s = 0; s < sink->nslots; s++) {
+		for (j = 0; j < sink->edges[s].n; j++) {
+			rows[sink->edges[s].pairs[2 * j] + 1]++;
+		}
+		total += sink->edges[s].n;
+	}
+	for (i = 0; i < n; i++) {
+		max_raw = rows[i + 1] > max_raw ? rows[i + 1] : max_raw;
+		rows[i + 1] += rows[i];
+	}
+	targets = malloc(sizeof(uint32_t) * (total > 0 ? total : 1));
+	buf = malloc(GRAPH_MAX_VARINT * (max_raw > 0 ? max_raw : 1));
+	if (targets == NULL || buf == NULL) {
+		failed = 1;
+		goto out;
+	}
+	for (s = 0; s < sink->nslots; s++) {
+		for (j = 0; j < sink->edges[s].n; j++) {
+			targets[rows[sink->edges[s].pairs[2 * j]]++] = sink->edges[s].pairs[2 * j + 1];
+		}
+	}
+	for (i = n; i > 0; i--) {
+		rows[i] = rows[i - 1];
+	}
+	rows[0] = 0;
+
+	snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+	file = fopen(tmp, "w");
+	if (file == NULL) {
+		perror("graph: create");
+		failed = 1;
+		goto out;
+	}
+	memset(&hdr, 0, sizeof(hdr));
+	fwrite(&hdr, sizeof(hdr), 1, file);
+	fwrite(offsets, sizeof(uint64_t), n + 1, file);
+	offsets[0] = 0;
+	for (i = 0; i < n; i++) {
+		uint64_t degree;
+		long length = encode_row(i, targets + rows[i], rows[i + 1] - rows[i], buf, &degree);
+		fwrite(buf, 1, length, file);
+		offsets[i + 1] = offsets[i] + length;
+		hdr.nedges += degree;
+		hdr.max_degree = degree > hdr.max_degree ? degree : hdr.max_degree;
+	}
+	hdr.adjacency_bytes = offsets[n];
+	fwrite(&pad, 1, (8 - hdr.adjacency_bytes % 8) % 8, file);
+
+	/* The row offsets are done with; reuse them for the names. */
+	rows[0] = 0;
+	for (i = 0; i < n; i++) {
+		rows[i + 1] = rows[i] + strlen(names[i]) + 1;
+	}
+	hdr.name_bytes = rows[n];
+	fwrite(rows, sizeof(uint64_t), n + 1, file);
+	for (i = 0; i < n; i++) {
+		fwrite(names[i], 1, rows[i + 1] - rows[i], file);
+	}
+
+	hdr.magic = GRAPH_MAGIC;
+	hdr.version = GRAPH_VERSION;
+	hdr.nnodes = n;
+	failed = fseek(file, 0, SEEK_SET) < 0 || fwrite(&hdr, sizeof(hdr), 1, file) != 1 ||
+		 fwrite(offsets, sizeof(uint64_t), n + 1, file) != n + 1;
+	failed = fflush(file) != 0 || ferror(file) || failed;
+	failed = fsync(fileno(file)) < 0 || failed;
+	if (fclose(file) != 0 || failed || rename(tmp, path) < 0) {
+		perror("graph: write");
+		unlink(tmp);
+		failed = 1;
+	}
+
+out:
+	free(rows);
+	free(offsets);
+	free(names);
+	free(targets);
+	free(buf);
+	return failed ? -1 : 0;
+}
+
+void graph_sink_free(graph_sink* sink)
+{
+	unsigned long j;
+	int s;
+	for (s = 0; s < GRAPH_STRIPES; s++) {
+		for (j = 0; j <= sink->stripes[s].mask; j++) {
+			free(sink->stripes[s].slots[j].url);
+		}
+		free(sink->stripes[s].slots);
+		pthread_mutex_destroy(&sink->stripes[s].lock);
+	}
+	for (s = 0; s < sink->nslots; s++) {
+		free(sink->edges[s].pairs);
+		free(sink->edges[s].last_from);
+	}
+	free(sink->edges);
+}
+
+/*
+Maps the graph in path and checks that its sections add up to the file.
+
+@return:
+int, 0 on success, -1 if path cannot be read or is not a graph
+*/
+int graph_open(graph* g, char* path)
+{
+	struct stat st;
+	uint64_t expected;
+	int fd = open(path, O_RDONLY);
+
+	if (fd < 0 || fstat(fd, &st) < 0) {
+		perror("graph: open");
+		if (fd >= 0) {
+			close(fd);
+		}
+		return -1;
+	}
+	g->map_size = st.st_size;
+	g->map = g->map_size >= sizeof(graph_header) ?
+		 mmap(NULL, g->map_size, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+	close(fd);
+	if (g->map == MAP_FAILED) {
+		fprintf(stderr, "graph: %s is not a graph\n", path);
+		return -1;
+	}
+	g->hdr = g->map;
+	expected = sizeof(graph_header) + 2 * (g->hdr->nnodes + 1) * sizeof(uint64_t) +
+		   (g->hdr->adjacency_bytes + 7) / 8 * 8 + g->hdr->name_bytes;
+	if (g->hdr->magic != GRAPH_MAGIC || g->hdr->version != GRAPH_VERSION || expected != g->map_size) {
+		fprintf(stderr, "graph: %s is not a graph\n", path);
+		munmap(g->map, g->map_size);
+		return -1;
+	}
+	g->rows = (uint64_t*)(g->hdr + 1);
+	g->adjacency = (unsigned char*)(g->rows + g->hdr->nnodes + 1);
+	g->name_offsets = (uint64_t*)(g->adjacency + (g->hdr->adjacency_bytes + 7) / 8 * 8);
+	g->names = (char*)(g->name_offsets + g->hdr->nnodes + 1);
+	return 0;
+}
+
+char* graph_url(graph* g, uint32_t id)
+{
+	return g->names + g->name_offsets[id];
+}
+
+/*
+Decodes the targets of node id into out, which must have room for
+hdr->max_degree of them.
+
+@return:
+int, the number of targets
+*/
+int graph_neighbors(graph* g, uint32_t id, uint32_t* out)
+{
+	unsigned char* p = g->adjacency + g->rows[id];
+	unsigned char* end = g->adjacency + g->rows[id + 1];
+	uint64_t prev = 0;
+	int n = 0;
+
+	while (p < end) {
+		uint64_t v = 0;
+		int shift = 0;
+		do {
+			v |= (uint64_t)(*p & 0x7f) << shift;
+			shift += 7;
+		} while (*p++ & 0x80);
+		if (n == 0) {
+			prev = id + ((int64_t)(v >> 1) ^ -(int64_t)(v & 1));
+		}
+		else {
+			prev += v + 1;
+		}
+		out[n++] = prev;
+	}
+	return n;
+}
+
+void graph_close(graph* g)
+{
+	munmap(g->map, g->map_size);
+}
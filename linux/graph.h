@@ -0,0 +1,103 @@
+#ifndef __GRAPH_H
+#define __GRAPH_H
+
+#include <stdint.h>
+#include <pthread.h>
+
+/*
+The link graph of a crawl in compressed sparse row form. While the crawl
+runs, a graph_sink interns every URL it is given to a dense id (in the
+order they are first seen, which keeps the ids of pages linked from one
+page close together) and appends edges to per worker buffers, so workers
+never share a buffer. graph_write sorts the edges by source and writes:
+
+  header          graph_header
+  row offsets     uint64 [nnodes + 1], byte offsets into the adjacency
+  adjacency       per node, its distinct targets in increasing order as
+                  varints: the first zigzag encoded relative to the node's
+                  own id, the rest as the gap to the previous one, less one
+  padding         zeros, to a multiple of 8 bytes
+  name offsets    uint64 [nnodes + 1], byte offsets into the names
+  names           every URL, NUL terminated, in id order
+
+A graph is read by mapping the file: graph_open validates the header and
+points into the mapping, and nothing is decoded until asked for, so
+loading takes the same time however big the graph is.
+*/
+#define GRAPH_MAGIC 0x43535247524150ULL
+#define GRAPH_VERSION 1
+#define GRAPH_STRIPES 64
+
+typedef struct graph_name graph_name;
+typedef struct graph_stripe graph_stripe;
+typedef struct graph_edges graph_edges;
+typedef struct graph_sink graph_sink;
+typedef struct graph_header graph_header;
+typedef struct graph graph;
+
+/* Empty when url is NULL. */
+struct graph_name {
+	unsigned long hash;
+	uint32_t id;
+	char* url;
+};
+
+/* Interned URLs whose hash falls in this stripe, at most half full. */
+struct graph_stripe {
+	pthread_mutex_t lock;
+	graph_name* slots;
+	unsigned long mask;
+	unsigned long used;
+} __attribute__((aligned(64)));
+
+/*
+One worker's edges, as (from, to) pairs. last_from caches the id of the
+page whose links the worker is reporting, which is the same for all of
+them.
+*/
+struct graph_edges {
+	uint32_t* pairs;
+	unsigned long n;
+	unsigned long size;
+	char* last_from;
+	uint32_t last_from_id;
+} __attribute__((aligned(64)));
+
+struct graph_sink {
+	graph_stripe stripes[GRAPH_STRIPES];
+	graph_edges* edges;
+	int nslots;
+	uint32_t nnodes;
+};
+
+struct graph_header {
+	uint64_t magic;
+	uint64_t version;
+	uint64_t nnodes;
+	uint64_t nedges;
+	uint64_t max_degree;
+	uint64_t adjacency_bytes;
+	uint64_t name_bytes;
+};
+
+struct graph {
+	void* map;
+	size_t map_size;
+	graph_header* hdr;
+	uint64_t* rows;
+	unsigned char* adjacency;
+	uint64_t* name_offsets;
+	char* names;
+};
+
+int graph_sink_init(graph_sink* sink, int nslots);
+void graph_sink_add(graph_sink* sink, int slot, char* from, char* to);
+int graph_sink_write(graph_sink* sink, char* path);
+void graph_sink_free(graph_sink* sink);
+
+int graph_open(graph* g, char* path);
+char* graph_url(graph* g, uint32_t id);
+int graph_neighbors(graph* g, uint32_t id, uint32_t* out);
+void graph_close(graph* g);
+
+#endif
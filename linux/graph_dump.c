@@ -0,0 +1,56 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include "graph.h"
+
+/*
+Reads a link graph written by a crawl (see crawl_set_graph) and prints its
+size and how long it took to open. With -e, also prints every edge in the
+"from -> to" form the testers print edges in.
+*/
+
+void usage(char *prog) {
+  fprintf(stderr, "usage: %s [-e] graph_file\n", prog);
+  exit(1);
+}
+
+int main(int argc, char *argv[]) {
+  struct timeval t0, t1;
+  graph g;
+  uint32_t *out;
+  uint64_t i;
+  int edges = 0;
+  int c, j, n;
+
+  while ((c = getopt(argc, argv, "e")) != -1) {
+    switch (c) {
+    case 'e': edges = 1; break;
+    default: usage(argv[0]);
+    }
+  }
+  if (optind != argc - 1) {
+    usage(argv[0]);
+  }
+  gettimeofday(&t0, NULL);
+  if (graph_open(&g, argv[optind]) < 0) {
+    return 1;
+  }
+  gettimeofday(&t1, NULL);
+  fprintf(stderr, "%lu nodes, %lu edges (max degree %lu), %lu bytes (%.2f per edge), opened in %ldus\n",
+	  (unsigned long)g.hdr->nnodes, (unsigned long)g.hdr->nedges, (unsigned long)g.hdr->max_degree,
+	  (unsigned long)g.map_size, g.hdr->nedges > 0 ? (double)g.map_size / g.hdr->nedges : 0.0,
+	  (t1.tv_sec - t0.tv_sec) * 1000000L + (t1.tv_usec - t0.tv_usec));
+  if (edges) {
+    out = malloc(sizeof(uint32_t) * (g.hdr->max_degree > 0 ? g.hdr->max_degree : 1));
+    for (i = 0; i < g.hdr->nnodes; i++) {
+      n = graph_neighbors(&g, i, out);
+      for (j = 0; j < n; j++) {
+	printf("%s -> %s\n", graph_url(&g, i), graph_url(&g, out[j]));
+      }
+    }
+    free(out);
+  }
+  graph_close(&g);
+  return 0;
+}
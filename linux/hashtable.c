@@ -0,0 +1,105 @@
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "hashtable.h"
+
+void hash_init(hashtable* tbl, int size) {
+	tbl->max = size;
+	tbl->table = calloc(size, sizeof(bucket*));
+	tbl->lock = malloc(sizeof(pthread_mutex_t));
+	pthread_mutex_init(tbl->lock, NULL);
+}
+
+/*
+The function for the hash table.
+
+@params:
+unsigned char *str, the string to be hashed (url)
+@return:
+unsigned long, the computed key
+
+**NOTE: this is the djb2 function created by Dan Bernstein for strings.**
+Source: http://www.cse.yorku.ca/~oz/hash.html
+*/
+unsigned long hash(char *str)
+{
+        unsigned long hash = 5381;
+        int c;
+        int i;
+        for (i = 0; str[i] != 0; i++)
+        {
+            c = str[i];
+            hash = ((hash << 5) + hash) + c; /* hash * 33 + c */
+        }
+
+        return hash;
+}
+
+/*
+Looks link up in tbl and inserts a private copy of it if it is not there.
+Must be called with tbl->lock held. New buckets are published with release
+stores so hash_find can walk the chains without the lock.
+
+@return:
+int, 1 if link was already in the table, 0 if it was just inserted
+*/
+int hash_find_insert(hashtable *tbl, char* link) {
+	
+        unsigned long key = hash(link) % (tbl->max);
+        bucket** slot = &tbl->table[key];
+        bucket* new_b;
+
+        while(*slot != NULL) {
+                if(strcmp((*slot)->link, link) == 0) {
+                        return 1;
+                }
+                slot = &(*slot)->next;
+        }
+        new_b = malloc(sizeof(bucket));
+        new_b->next = NULL;
+        new_b->link = malloc(sizeof(char) * (int)strlen(link) + 1);
+        strcpy(new_b->link, link);
+        __atomic_store_n(slot, new_b, __ATOMIC_RELEASE);
+        return 0;
+}
+
+/*
+Lock free lookup. Buckets are only ever appended and never freed, so a
+reader racing with hash_find_insert either sees the new bucket or misses it
+and falls back to the locked path.
+
+@return:
+int, 1 if link is in the table, 0 otherwise
+*/
+int hash_find(hashtable *tbl, char* link) {
+        unsigned long key = hash(link) % (tbl->max);
+        bucket* copy = __atomic_load_n(&tbl->table[key], __ATOMIC_ACQUIRE);
+
+        while(copy != NULL) {
+                if(strcmp(copy->link, link) == 0) {
+                        return 1;
+                }
+                copy = __atomic_load_n(&copy->next, __ATOMIC_ACQUIRE);
+        }
+        return 0;
+}
+
+/*
+Frees every bucket and key in tbl along with the table and its lock.
+Only safe once no reader can still be walking the chains.
+*/
+void hash_free(hashtable *tbl) {
+        int i;
+        for(i = 0; i < tbl->max; i++) {
+                bucket* copy = tbl->table[i];
+                while(copy != NULL) {
+                        bucket* next = copy->next;
+                        free(copy->link);
+                        free(copy);
+                        copy = next;
+                }
+        }
+        free(tbl->table);
+        pthread_mutex_destroy(tbl->lock);
+        free(tbl->lock);
+}
@@ -0,0 +1,29 @@
+#ifndef __HASHTABLE_H
+#define __HASHTABLE_H
+
+#include <pthread.h>
+
+struct bucket;
+struct hashtable;
+
+typedef struct bucket bucket;
+typedef struct hashtable hashtable;
+
+struct bucket {
+    bucket* next;
+    char* link;
+};
+
+struct hashtable {
+    bucket** table;
+    int max;
+    pthread_mutex_t* lock;
+};
+
+unsigned long hash(char *str);
+void hash_init(hashtable *tbl, int size);
+int hash_find_insert(hashtable *tbl, char* link);
+int hash_find(hashtable *tbl, char* link);
+void hash_free(hashtable *tbl);
+
+#endif
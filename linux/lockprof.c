@@ -0,0 +1,101 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "lockprof.h"
+#include "stats.h"
+
+/*
+Takes mutex, trying without blocking first so that a wait is only timed,
+and counted as contended, when the mutex was actually held.
+*/
+void lockprof_lock(lockprof* prof, pthread_mutex_t* mutex)
+{
+	uint64_t t0;
+	uint64_t wait;
+
+	if (prof == NULL) {
+		pthread_mutex_lock(mutex);
+		return;
+	}
+	if (pthread_mutex_trylock(mutex) == 0) {
+		prof->acquisitions++;
+		prof->held_since = stats_now_ns();
+		return;
+	}
+	t0 = stats_now_ns();
+	pthread_mutex_lock(mutex);
+	prof->held_since = stats_now_ns();
+	wait = prof->held_since - t0;
+	prof->acquisitions++;
+	prof->contended++;
+	prof->wait_ns += wait;
+	if (wait > prof->max_wait_ns) {
+		prof->max_wait_ns = wait;
+	}
+}
+
+void lockprof_wait_begin(lockprof* prof)
+{
+	uint64_t hold;
+
+	if (prof == NULL) {
+		return;
+	}
+	hold = stats_now_ns() - prof->held_since;
+	prof->hold_ns += hold;
+	if (hold > prof->max_hold_ns) {
+		prof->max_hold_ns = hold;
+	}
+}
+
+void lockprof_wait_end(lockprof* prof)
+{
+	if (prof != NULL) {
+		prof->held_since = stats_now_ns();
+	}
+}
+
+void lockprof_unlock(lockprof* prof, pthread_mutex_t* mutex)
+{
+	lockprof_wait_begin(prof);
+	pthread_mutex_unlock(mutex);
+}
+
+static int by_wait(const void* a, const void* b)
+{
+	const lockprof* x = a;
+	const lockprof* y = b;
+	return x->wait_ns < y->wait_ns ? 1 : x->wait_ns > y->wait_ns ? -1 : 0;
+}
+
+/*
+Prints one line per profile, most waited on first. elapsed_ns is the
+length of the run, against which wait and hold times are given as a
+share: summed over all threads, so a lock held 50% of the time by each of
+four threads shows 200%.
+*/
+void lockprof_print(FILE* file, lockprof* profs, int n, uint64_t elapsed_ns)
+{
+	lockprof* sorted = malloc(sizeof(lockprof) * n);
+	double elapsed = elapsed_ns > 0 ? elapsed_ns : 1;
+	int i;
+
+	if (sorted == NULL) {
+		return;
+	}
+	memcpy(sorted, profs, sizeof(lockprof) * n);
+	qsort(sorted, n, sizeof(lockprof), by_wait);
+	fprintf(file, "%-24s %10s %10s %8s %10s %8s %11s %10s %8s %11s\n", "lock", "acquired", "contended", "(%)",
+		"wait ms", "(%)", "max wait us", "held ms", "(%)", "max held us");
+	for (i = 0; i < n; i++) {
+		lockprof* p = &sorted[i];
+		fprintf(file, "%-24s %10lu %10lu %7.2f%% %10.3f %7.2f%% %11.1f %10.3f %7.2f%% %11.1f\n", p->name,
+			p->acquisitions, p->contended,
+			p->acquisitions ? 100.0 * p->contended / p->acquisitions : 0.0,
+			p->wait_ns / 1e6, 100.0 * p->wait_ns / elapsed, p->max_wait_ns / 1e3,
+			p->hold_ns / 1e6, 100.0 * p->hold_ns / elapsed, p->max_hold_ns / 1e3);
+	}
+	free(sorted);
+}
@@ -0,0 +1,59 @@
+#ifndef __LOCKPROF_H
+#define __LOCKPROF_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <pthread.h>
+
+/*
+Lock contention profiling. A lockprof is the profile of one named mutex:
+how often it was taken, how often it was already held (a trylock failed
+first), how long takers waited for it and how long it was held. Its
+counters are only written by the thread holding the mutex, so they need
+no locking of their own.
+
+Code takes a profiled mutex with LOCKPROF_LOCK and LOCKPROF_UNLOCK, and
+brackets condition waits on it with LOCKPROF_WAIT_BEGIN and
+LOCKPROF_WAIT_END, since the wait drops the mutex: the time asleep is not
+held time, and the retake inside the wait is not counted. The macros only
+profile when compiled with -DCRAWL_LOCK_PROFILE (make LOCKPROF=1);
+otherwise they are plain pthread calls and the profiles stay empty.
+
+Modules that own a mutex (visited.h, checkpoint.h) keep a lockprof* next
+to it for their owner to point at a profile; left NULL, the macros take
+and release the mutex without profiling it.
+*/
+typedef struct lockprof lockprof;
+
+struct lockprof {
+	char* name;
+	unsigned long acquisitions;
+	unsigned long contended;
+	uint64_t wait_ns;
+	uint64_t max_wait_ns;
+	uint64_t hold_ns;
+	uint64_t max_hold_ns;
+	uint64_t held_since;
+};
+
+#define LOCKPROF_INIT(name) { name, 0, 0, 0, 0, 0, 0, 0 }
+
+#ifdef CRAWL_LOCK_PROFILE
+#define LOCKPROF_LOCK(prof, mutex) lockprof_lock(prof, mutex)
+#define LOCKPROF_UNLOCK(prof, mutex) lockprof_unlock(prof, mutex)
+#define LOCKPROF_WAIT_BEGIN(prof) lockprof_wait_begin(prof)
+#define LOCKPROF_WAIT_END(prof) lockprof_wait_end(prof)
+#else
+#define LOCKPROF_LOCK(prof, mutex) pthread_mutex_lock(mutex)
+#define LOCKPROF_UNLOCK(prof, mutex) pthread_mutex_unlock(mutex)
+#define LOCKPROF_WAIT_BEGIN(prof) ((void)0)
+#define LOCKPROF_WAIT_END(prof) ((void)0)
+#endif
+
+void lockprof_lock(lockprof* prof, pthread_mutex_t* mutex);
+void lockprof_unlock(lockprof* prof, pthread_mutex_t* mutex);
+void lockprof_wait_begin(lockprof* prof);
+void lockprof_wait_end(lockprof* prof);
+void lockprof_print(FILE* file, lockprof* profs, int n, uint64_t elapsed_ns);
+
+#endif
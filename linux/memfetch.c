@@ -0,0 +1,179 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <time.h>
+#include "memfetch.h"
+
+static char** corpus;
+static long* corpus_len;
+static long corpus_pages;
+static webgraph_params lazy_params;
+static memfetch_latency latency;
+
+/* Per-thread generator state; 0 means not seeded yet. */
+static __thread uint64_t rng_state;
+static unsigned long next_seed;
+
+static double rng_unit(void)
+{
+	uint64_t x;
+	if (rng_state == 0) {
+		rng_state = 0x9e3779b97f4a7c15ULL * (__atomic_add_fetch(&next_seed, 1, __ATOMIC_RELAXED));
+	}
+	x = rng_state;
+	x ^= x >> 12;
+	x ^= x << 25;
+	x ^= x >> 27;
+	rng_state = x;
+	return (((x * 0x2545f4914f6cdd1dULL) >> 11) + 0.5) / 9007199254740992.0;
+}
+
+/*
+Parses a latency spec, see memfetch.h.
+
+@return:
+int, 0 on success, -1 if spec is malformed
+*/
+int memfetch_parse_latency(char* spec, memfetch_latency* out)
+{
+	out->mean_us = 0;
+	out->shape = 0;
+	if (strcmp(spec, "none") == 0) {
+		out->dist = MEMFETCH_NONE;
+		return 0;
+	}
+	if (sscanf(spec, "fixed:%lf", &out->mean_us) == 1) {
+		out->dist = MEMFETCH_FIXED;
+	}
+	else if (sscanf(spec, "exp:%lf", &out->mean_us) == 1) {
+		out->dist = MEMFETCH_EXP;
+	}
+	else if (sscanf(spec, "pareto:%lf:%lf", &out->mean_us, &out->shape) == 2 && out->shape > 1.0) {
+		out->dist = MEMFETCH_PARETO;
+	}
+	else {
+		return -1;
+	}
+	return out->mean_us >= 0 ? 0 : -1;
+}
+
+/*
+Generates the whole corpus up front, so fetches only pay for the copy and
+the injected delay.
+
+@return:
+int, 0 on success, -1 on allocation failure
+*/
+int memfetch_init(webgraph_params* params, memfetch_latency* lat)
+{
+	long i;
+	corpus = malloc(sizeof(char*) * params->pages);
+	corpus_len = malloc(sizeof(long) * params->pages);
+	if (corpus == NULL || corpus_len == NULL) {
+		return -1;
+	}
+	for (i = 0; i < params->pages; i++) {
+		corpus[i] = webgraph_page(params, i, &corpus_len[i]);
+	}
+	corpus_pages = params->pages;
+	latency = *lat;
+	return 0;
+}
+
+/*
+Like memfetch_init, but pages are generated as they are fetched instead of
+all up front, for corpora too big to hold, or to keep the corpus out of a
+benchmark's memory use. memfetch_page cannot hand out such pages and
+always returns NULL.
+
+@return:
+int, 0
+*/
+int memfetch_init_lazy(webgraph_params* params, memfetch_latency* lat)
+{
+	corpus = NULL;
+	corpus_pages = params->pages;
+	lazy_params = *params;
+	latency = *lat;
+	return 0;
+}
+
+/*
+Draws one delay from the configured distribution.
+
+@return:
+double, the delay in microseconds
+*/
+double memfetch_delay_us(void)
+{
+	switch (latency.dist) {
+	case MEMFETCH_FIXED:
+		return latency.mean_us;
+	case MEMFETCH_EXP:
+		return -latency.mean_us * log(rng_unit());
+	case MEMFETCH_PARETO:
+		return latency.mean_us * (latency.shape - 1.0) / latency.shape /
+			pow(rng_unit(), 1.0 / latency.shape);
+	default:
+		return 0;
+	}
+}
+
+/*
+Sleeps for delay microseconds; delays under one are skipped.
+*/
+void memfetch_sleep_us(double delay)
+{
+	if (delay >= 1.0) {
+		struct timespec ts;
+		ts.tv_sec = (time_t)(delay / 1e6);
+		ts.tv_nsec = (long)((delay - ts.tv_sec * 1e6) * 1000);
+		while (nanosleep(&ts, &ts) != 0)
+			;
+	}
+}
+
+/*
+Looks link up in the corpus without a delay or a copy, for fetchers that
+hand pages over in pieces.
+
+@return:
+char*, the page, not to be written or freed, or NULL if link is not in the
+corpus; *length is set to its length
+*/
+char* memfetch_page(char* link, long* length)
+{
+	long i = webgraph_index(link);
+
+	if (corpus == NULL || i < 0 || i >= corpus_pages) {
+		return NULL;
+	}
+	*length = corpus_len[i];
+	return corpus[i];
+}
+
+/*
+fetch_fn for crawl(): sleeps for one delay, then copies the page.
+
+@return:
+char*, a malloc'd copy of the page, or NULL if link is not in the corpus
+*/
+char* memfetch_fetch(char* link)
+{
+	long i = webgraph_index(link);
+	long length;
+	char* page;
+
+	memfetch_sleep_us(memfetch_delay_us());
+	if (i < 0 || i >= corpus_pages) {
+		return NULL;
+	}
+	if (corpus == NULL) {
+		return webgraph_page(&lazy_params, i, &length);
+	}
+	page = malloc(corpus_len[i] + 1);
+	memcpy(page, corpus[i], corpus_len[i] + 1);
+	return page;
+}
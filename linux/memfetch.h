@@ -0,0 +1,43 @@
+#ifndef __MEMFETCH_H
+#define __MEMFETCH_H
+
+#include "webgraph.h"
+
+/*
+A fetch_fn backed by a synthetic corpus held in memory, with injected
+latency, for benchmarking the crawler without disk or network. Every fetch
+sleeps for a delay drawn from the configured distribution, then returns a
+malloc'd copy of the page.
+
+Latency specs, all in microseconds:
+  none               no delay
+  fixed:MEAN         always MEAN
+  exp:MEAN           exponential with mean MEAN
+  pareto:MEAN:SHAPE  Pareto with mean MEAN and tail index SHAPE (> 1); the
+                     smaller SHAPE, the longer the tail
+*/
+
+typedef enum {
+	MEMFETCH_NONE,
+	MEMFETCH_FIXED,
+	MEMFETCH_EXP,
+	MEMFETCH_PARETO
+} memfetch_dist;
+
+typedef struct memfetch_latency memfetch_latency;
+
+struct memfetch_latency {
+	memfetch_dist dist;
+	double mean_us;
+	double shape;
+};
+
+int memfetch_parse_latency(char* spec, memfetch_latency* out);
+int memfetch_init(webgraph_params* params, memfetch_latency* latency);
+int memfetch_init_lazy(webgraph_params* params, memfetch_latency* latency);
+char* memfetch_fetch(char* link);
+char* memfetch_page(char* link, long* length);
+double memfetch_delay_us(void);
+void memfetch_sleep_us(double delay);
+
+#endif
@@ -0,0 +1,432 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "pagecache.h"
+
+#define NO_SEGMENT PAGECACHE_MAX_SEGMENTS
+
+static int fp_empty(dedup_fp* fp)
+{
+	return fp->lo == 0 && fp->hi == 0;
+}
+
+static int fp_equal(dedup_fp* a, dedup_fp* b)
+{
+	return a->lo == b->lo && a->hi == b->hi;
+}
+
+/*
+@return:
+pagecache_url*, the slot holding key, or the empty slot where it would go
+*/
+static pagecache_url* url_slot(pagecache* cache, dedup_fp* key)
+{
+	uint64_t mask = cache->hdr->nslots - 1;
+	uint64_t i = key->lo & mask;
+	while (!fp_empty(&cache->urls[i].url) && !fp_equal(&cache->urls[i].url, key)) {
+		i = (i + 1) & mask;
+	}
+	return &cache->urls[i];
+}
+
+static pagecache_blob* blob_slot(pagecache* cache, dedup_fp* body)
+{
+	uint64_t mask = cache->hdr->nslots - 1;
+	uint64_t i = body->lo & mask;
+	while (!fp_empty(&cache->blobs[i].body) && !fp_equal(&cache->blobs[i].body, body)) {
+		i = (i + 1) & mask;
+	}
+	return &cache->blobs[i];
+}
+
+static void segment_path(pagecache* cache, uint64_t id, char* buf, size_t size)
+{
+	snprintf(buf, size, "%s/seg.%lu", cache->dir, (unsigned long)id);
+}
+
+/*
+Opens segment slot s on first use. May be called under the read lock, so
+racing openers agree on one descriptor.
+
+@return:
+int, the descriptor, or -1 if the segment file cannot be opened
+*/
+static int segment_fd(pagecache* cache, uint64_t s)
+{
+	char path[4096];
+	int expected = -1;
+	int fd = __atomic_load_n(&cache->fds[s], __ATOMIC_ACQUIRE);
+	if (fd >= 0) {
+		return fd;
+	}
+	segment_path(cache, cache->hdr->segments[s].id, path, sizeof(path));
+	fd = open(path, O_RDWR);
+	if (fd < 0) {
+		return -1;
+	}
+	if (!__atomic_compare_exchange_n(&cache->fds[s], &expected, fd, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+		close(fd);
+		return expected;
+	}
+	return fd;
+}
+
+static void touch(pagecache* cache, uint64_t s)
+{
+	uint64_t now = __atomic_add_fetch(&cache->hdr->clock, 1, __ATOMIC_RELAXED);
+	__atomic_store_n(&cache->hdr->segments[s].last_used, now, __ATOMIC_RELAXED);
+}
+
+/*
+Drops the bodies that lived in evicted segments, and the URLs that pointed
+to them, by reinserting what is left into cleared tables. Called with the
+write lock held.
+*/
+static void rebuild(pagecache* cache)
+{
+	pagecache_header* hdr = cache->hdr;
+	pagecache_blob* blobs = malloc(sizeof(pagecache_blob) * hdr->nslots);
+	pagecache_url* urls = malloc(sizeof(pagecache_url) * hdr->nslots);
+	uint64_t nblobs = 0;
+	uint64_t nurls = 0;
+	uint64_t i;
+
+	for (i = 0; i < hdr->nslots; i++) {
+		if (!fp_empty(&cache->blobs[i].body) && hdr->segments[cache->blobs[i].segment].live) {
+			blobs[nblobs++] = cache->blobs[i];
+		}
+	}
+	memset(cache->blobs, 0, sizeof(pagecache_blob) * hdr->nslots);
+	for (i = 0; i < nblobs; i++) {
+		*blob_slot(cache, &blobs[i].body) = blobs[i];
+	}
+	for (i = 0; i < hdr->nslots; i++) {
+		if (!fp_empty(&cache->urls[i].url) && !fp_empty(&blob_slot(cache, &cache->urls[i].body)->body)) {
+			urls[nurls++] = cache->urls[i];
+		}
+	}
+	memset(cache->urls, 0, sizeof(pagecache_url) * hdr->nslots);
+	for (i = 0; i < nurls; i++) {
+		*url_slot(cache, &urls[i].url) = urls[i];
+	}
+	hdr->nblobs = nblobs;
+	hdr->nurls = nurls;
+	free(blobs);
+	free(urls);
+}
+
+/*
+Deletes the least recently used segment. Called with the write lock held.
+
+@return:
+int, 0 on success, -1 if there are no segments left
+*/
+static int evict_lru(pagecache* cache)
+{
+	pagecache_header* hdr = cache->hdr;
+	char path[4096];
+	uint64_t s;
+	uint64_t lru = NO_SEGMENT;
+
+	for (s = 0; s < PAGECACHE_MAX_SEGMENTS; s++) {
+		if (hdr->segments[s].live && (lru == NO_SEGMENT || hdr->segments[s].last_used < hdr->segments[lru].last_used)) {
+			lru = s;
+		}
+	}
+	if (lru == NO_SEGMENT) {
+		return -1;
+	}
+	if (cache->fds[lru] >= 0) {
+		close(cache->fds[lru]);
+		cache->fds[lru] = -1;
+	}
+	segment_path(cache, hdr->segments[lru].id, path, sizeof(path));
+	unlink(path);
+	hdr->bytes -= hdr->segments[lru].bytes;
+	hdr->segments[lru].live = 0;
+	if (hdr->current == lru) {
+		hdr->current = NO_SEGMENT;
+	}
+	cache->stats.evictions++;
+	rebuild(cache);
+	return 0;
+}
+
+/*
+Evicts until length more bytes, one more body and one more URL fit.
+
+@return:
+int, 0 on success, -1 if they cannot fit even in an empty cache
+*/
+static int make_room(pagecache* cache, long length)
+{
+	pagecache_header* hdr = cache->hdr;
+	while (hdr->bytes + length > hdr->max_bytes || 2 * (hdr->nblobs + 1) > hdr->nslots ||
+	       2 * (hdr->nurls + 1) > hdr->nslots) {
+		if (evict_lru(cache) < 0) {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/*
+Starts a new segment and makes it the one bodies are appended to.
+
+@return:
+int, 0 on success, -1 if the segment file cannot be created
+*/
+static int new_segment(pagecache* cache)
+{
+	pagecache_header* hdr = cache->hdr;
+	char path[4096];
+	uint64_t s;
+	int fd;
+
+	for (s = 0; s < PAGECACHE_MAX_SEGMENTS && hdr->segments[s].live; s++)
+		;
+	if (s == PAGECACHE_MAX_SEGMENTS) {
+		evict_lru(cache);
+		for (s = 0; hdr->segments[s].live; s++)
+			;
+	}
+	segment_path(cache, hdr->next_id, path, sizeof(path));
+	fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		perror("pagecache: segment");
+		return -1;
+	}
+	cache->fds[s] = fd;
+	hdr->segments[s].id = hdr->next_id++;
+	hdr->segments[s].bytes = 0;
+	hdr->segments[s].live = 1;
+	hdr->current = s;
+	touch(cache, s);
+	return 0;
+}
+
+/*
+Appends a body that is not in the cache yet. Called with the write lock
+held.
+
+@return:
+int, 0 on success, -1 if it was not stored
+*/
+static int store_body(pagecache* cache, dedup_fp* body, char* page, long length)
+{
+	pagecache_header* hdr = cache->hdr;
+	pagecache_segment* seg;
+	pagecache_blob* blob;
+	int fd;
+
+	if (length > (long)hdr->segment_bytes || make_room(cache, length) < 0) {
+		return -1;
+	}
+	if (hdr->current == NO_SEGMENT || hdr->segments[hdr->current].bytes + length > hdr->segment_bytes) {
+		if (new_segment(cache) < 0) {
+			return -1;
+		}
+	}
+	seg = &hdr->segments[hdr->current];
+	fd = segment_fd(cache, hdr->current);
+	if (fd < 0 || pwrite(fd, page, length, seg->bytes) != length) {
+		return -1;
+	}
+	blob = blob_slot(cache, body);
+	blob->body = *body;
+	blob->segment = hdr->current;
+	blob->offset = seg->bytes;
+	blob->length = length;
+	seg->bytes += length;
+	hdr->bytes += length;
+	hdr->nblobs++;
+	return 0;
+}
+
+/*
+Opens the cache in dir, creating it if needed, and trims it to max_bytes.
+The index is sized for max_bytes of 2KB pages when it is created and keeps
+that size; segments are an eighth of max_bytes.
+
+@return:
+int, 0 on success, -1 on failure
+*/
+int pagecache_open(pagecache* cache, char* dir, long max_bytes)
+{
+	char path[4096];
+	pagecache_header hdr;
+	uint64_t nslots = 1024;
+	ssize_t n;
+	int i;
+
+	if (mkdir(dir, 0755) < 0 && errno != EEXIST) {
+		perror("pagecache: mkdir");
+		return -1;
+	}
+	snprintf(path, sizeof(path), "%s/index", dir);
+	cache->index_fd = open(path, O_RDWR | O_CREAT, 0644);
+	if (cache->index_fd < 0) {
+		perror("pagecache: index");
+		return -1;
+	}
+	if (flock(cache->index_fd, LOCK_EX | LOCK_NB) < 0) {
+		fprintf(stderr, "pagecache: %s is in use\n", dir);
+		close(cache->index_fd);
+		return -1;
+	}
+	n = pread(cache->index_fd, &hdr, sizeof(hdr), 0);
+	if (n == 0) {
+		while (nslots < (uint64_t)max_bytes / 1024) {
+			nslots *= 2;
+		}
+		memset(&hdr, 0, sizeof(hdr));
+		hdr.magic = PAGECACHE_MAGIC;
+		hdr.version = PAGECACHE_VERSION;
+		hdr.nslots = nslots;
+		hdr.current = NO_SEGMENT;
+		cache->map_size = sizeof(hdr) + nslots * (sizeof(pagecache_url) + sizeof(pagecache_blob));
+		if (ftruncate(cache->index_fd, cache->map_size) < 0 ||
+		    pwrite(cache->index_fd, &hdr, sizeof(hdr), 0) != sizeof(hdr)) {
+			perror("pagecache: create index");
+			close(cache->index_fd);
+			return -1;
+		}
+	}
+	else if (n != sizeof(hdr) || hdr.magic != PAGECACHE_MAGIC || hdr.version != PAGECACHE_VERSION) {
+		fprintf(stderr, "pagecache: %s is not a page cache\n", path);
+		close(cache->index_fd);
+		return -1;
+	}
+	cache->map_size = sizeof(hdr) + hdr.nslots * (sizeof(pagecache_url) + sizeof(pagecache_blob));
+	cache->hdr = mmap(NULL, cache->map_size, PROT_READ | PROT_WRITE, MAP_SHARED, cache->index_fd, 0);
+	if (cache->hdr == MAP_FAILED) {
+		perror("pagecache: mmap index");
+		close(cache->index_fd);
+		return -1;
+	}
+	cache->urls = (pagecache_url*)(cache->hdr + 1);
+	cache->blobs = (pagecache_blob*)(cache->urls + hdr.nslots);
+	cache->dir = strdup(dir);
+	for (i = 0; i < PAGECACHE_MAX_SEGMENTS; i++) {
+		cache->fds[i] = -1;
+	}
+	pthread_rwlock_init(&cache->lock, NULL);
+	memset(&cache->stats, 0, sizeof(cache->stats));
+
+	cache->hdr->max_bytes = max_bytes;
+	cache->hdr->segment_bytes = max_bytes / 8 > PAGECACHE_MIN_SEGMENT_BYTES ? max_bytes / 8 : PAGECACHE_MIN_SEGMENT_BYTES;
+	make_room(cache, 0);
+	return 0;
+}
+
+/*
+Looks url up.
+
+@return:
+char*, a malloc'd, NUL terminated copy of the cached body, or NULL on a miss
+*/
+char* pagecache_get(pagecache* cache, char* url)
+{
+	dedup_fp key;
+	dedup_fp check = { 0, 0 };
+	pagecache_url* entry;
+	pagecache_blob* blob;
+	char* page = NULL;
+
+	dedup_hash(url, strlen(url), &key);
+	pthread_rwlock_rdlock(&cache->lock);
+	entry = url_slot(cache, &key);
+	blob = fp_empty(&entry->url) ? NULL : blob_slot(cache, &entry->body);
+	if (blob != NULL && !fp_empty(&blob->body)) {
+		int fd = segment_fd(cache, blob->segment);
+		page = malloc(blob->length + 1);
+		if (fd >= 0 && pread(fd, page, blob->length, blob->offset) == (ssize_t)blob->length) {
+			page[blob->length] = '\0';
+			dedup_hash(page, blob->length, &check);
+		}
+		if (fd < 0 || !fp_equal(&check, &blob->body)) {
+			free(page);
+			page = NULL;
+		}
+		else {
+			touch(cache, blob->segment);
+		}
+	}
+	pthread_rwlock_unlock(&cache->lock);
+	__atomic_add_fetch(page != NULL ? &cache->stats.hits : &cache->stats.misses, 1, __ATOMIC_RELAXED);
+	return page;
+}
+
+/*
+Stores length bytes of page as the body of url. A body the cache already
+holds, under any URL, is not written again. Pages bigger than a segment
+are not cached.
+*/
+void pagecache_put(pagecache* cache, char* url, char* page, long length)
+{
+	dedup_fp key;
+	dedup_fp body;
+	pagecache_url* entry;
+	pagecache_blob* blob;
+
+	dedup_hash(url, strlen(url), &key);
+	dedup_hash(page, length, &body);
+	pthread_rwlock_wrlock(&cache->lock);
+	if (!fp_empty(&blob_slot(cache, &body)->body)) {
+		cache->stats.shared++;
+	}
+	else if (store_body(cache, &body, page, length) < 0) {
+		pthread_rwlock_unlock(&cache->lock);
+		return;
+	}
+	/* Only now: storing may have evicted, which moves entries around. */
+	entry = url_slot(cache, &key);
+	if (fp_empty(&entry->url)) {
+		if (2 * (cache->hdr->nurls + 1) > cache->hdr->nslots) {
+			pthread_rwlock_unlock(&cache->lock);
+			return;
+		}
+		cache->hdr->nurls++;
+		entry->url = key;
+	}
+	entry->body = body;
+	blob = blob_slot(cache, &body);
+	touch(cache, blob->segment);
+	cache->stats.stores++;
+	pthread_rwlock_unlock(&cache->lock);
+}
+
+void pagecache_get_stats(pagecache* cache, pagecache_stats* out)
+{
+	pthread_rwlock_rdlock(&cache->lock);
+	*out = cache->stats;
+	out->bytes = cache->hdr->bytes;
+	pthread_rwlock_unlock(&cache->lock);
+}
+
+/*
+Writes the index back and closes everything, which also lets another
+process open the cache.
+*/
+void pagecache_close(pagecache* cache)
+{
+	int i;
+	msync(cache->hdr, cache->map_size, MS_SYNC);
+	munmap(cache->hdr, cache->map_size);
+	for (i = 0; i < PAGECACHE_MAX_SEGMENTS; i++) {
+		if (cache->fds[i] >= 0) {
+			close(cache->fds[i]);
+		}
+	}
+	close(cache->index_fd);
+	free(cache->dir);
+	pthread_rwlock_destroy(&cache->lock);
+}
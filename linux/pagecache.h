@@ -0,0 +1,105 @@
+#ifndef __PAGECACHE_H
+#define __PAGECACHE_H
+
+#include <stdint.h>
+#include <pthread.h>
+#include "dedup.h"
+
+/*
+An on-disk page cache for fetchers, so repeated crawls of the same pages
+read them from local disk instead of the network. Kept in one directory:
+
+  index      mmap'd header and two open addressing tables
+  seg.<id>   append-only segment files holding page bodies
+
+Bodies are content addressed: the blob table maps a body's fingerprint
+(see dedup.h) to where it sits in a segment, so pages with the same body
+are stored once. The URL table maps the fingerprint of a URL to the
+fingerprint of its body. A body is appended to the newest segment, which
+is sealed once it reaches segment_bytes, and is never rewritten.
+
+Space is reclaimed a segment at a time. Every lookup and store stamps its
+segment with a logical clock; when the segments would grow past max_bytes,
+or a table past half full, the least recently used segment is deleted with
+all its bodies and the URLs that point to them. Hits check the body against
+its fingerprint, so a damaged segment reads as a miss.
+
+One process at a time: the index is flock'd when opened. Within it, any
+number of threads may use the cache.
+*/
+#define PAGECACHE_MAGIC 0x5041474543414331ULL
+#define PAGECACHE_VERSION 1
+#define PAGECACHE_MAX_SEGMENTS 64
+#define PAGECACHE_MIN_SEGMENT_BYTES (1L << 20)
+
+typedef struct pagecache_segment pagecache_segment;
+typedef struct pagecache_header pagecache_header;
+typedef struct pagecache_url pagecache_url;
+typedef struct pagecache_blob pagecache_blob;
+typedef struct pagecache pagecache;
+typedef struct pagecache_stats pagecache_stats;
+
+/* A segment slot; live is 0 for a free slot. */
+struct pagecache_segment {
+	uint64_t id;
+	uint64_t bytes;
+	uint64_t last_used;
+	uint64_t live;
+};
+
+struct pagecache_header {
+	uint64_t magic;
+	uint64_t version;
+	uint64_t nslots;
+	uint64_t max_bytes;
+	uint64_t segment_bytes;
+	uint64_t clock;
+	uint64_t next_id;
+	uint64_t current;
+	uint64_t nurls;
+	uint64_t nblobs;
+	uint64_t bytes;
+	pagecache_segment segments[PAGECACHE_MAX_SEGMENTS];
+};
+
+/* Empty when url is all zero, which dedup_hash never returns. */
+struct pagecache_url {
+	dedup_fp url;
+	dedup_fp body;
+};
+
+struct pagecache_blob {
+	dedup_fp body;
+	uint64_t segment;
+	uint64_t offset;
+	uint64_t length;
+};
+
+struct pagecache_stats {
+	unsigned long hits;
+	unsigned long misses;
+	unsigned long stores;
+	unsigned long shared;
+	unsigned long evictions;
+	unsigned long bytes;
+};
+
+struct pagecache {
+	char* dir;
+	int index_fd;
+	size_t map_size;
+	pagecache_header* hdr;
+	pagecache_url* urls;
+	pagecache_blob* blobs;
+	int fds[PAGECACHE_MAX_SEGMENTS];
+	pthread_rwlock_t lock;
+	pagecache_stats stats;
+};
+
+int pagecache_open(pagecache* cache, char* dir, long max_bytes);
+char* pagecache_get(pagecache* cache, char* url);
+void pagecache_put(pagecache* cache, char* url, char* page, long length);
+void pagecache_get_stats(pagecache* cache, pagecache_stats* out);
+void pagecache_close(pagecache* cache);
+
+#endif
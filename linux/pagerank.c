@@ -0,0 +1,366 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include "graph.h"
+#include "hashtable.h"
+
+/*
+PageRank over a crawled graph. Reads either a graph file (see
+crawl_set_graph) or the "from -> to" text edges the testers print ("-" for
+stdin), builds the transposed graph in memory as CSR, and iterates
+
+  rank'[v] = (1 - d) / n + d * (dangling / n + sum of rank[u] / out[u]
+             over the pages u linking to v)
+
+where dangling is the rank held by pages without links, until the L1
+change in ranks drops below the tolerance. Each iteration pulls: every
+thread owns a contiguous range of pages, balanced by in-links, and only
+writes the ranks in its range, so there are no atomics and no false
+sharing except at range edges. Threads meet at a barrier twice an
+iteration. Prints the top pages, and timings to stderr.
+*/
+
+typedef struct pagerank_part pagerank_part;
+
+/* A thread's range of pages and its partial sums, two of each by iteration parity. */
+struct pagerank_part {
+  pthread_t thread;
+  uint32_t begin, end;
+  double dangling[2];
+  double delta[2];
+} __attribute__((aligned(64)));
+
+uint32_t nnodes = 0;
+uint64_t nedges = 0;
+char **urls;
+uint32_t *out_degree;
+uint64_t *in_offsets;
+uint32_t *in_sources;
+
+double damping = 0.85;
+double tolerance = 1e-6;
+int max_iterations = 100;
+int nthreads = 0;
+
+double *rank, *next_rank, *contrib;
+pagerank_part *parts;
+pthread_barrier_t barrier;
+int iterations = 0;
+double final_delta = 0;
+
+void usage(char *prog) {
+  fprintf(stderr, "usage: %s [-t threads] [-d damping] [-e tolerance] [-i max_iterations] [-k top] "
+	  "graph_file|edges_file|-\n", prog);
+  exit(1);
+}
+
+double now() {
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+/* URL interning for text input: open addressing, at most half full. */
+typedef struct {
+  char *url;
+  unsigned long hash;
+  uint32_t id;
+} name;
+
+name *names;
+unsigned long names_mask = 1023;
+uint32_t urls_size = 1024;
+
+uint32_t intern(char *url) {
+  unsigned long h = hash(url);
+  unsigned long i;
+  if (2 * (nnodes + 1) > names_mask + 1) {
+    name *old = names;
+    unsigned long size = names_mask + 1;
+    names = calloc(size * 2, sizeof(name));
+    names_mask = size * 2 - 1;
+    for (i = 0; i < size; i++) {
+      if (old[i].url != NULL) {
+	unsigned long j = old[i].hash & names_mask;
+	while (names[j].url != NULL)
+	  j = (j + 1) & names_mask;
+	names[j] = old[i];
+      }
+    }
+    free(old);
+  }
+  for (i = h & names_mask; names[i].url != NULL; i = (i + 1) & names_mask) {
+    if (names[i].hash == h && strcmp(names[i].url, url) == 0)
+      return names[i].id;
+  }
+  if (nnodes == urls_size) {
+    urls_size *= 2;
+    urls = realloc(urls, sizeof(char *) * urls_size);
+  }
+  names[i].url = urls[nnodes] = strdup(url);
+  names[i].hash = h;
+  names[i].id = nnodes;
+  return nnodes++;
+}
+
+int compare_pairs(const void *a, const void *b) {
+  const uint32_t *x = a, *y = b;
+  if (x[0] != y[0])
+    return x[0] < y[0] ? -1 : 1;
+  return x[1] < y[1] ? -1 : x[1] > y[1];
+}
+
+/*
+Reads text edges into (from, to) pairs, sorted and without duplicates.
+*/
+uint32_t *read_text(FILE *file) {
+  uint32_t *pairs = NULL;
+  uint64_t size = 0, n = 0, i;
+  char *line = NULL;
+  size_t cap = 0;
+  ssize_t len;
+
+  names = calloc(names_mask + 1, sizeof(name));
+  urls = malloc(sizeof(char *) * urls_size);
+  while ((len = getline(&line, &cap, file)) > 0) {
+    char *arrow = strstr(line, " -> ");
+    if (arrow == NULL)
+      continue;
+    if (line[len - 1] == '\n')
+      line[len - 1] = '\0';
+    *arrow = '\0';
+    if (n == size) {
+      size = size > 0 ? size * 2 : 4096;
+      pairs = realloc(pairs, sizeof(uint32_t) * 2 * size);
+    }
+    pairs[2 * n] = intern(line);
+    pairs[2 * n + 1] = intern(arrow + 4);
+    n++;
+  }
+  free(line);
+  qsort(pairs, n, 2 * sizeof(uint32_t), compare_pairs);
+  nedges = 0;
+  for (i = 0; i < n; i++) {
+    if (nedges == 0 || compare_pairs(&pairs[2 * i], &pairs[2 * (nedges - 1)]) != 0) {
+      pairs[2 * nedges] = pairs[2 * i];
+      pairs[2 * nedges + 1] = pairs[2 * i + 1];
+      nedges++;
+    }
+  }
+  return pairs;
+}
+
+/*
+Decodes a graph file into (from, to) pairs, which come out sorted and
+without duplicates already.
+*/
+uint32_t *read_graph(graph *g) {
+  uint32_t *out = malloc(sizeof(uint32_t) * (g->hdr->max_degree > 0 ? g->hdr->max_degree : 1));
+  uint32_t *pairs = malloc(sizeof(uint32_t) * 2 * (g->hdr->nedges > 0 ? g->hdr->nedges : 1));
+  uint32_t u;
+  int i, n;
+
+  nnodes = g->hdr->nnodes;
+  urls = malloc(sizeof(char *) * (nnodes > 0 ? nnodes : 1));
+  nedges = 0;
+  for (u = 0; u < nnodes; u++) {
+    urls[u] = graph_url(g, u);
+    n = graph_neighbors(g, u, out);
+    for (i = 0; i < n; i++) {
+      pairs[2 * nedges] = u;
+      pairs[2 * nedges + 1] = out[i];
+      nedges++;
+    }
+  }
+  free(out);
+  return pairs;
+}
+
+/*
+Builds the out-degrees and the in-link CSR from pairs, and splits the pages
+into nthreads ranges of about the same number of in-links plus pages.
+*/
+void build(uint32_t *pairs) {
+  uint64_t i, per, acc;
+  uint32_t v;
+  int t;
+
+  out_degree = calloc(nnodes, sizeof(uint32_t));
+  in_offsets = calloc(nnodes + 1, sizeof(uint64_t));
+  in_sources = malloc(sizeof(uint32_t) * (nedges > 0 ? nedges : 1));
+  for (i = 0; i < nedges; i++) {
+    out_degree[pairs[2 * i]]++;
+    in_offsets[pairs[2 * i + 1] + 1]++;
+  }
+  for (v = 0; v < nnodes; v++)
+    in_offsets[v + 1] += in_offsets[v];
+  for (i = 0; i < nedges; i++)
+    in_sources[in_offsets[pairs[2 * i + 1]]++] = pairs[2 * i];
+  for (v = nnodes; v > 0; v--)
+    in_offsets[v] = in_offsets[v - 1];
+  in_offsets[0] = 0;
+
+  parts = aligned_alloc(64, sizeof(pagerank_part) * nthreads);
+  memset(parts, 0, sizeof(pagerank_part) * nthreads);
+  per = (nedges + nnodes) / nthreads + 1;
+  v = 0;
+  for (t = 0; t < nthreads; t++) {
+    parts[t].begin = v;
+    acc = 0;
+    while (v < nnodes && (acc < per || t == nthreads - 1)) {
+      acc += in_offsets[v + 1] - in_offsets[v] + 1;
+      v++;
+    }
+    parts[t].end = v;
+  }
+}
+
+void *worker(void *arg) {
+  pagerank_part *part = arg;
+  double *cur = rank, *nxt = next_rank;
+  double base, dangling, delta = 0;
+  uint64_t e;
+  uint32_t v;
+  int it, t;
+
+  /* First touch: each thread's ranges live near it. */
+  for (v = part->begin; v < part->end; v++) {
+    cur[v] = 1.0 / nnodes;
+    nxt[v] = 0;
+    contrib[v] = 0;
+  }
+  pthread_barrier_wait(&barrier);
+  for (it = 0; it < max_iterations; it++) {
+    int p = it & 1;
+    dangling = 0;
+    for (v = part->begin; v < part->end; v++) {
+      if (out_degree[v] > 0)
+	contrib[v] = cur[v] / out_degree[v];
+      else
+	dangling += cur[v];
+    }
+    part->dangling[p] = dangling;
+    pthread_barrier_wait(&barrier);
+
+    dangling = 0;
+    for (t = 0; t < nthreads; t++)
+      dangling += parts[t].dangling[p];
+    base = (1.0 - damping) / nnodes + damping * dangling / nnodes;
+    delta = 0;
+    for (v = part->begin; v < part->end; v++) {
+      double sum = 0;
+      for (e = in_offsets[v]; e < in_offsets[v + 1]; e++)
+	sum += contrib[in_sources[e]];
+      nxt[v] = base + damping * sum;
+      delta += nxt[v] > cur[v] ? nxt[v] - cur[v] : cur[v] - nxt[v];
+    }
+    part->delta[p] = delta;
+    pthread_barrier_wait(&barrier);
+
+    delta = 0;
+    for (t = 0; t < nthreads; t++)
+      delta += parts[t].delta[p];
+    double *tmp = cur;
+    cur = nxt;
+    nxt = tmp;
+    if (delta < tolerance)
+      break;
+  }
+  if (part == &parts[0]) {
+    iterations = it < max_iterations ? it + 1 : max_iterations;
+    final_delta = delta;
+    rank = cur;
+  }
+  return NULL;
+}
+
+int by_rank(const void *a, const void *b) {
+  double x = rank[*(const uint32_t *)a], y = rank[*(const uint32_t *)b];
+  return x > y ? -1 : x < y;
+}
+
+int main(int argc, char *argv[]) {
+  uint64_t magic = 0;
+  uint32_t *pairs, *order;
+  uint32_t v;
+  FILE *file;
+  graph g;
+  int is_graph = 0;
+  int top = 20;
+  int c, t;
+  double t0, t1, t2, t3;
+
+  while ((c = getopt(argc, argv, "t:d:e:i:k:")) != -1) {
+    switch (c) {
+    case 't': nthreads = atoi(optarg); break;
+    case 'd': damping = atof(optarg); break;
+    case 'e': tolerance = atof(optarg); break;
+    case 'i': max_iterations = atoi(optarg); break;
+    case 'k': top = atoi(optarg); break;
+    default: usage(argv[0]);
+    }
+  }
+  if (optind != argc - 1 || damping <= 0 || damping >= 1 || max_iterations < 1)
+    usage(argv[0]);
+  if (nthreads < 1)
+    nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+
+  t0 = now();
+  file = strcmp(argv[optind], "-") == 0 ? stdin : fopen(argv[optind], "r");
+  if (file == NULL) {
+    perror(argv[optind]);
+    return 1;
+  }
+  if (file != stdin) {
+    is_graph = fread(&magic, sizeof(magic), 1, file) == 1 && magic == GRAPH_MAGIC;
+    rewind(file);
+  }
+  if (is_graph) {
+    fclose(file);
+    if (graph_open(&g, argv[optind]) < 0)
+      return 1;
+    pairs = read_graph(&g);
+  }
+  else {
+    pairs = read_text(file);
+    if (file != stdin)
+      fclose(file);
+  }
+  if (nnodes == 0) {
+    fprintf(stderr, "no edges in %s\n", argv[optind]);
+    return 1;
+  }
+  if ((uint32_t)nthreads > nnodes)
+    nthreads = nnodes;
+  t1 = now();
+  build(pairs);
+  free(pairs);
+  t2 = now();
+
+  rank = malloc(sizeof(double) * nnodes);
+  next_rank = malloc(sizeof(double) * nnodes);
+  contrib = malloc(sizeof(double) * nnodes);
+  pthread_barrier_init(&barrier, NULL, nthreads);
+  for (t = 1; t < nthreads; t++)
+    pthread_create(&parts[t].thread, NULL, worker, &parts[t]);
+  worker(&parts[0]);
+  for (t = 1; t < nthreads; t++)
+    pthread_join(parts[t].thread, NULL);
+  t3 = now();
+
+  fprintf(stderr, "%u pages, %lu links; read %.3fs, built %.3fs; %d iterations on %d threads in %.3fs "
+	  "(%.1f iterations/s, %.0f links/s), last change %.3g\n",
+	  nnodes, (unsigned long)nedges, t1 - t0, t2 - t1, iterations, nthreads, t3 - t2,
+	  iterations / (t3 - t2), iterations * (double)nedges / (t3 - t2), final_delta);
+  order = malloc(sizeof(uint32_t) * nnodes);
+  for (v = 0; v < nnodes; v++)
+    order[v] = v;
+  qsort(order, nnodes, sizeof(uint32_t), by_rank);
+  for (v = 0; v < nnodes && (top == 0 || v < (uint32_t)top); v++)
+    printf("%.8f %s\n", rank[order[v]], urls[order[v]]);
+  return 0;
+}
@@ -0,0 +1,215 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "recrawl.h"
+#include "hashtable.h"
+
+static void put_string(FILE* file, char* str)
+{
+	uint32_t n = str != NULL ? strlen(str) : 0;
+	fwrite(&n, sizeof(n), 1, file);
+	fwrite(str, 1, n, file);
+}
+
+/*
+Reads one length prefixed string into a fresh buffer.
+
+@return:
+char*, the string, or NULL at end of file or on a short read
+*/
+static char* get_string(FILE* file)
+{
+	uint32_t n;
+	char* str;
+	if (fread(&n, sizeof(n), 1, file) != 1) {
+		return NULL;
+	}
+	str = malloc(n + 1);
+	if (fread(str, 1, n, file) != n) {
+		free(str);
+		return NULL;
+	}
+	str[n] = '\0';
+	return str;
+}
+
+static void free_record(recrawl_record* rec)
+{
+	uint32_t i;
+
+	if (rec->links != NULL) {
+		for (i = 0; i < rec->nlinks; i++) {
+			free(rec->links[i]);
+		}
+		free(rec->links);
+	}
+	free(rec->url);
+	free(rec->etag);
+	free(rec->last_modified);
+	free(rec);
+}
+
+/*
+Reads one record.
+
+@return:
+recrawl_record*, the record, or NULL if the file ends inside it
+*/
+static recrawl_record* get_record(FILE* file)
+{
+	recrawl_record* rec = calloc(1, sizeof(recrawl_record));
+	uint32_t i;
+
+	if ((rec->url = get_string(file)) == NULL || (rec->etag = get_string(file)) == NULL ||
+	    (rec->last_modified = get_string(file)) == NULL ||
+	    fread(&rec->fp, sizeof(rec->fp), 1, file) != 1 ||
+	    fread(&rec->nlinks, sizeof(rec->nlinks), 1, file) != 1) {
+		free_record(rec);
+		return NULL;
+	}
+	rec->links = malloc(sizeof(char*) * (rec->nlinks ? rec->nlinks : 1));
+	for (i = 0; i < rec->nlinks; i++) {
+		if ((rec->links[i] = get_string(file)) == NULL) {
+			rec->nlinks = i;
+			free_record(rec);
+			return NULL;
+		}
+	}
+	return rec;
+}
+
+/*
+Loads the records in path, if there is a store there, and starts writing
+this crawl's to path.tmp. A missing store just means nothing is known
+about any URL yet.
+
+@return:
+int, 0 on success, -1 if path is not a store or path.tmp cannot be created
+*/
+int recrawl_open(recrawl_store* store, char* path)
+{
+	char tmp[4096];
+	recrawl_header hdr;
+	FILE* file;
+	uint64_t i;
+
+	store->path = strdup(path);
+	store->nrecords = 0;
+	store->written = 0;
+	store->size = 16;
+	pthread_mutex_init(&store->lock, NULL);
+	file = fopen(path, "r");
+	if (file == NULL && errno != ENOENT) {
+		perror("recrawl: open");
+		return -1;
+	}
+	if (file != NULL) {
+		if (fread(&hdr, sizeof(hdr), 1, file) != 1 || hdr.magic != RECRAWL_MAGIC ||
+		    hdr.version != RECRAWL_VERSION) {
+			fprintf(stderr, "recrawl: %s is not a recrawl store\n", path);
+			fclose(file);
+			return -1;
+		}
+		while (store->size < 2 * hdr.nrecords) {
+			store->size *= 2;
+		}
+	}
+	store->table = calloc(store->size, sizeof(recrawl_record*));
+	if (file != NULL) {
+		for (i = 0; i < hdr.nrecords; i++) {
+			recrawl_record* rec = get_record(file);
+			unsigned long key;
+			if (rec == NULL) {
+				fprintf(stderr, "recrawl: %s is truncated\n", path);
+				break;
+			}
+			key = hash(rec->url) % store->size;
+			rec->next = store->table[key];
+			store->table[key] = rec;
+			store->nrecords++;
+		}
+		fclose(file);
+	}
+
+	snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+	store->out = fopen(tmp, "w");
+	if (store->out == NULL) {
+		perror("recrawl: create");
+		return -1;
+	}
+	memset(&hdr, 0, sizeof(hdr));
+	fwrite(&hdr, sizeof(hdr), 1, store->out);
+	return 0;
+}
+
+/*
+Looks url up among the previous crawl's records. No lock needed: they are
+never changed once loaded.
+
+@return:
+recrawl_record*, the record, or NULL if url was not fetched last time
+*/
+recrawl_record* recrawl_find(recrawl_store* store, char* url)
+{
+	recrawl_record* rec = store->table[hash(url) % store->size];
+	while (rec != NULL && strcmp(rec->url, url) != 0) {
+		rec = rec->next;
+	}
+	return rec;
+}
+
+/*
+Records what this crawl learned about url. Safe to call from any thread.
+*/
+void recrawl_put(recrawl_store* store, char* url, char* etag, char* last_modified,
+		 dedup_fp* fp, char** links, uint32_t nlinks)
+{
+	uint32_t i;
+	pthread_mutex_lock(&store->lock);
+	put_string(store->out, url);
+	put_string(store->out, etag);
+	put_string(store->out, last_modified);
+	fwrite(fp, sizeof(*fp), 1, store->out);
+	fwrite(&nlinks, sizeof(nlinks), 1, store->out);
+	for (i = 0; i < nlinks; i++) {
+		put_string(store->out, links[i]);
+	}
+	store->written++;
+	pthread_mutex_unlock(&store->lock);
+}
+
+/*
+Finishes this crawl's store and makes it the one the next crawl loads:
+the record count goes into the header, then the file is fsync'd and
+renamed over path.
+
+@return:
+int, 0 on success, -1 on failure (the previous store is left in place)
+*/
+int recrawl_commit(recrawl_store* store)
+{
+	char tmp[4096];
+	recrawl_header hdr;
+	int failed;
+
+	snprintf(tmp, sizeof(tmp), "%s.tmp", store->path);
+	pthread_mutex_lock(&store->lock);
+	hdr.magic = RECRAWL_MAGIC;
+	hdr.version = RECRAWL_VERSION;
+	hdr.nrecords = store->written;
+	failed = fseek(store->out, 0, SEEK_SET) < 0 || fwrite(&hdr, sizeof(hdr), 1, store->out) != 1;
+	failed = fflush(store->out) != 0 || ferror(store->out) || failed;
+	failed = fsync(fileno(store->out)) < 0 || failed;
+	if (fclose(store->out) != 0 || failed || rename(tmp, store->path) < 0) {
+		perror("recrawl: write");
+		unlink(tmp);
+		failed = 1;
+	}
+	store->out = NULL;
+	pthread_mutex_unlock(&store->lock);
+	return failed ? -1 : 0;
+}
@@ -0,0 +1,67 @@
+#ifndef __RECRAWL_H
+#define __RECRAWL_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "dedup.h"
+
+/*
+Per-URL state carried from one crawl to the next, so a recrawl can ask
+servers whether a page changed and, if it did not, reuse its links instead
+of parsing it again. A store is one file: a header, then one record per
+page:
+
+  url, etag, last_modified  length prefixed strings ("" when absent)
+  fingerprint               the dedup_fp of the body
+  links                     uint32 count, then that many strings
+
+Every link token on the page is kept, seen before or not, so reusing them
+replays exactly what parsing would have found. Strings are stored as in
+checkpoint.h.
+
+The previous crawl's records are loaded into a hash table when the store
+is opened and are only read after that. This crawl's records stream to
+path.tmp as pages finish, and recrawl_commit renames that over path, so a
+crawl that does not finish leaves the previous store alone.
+*/
+#define RECRAWL_MAGIC 0x52435241574c5331ULL
+#define RECRAWL_VERSION 1
+
+typedef struct recrawl_header recrawl_header;
+typedef struct recrawl_record recrawl_record;
+typedef struct recrawl_store recrawl_store;
+
+struct recrawl_header {
+	uint64_t magic;
+	uint64_t version;
+	uint64_t nrecords;
+};
+
+struct recrawl_record {
+	recrawl_record* next;
+	char* url;
+	char* etag;
+	char* last_modified;
+	dedup_fp fp;
+	uint32_t nlinks;
+	char** links;
+};
+
+struct recrawl_store {
+	recrawl_record** table;
+	unsigned long size;
+	unsigned long nrecords;
+	char* path;
+	FILE* out;
+	uint64_t written;
+	pthread_mutex_t lock;
+};
+
+int recrawl_open(recrawl_store* store, char* path);
+recrawl_record* recrawl_find(recrawl_store* store, char* url);
+void recrawl_put(recrawl_store* store, char* url, char* etag, char* last_modified,
+		 dedup_fp* fp, char** links, uint32_t nlinks);
+int recrawl_commit(recrawl_store* store);
+
+#endif
@@ -0,0 +1,139 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <fcntl.h>
+#include "crawler.h"
+#include "memfetch.h"
+
+/*
+Checkpoint and resume workload. Crawls an in-memory corpus of the given
+number of pages (see memfetch.h) with a single fused worker, so pages are
+fetched and their links found in the same order on every run. Every edge
+is printed to stdout as it is found and every page fetched is appended to
+fetch_log, both unbuffered, so they survive the process being killed.
+
+-s crawls with 2 downloaders and 2 parsers instead, so a checkpoint also
+holds pages waiting in the parse queue; the order is no longer fixed.
+
+-c checkpoints the crawl to dir every interval_ms (-i, default 20).
+
+-k kills the crawl with SIGKILL in the middle of its kill_at'th fetch, once
+a checkpoint begun since the fetch began has been written; one already
+under way may have taken its snapshot earlier. Other fetches started from
+then on never return, so every page logged was fetched before that
+checkpoint; the killed fetch is not logged, its page never reached the
+crawler.
+
+-r resumes the crawl checkpointed in dir (see crawl_resume). With -L, the
+URLs the checkpoint queues again, in flight and on the frontier, are
+written to requeued first, one per line.
+
+usage: resume_tester -m pages [-s] [-c dir] [-i interval_ms] [-k kill_at] [-r [-L requeued]] fetch_log
+*/
+
+int fetch_log;
+long fetches = 0;
+long kill_at = 0;
+int killing = 0;
+
+char *fetch(char *link) {
+  char *page;
+  if (__atomic_load_n(&killing, __ATOMIC_SEQ_CST))
+    while (1)
+      pause();
+  if (__atomic_add_fetch(&fetches, 1, __ATOMIC_SEQ_CST) == kill_at) {
+    checkpoint_stats before, now;
+    __atomic_store_n(&killing, 1, __ATOMIC_SEQ_CST);
+    crawl_checkpoint_stats(&before);
+    do {
+      usleep(1000);
+      crawl_checkpoint_stats(&now);
+    } while (now.checkpoints < before.checkpoints + 2);
+    raise(SIGKILL);
+  }
+  page = memfetch_fetch(link);
+  if (page != NULL)
+    dprintf(fetch_log, "%s\n", link);
+  return page;
+}
+
+void edge(char *from, char *to) {
+  printf("%s -> %s\n", from, to);
+}
+
+void write_requeued(char *dir, char *path) {
+  checkpoint_header hdr;
+  char **urls;
+  uint64_t i;
+  FILE *out = fopen(path, "w");
+  if (out == NULL) {
+    perror(path);
+    exit(1);
+  }
+  if (checkpoint_read(dir, &hdr, &urls) < 0)
+    exit(1);
+  for (i = 0; i < hdr.ninflight + hdr.nfrontier; i++) {
+    fprintf(out, "%s\n", urls[i]);
+    free(urls[i]);
+  }
+  free(urls);
+  fclose(out);
+  fprintf(stderr, "checkpoint: %lu in flight, %lu on the frontier\n",
+	  (unsigned long)hdr.ninflight, (unsigned long)hdr.nfrontier);
+}
+
+int main(int argc, char *argv[]) {
+  webgraph_params params;
+  memfetch_latency latency;
+  char *dir = NULL;
+  char *requeued = NULL;
+  int split = 0;
+  int interval_ms = 20;
+  int resume = 0;
+  int c, rc;
+
+  webgraph_defaults(&params);
+  params.pages = 0;
+  while ((c = getopt(argc, argv, "m:sc:i:k:rL:")) != -1) {
+    switch (c) {
+    case 'm': params.pages = atol(optarg); break;
+    case 'c': dir = optarg; break;
+    case 'i': interval_ms = atoi(optarg); break;
+    case 'k': kill_at = atol(optarg); break;
+    case 'r': resume = 1; break;
+    case 's': split = 1; break;
+    case 'L': requeued = optarg; break;
+    default:
+      fprintf(stderr, "usage: %s -m pages [-s] [-c dir] [-i interval_ms] [-k kill_at] [-r [-L requeued]] fetch_log\n", argv[0]);
+      return 1;
+    }
+  }
+  assert(params.pages > 0 && optind == argc - 1);
+  assert(dir != NULL || (kill_at == 0 && !resume));
+  assert(requeued == NULL || resume);
+  fetch_log = open(argv[optind], O_WRONLY | O_CREAT | O_APPEND, 0644);
+  if (fetch_log < 0) {
+    perror(argv[optind]);
+    return 1;
+  }
+  setvbuf(stdout, NULL, _IOLBF, 0);
+  memfetch_parse_latency("none", &latency);
+  if (memfetch_init(&params, &latency) < 0) {
+    fprintf(stderr, "cannot generate %ld pages\n", params.pages);
+    return 1;
+  }
+
+  crawl_set_mode(split ? CRAWL_SPLIT : CRAWL_FUSED);
+  if (dir != NULL)
+    crawl_set_checkpoint(dir, interval_ms);
+  if (requeued != NULL)
+    write_requeued(dir, requeued);
+  if (resume)
+    rc = crawl_resume(dir, split ? 2 : 1, split ? 2 : 0, 16, fetch, edge);
+  else
+    rc = crawl("p0", split ? 2 : 1, split ? 2 : 0, 16, fetch, edge);
+  return rc == 0 ? 0 : 1;
+}
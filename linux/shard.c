@@ -0,0 +1,168 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include "shard.h"
+
+static size_t map_size(int nshards)
+{
+	return sizeof(shard_map) + sizeof(shard_ring) * nshards * nshards;
+}
+
+/*
+Makes the shared segment for nshards shards. Its name is unlinked as soon
+as it is mapped: the mapping is inherited over fork, and nothing is left
+behind in /dev/shm however the crawl ends.
+
+@return:
+shard_map*, the zeroed map, or NULL on failure
+*/
+shard_map* shard_map_create(int nshards)
+{
+	char name[64];
+	size_t size = map_size(nshards);
+	shard_map* map;
+	int fd;
+
+	snprintf(name, sizeof(name), "/crawler-shards-%d", (int)getpid());
+	fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+	if (fd < 0) {
+		perror("shard: shm_open");
+		return NULL;
+	}
+	shm_unlink(name);
+	if (ftruncate(fd, size) < 0) {
+		perror("shard: ftruncate");
+		close(fd);
+		return NULL;
+	}
+	map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		perror("shard: mmap");
+		return NULL;
+	}
+	map->nshards = nshards;
+	return map;
+}
+
+void shard_map_free(shard_map* map)
+{
+	munmap(map, map_size(map->nshards));
+}
+
+/*
+FNV-1a with a final mix, so that shards do not line up with the buckets
+of their visited sets, which hash the same URLs another way.
+
+@return:
+int, the shard url belongs to
+*/
+int shard_of(char* url, int nshards)
+{
+	uint64_t h = 14695981039346656037ULL;
+	unsigned char* p;
+
+	for (p = (unsigned char*)url; *p != '\0'; p++) {
+		h = (h ^ *p) * 1099511628211ULL;
+	}
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	return h % nshards;
+}
+
+shard_ring* shard_ring_between(shard_map* map, int from, int to)
+{
+	return &map->rings[from * map->nshards + to];
+}
+
+static void ring_write(shard_ring* ring, uint64_t at, void* src, long n)
+{
+	long off = at % SHARD_RING_BYTES;
+	long first = n < SHARD_RING_BYTES - off ? n : SHARD_RING_BYTES - off;
+
+	memcpy(ring->data + off, src, first);
+	memcpy(ring->data, (char*)src + first, n - first);
+}
+
+static void ring_read(shard_ring* ring, uint64_t at, void* dst, long n)
+{
+	long off = at % SHARD_RING_BYTES;
+	long first = n < SHARD_RING_BYTES - off ? n : SHARD_RING_BYTES - off;
+
+	memcpy(dst, ring->data + off, first);
+	memcpy((char*)dst + first, ring->data, n - first);
+}
+
+/*
+Adds a link found on page from. Only the ring's producer may call this;
+from and link must be shorter than SHARD_MAX_URL.
+
+@return:
+int, 0 on success, -1 if the ring has no room for it yet
+*/
+int shard_ring_put(shard_ring* ring, char* from, char* link)
+{
+	uint32_t lengths[2] = { strlen(from), strlen(link) };
+	uint64_t tail = ring->tail;
+	uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+
+	if (SHARD_RING_BYTES - (tail - head) < sizeof(lengths) + lengths[0] + lengths[1]) {
+		return -1;
+	}
+	ring_write(ring, tail, lengths, sizeof(lengths));
+	ring_write(ring, tail + sizeof(lengths), from, lengths[0]);
+	ring_write(ring, tail + sizeof(lengths) + lengths[0], link, lengths[1]);
+	__atomic_store_n(&ring->tail, tail + sizeof(lengths) + lengths[0] + lengths[1], __ATOMIC_RELEASE);
+	return 0;
+}
+
+/*
+Takes the oldest link off the ring into from and link, SHARD_MAX_URL bytes
+each. Only the ring's consumer may call this.
+
+@return:
+int, 1 if a link was taken, 0 if the ring is empty
+*/
+int shard_ring_get(shard_ring* ring, char* from, char* link)
+{
+	uint32_t lengths[2];
+	uint64_t head = ring->head;
+	uint64_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+
+	if (head == tail) {
+		return 0;
+	}
+	ring_read(ring, head, lengths, sizeof(lengths));
+	ring_read(ring, head + sizeof(lengths), from, lengths[0]);
+	ring_read(ring, head + sizeof(lengths) + lengths[0], link, lengths[1]);
+	from[lengths[0]] = '\0';
+	link[lengths[1]] = '\0';
+	__atomic_store_n(&ring->head, head + sizeof(lengths) + lengths[0] + lengths[1], __ATOMIC_RELEASE);
+	return 1;
+}
+
+void shard_work_add(shard_map* map, long n)
+{
+	__atomic_add_fetch(&map->outstanding, n, __ATOMIC_SEQ_CST);
+}
+
+void shard_work_done(shard_map* map, long n)
+{
+	if (__atomic_sub_fetch(&map->outstanding, n, __ATOMIC_SEQ_CST) == 0) {
+		__atomic_store_n(&map->done, 1, __ATOMIC_RELEASE);
+	}
+}
+
+/*
+@return:
+int, 1 once the crawl is over in every shard, 0 otherwise
+*/
+int shard_all_done(shard_map* map)
+{
+	return __atomic_load_n(&map->done, __ATOMIC_ACQUIRE);
+}
@@ -0,0 +1,54 @@
+#ifndef __SHARD_H
+#define __SHARD_H
+
+#include <stdint.h>
+
+/*
+Shared memory for a sharded crawl (see crawl_set_shards): one segment,
+made with shm_open and mmap before the shard processes are forked, so
+every shard has it at the same address. Each URL belongs to shard
+shard_of(url), and only that shard keeps it in its visited set and
+frontier. Links a shard finds that belong to another go there through
+the ring between the two; there is one for every ordered pair of shards.
+
+A ring has one producer and one consumer, so head and tail are all the
+synchronization it needs: the producer copies a record in and then
+publishes the new tail, the consumer copies it out and then publishes
+the new head. Both only ever grow; their difference is the bytes in use.
+A record is two 32 bit lengths followed by the page the link was found on
+and the link, wrapping around the end of data.
+
+outstanding is what keeps every shard going: one for each shard that has
+pages not yet done, plus one for each link still in a ring. Whoever takes
+it to 0 sets done, and the crawl is over everywhere.
+*/
+#define SHARD_RING_BYTES (1 << 20)
+#define SHARD_MAX_URL 8192
+
+typedef struct shard_ring shard_ring;
+typedef struct shard_map shard_map;
+
+struct shard_ring {
+	uint64_t head __attribute__((aligned(64)));
+	uint64_t tail __attribute__((aligned(64)));
+	char data[SHARD_RING_BYTES] __attribute__((aligned(64)));
+};
+
+struct shard_map {
+	int nshards;
+	long outstanding __attribute__((aligned(64)));
+	int done __attribute__((aligned(64)));
+	shard_ring rings[];
+};
+
+shard_map* shard_map_create(int nshards);
+void shard_map_free(shard_map* map);
+int shard_of(char* url, int nshards);
+shard_ring* shard_ring_between(shard_map* map, int from, int to);
+int shard_ring_put(shard_ring* ring, char* from, char* link);
+int shard_ring_get(shard_ring* ring, char* from, char* link);
+void shard_work_add(shard_map* map, long n);
+void shard_work_done(shard_map* map, long n);
+int shard_all_done(shard_map* map);
+
+#endif
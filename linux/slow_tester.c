@@ -0,0 +1,78 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/resource.h>
+#include "crawler.h"
+
+/*
+Slow parser workload for the parse queue byte budget. Every page is padded
+to pad_kb kilobytes and every edge costs the parser delay_us, so downloaders
+run far ahead of the parser. Prints the crawl stats and the peak RSS when
+the crawl exits.
+
+usage: slow_tester start_url pad_kb delay_us budget_bytes [spill]
+*/
+
+int pad_kb;
+int delay_us;
+
+void *Malloc(size_t size) {
+  void *r = malloc(size);
+  assert(r);
+  return r;
+}
+
+char *fetch(char *link) {
+  int fd = open(link, O_RDONLY);
+  if (fd < 0) {
+    perror("failed to open file");
+    return NULL;
+  }
+  int size = lseek(fd, 0, SEEK_END);
+  assert(size >= 0);
+  int pad = pad_kb * 1024;
+  char *buf = Malloc(size+pad+2);
+  lseek(fd, 0, SEEK_SET);
+  char *pos = buf;
+  while(pos < buf+size) {
+    int rv = read(fd, pos, buf+size-pos);
+    assert(rv > 0);
+    pos += rv;
+  }
+  close(fd);
+  buf[size] = '\n';
+  memset(buf+size+1, 'x', pad);
+  buf[size+pad+1] = '\0';
+  return buf;
+}
+
+void edge(char *from, char *to) {
+  usleep(delay_us);
+  printf("%s -> %s\n", from, to);
+}
+
+void print_stats(crawl_stats *stats) {
+  stats_print(stderr, stats);
+}
+
+void report(void) {
+  struct rusage ru;
+  getrusage(RUSAGE_SELF, &ru);
+  fprintf(stderr, "peak_rss_kb=%ld\n", ru.ru_maxrss);
+}
+
+int main(int argc, char *argv[]) {
+  assert(argc == 5 || argc == 6);
+  pad_kb = atoi(argv[2]);
+  delay_us = atoi(argv[3]);
+  crawl_set_parse_budget(atol(argv[4]), argc == 6);
+  crawl_set_stats(10, print_stats);
+  atexit(report);
+  int rc = crawl(argv[1], 4, 1, 4, fetch, edge);
+  assert(rc == 0);
+  return 0;
+}
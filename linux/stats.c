@@ -0,0 +1,195 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include "stats.h"
+
+uint64_t stats_now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+Adds one value to a histogram. Only the owning thread writes a histogram,
+so plain increments are enough; readers may see a slightly stale copy.
+*/
+void stats_hist_add(stats_hist* hist, uint64_t ns)
+{
+	int bucket = ns ? 63 - __builtin_clzll(ns) : 0;
+	if (bucket >= STATS_BUCKETS) {
+		bucket = STATS_BUCKETS - 1;
+	}
+	hist->buckets[bucket]++;
+	hist->count++;
+	hist->sum_ns += ns;
+	if (ns > hist->max_ns) {
+		hist->max_ns = ns;
+	}
+}
+
+/*
+Estimates the p-th percentile (0 < p <= 1) as the upper edge of the bucket
+it falls in.
+
+@return:
+unsigned long, the estimate in ns, 0 for an empty histogram
+*/
+unsigned long stats_hist_percentile(stats_hist* hist, double p)
+{
+	unsigned long target = (unsigned long)(p * hist->count + 0.5);
+	unsigned long seen = 0;
+	int i;
+	if (hist->count == 0) {
+		return 0;
+	}
+	if (target == 0) {
+		target = 1;
+	}
+	for (i = 0; i < STATS_BUCKETS; i++) {
+		seen += hist->buckets[i];
+		if (seen >= target) {
+			unsigned long edge = 2UL << i;
+			return edge < hist->max_ns ? edge : hist->max_ns;
+		}
+	}
+	return hist->max_ns;
+}
+
+/*
+Allocates zeroed, cache line aligned per-thread counters.
+*/
+stats_thread* stats_alloc(int nthreads)
+{
+	stats_thread* threads;
+	if (posix_memalign((void**)&threads, 64, sizeof(stats_thread) * nthreads) != 0) {
+		return NULL;
+	}
+	memset(threads, 0, sizeof(stats_thread) * nthreads);
+	return threads;
+}
+
+void stats_hist_merge(stats_hist* into, stats_hist* from)
+{
+	int i;
+	for (i = 0; i < STATS_BUCKETS; i++) {
+		into->buckets[i] += from->buckets[i];
+	}
+	into->count += from->count;
+	into->sum_ns += from->sum_ns;
+	if (from->max_ns > into->max_ns) {
+		into->max_ns = from->max_ns;
+	}
+}
+
+/*
+Adds up the per-thread counters into out. Leaves the fields that do not
+come from threads (queue depths, samples) alone.
+*/
+void stats_merge(stats_thread* threads, int nthreads, crawl_stats* out)
+{
+	int i;
+	out->pages_fetched = 0;
+	out->pages_parsed = 0;
+	out->pages_streamed = 0;
+	out->fetch_errors = 0;
+	out->links_seen = 0;
+	out->links_new = 0;
+	out->links_rewritten = 0;
+	out->links_filtered = 0;
+	out->frontier_locks = 0;
+	out->dup_pages = 0;
+	out->dup_bytes = 0;
+	out->not_modified = 0;
+	out->unchanged = 0;
+	out->fetch_retries = 0;
+	out->fetch_gave_up = 0;
+	out->fetch_timeouts = 0;
+	out->fetch_hedges = 0;
+	out->hedge_wins = 0;
+	out->shard_links_out = 0;
+	out->shard_links_in = 0;
+	out->shard_ring_waits = 0;
+	memset(&out->fetch, 0, sizeof(stats_hist));
+	memset(&out->parse, 0, sizeof(stats_hist));
+	memset(&out->wait_frontier_empty, 0, sizeof(stats_hist));
+	memset(&out->wait_frontier_full, 0, sizeof(stats_hist));
+	memset(&out->wait_parse_empty, 0, sizeof(stats_hist));
+	memset(&out->wait_parse_full, 0, sizeof(stats_hist));
+	for (i = 0; i < nthreads; i++) {
+		out->pages_fetched += threads[i].pages_fetched;
+		out->pages_parsed += threads[i].pages_parsed;
+		out->pages_streamed += threads[i].pages_streamed;
+		out->fetch_errors += threads[i].fetch_errors;
+		out->links_seen += threads[i].links_seen;
+		out->links_new += threads[i].links_new;
+		out->links_rewritten += threads[i].links_rewritten;
+		out->links_filtered += threads[i].links_filtered;
+		out->frontier_locks += threads[i].frontier_locks;
+		out->dup_pages += threads[i].dup_pages;
+		out->dup_bytes += threads[i].dup_bytes;
+		out->not_modified += threads[i].not_modified;
+		out->unchanged += threads[i].unchanged;
+		out->fetch_retries += threads[i].fetch_retries;
+		out->fetch_gave_up += threads[i].fetch_gave_up;
+		out->fetch_timeouts += threads[i].fetch_timeouts;
+		out->fetch_hedges += threads[i].fetch_hedges;
+		out->hedge_wins += threads[i].hedge_wins;
+		out->shard_links_out += threads[i].shard_links_out;
+		out->shard_links_in += threads[i].shard_links_in;
+		out->shard_ring_waits += threads[i].shard_ring_waits;
+		stats_hist_merge(&out->fetch, &threads[i].fetch);
+		stats_hist_merge(&out->parse, &threads[i].parse);
+		stats_hist_merge(&out->wait_frontier_empty, &threads[i].wait_frontier_empty);
+		stats_hist_merge(&out->wait_frontier_full, &threads[i].wait_frontier_full);
+		stats_hist_merge(&out->wait_parse_empty, &threads[i].wait_parse_empty);
+		stats_hist_merge(&out->wait_parse_full, &threads[i].wait_parse_full);
+	}
+}
+
+static void hist_print(FILE* file, char* name, stats_hist* hist)
+{
+	fprintf(file, "%-20s n=%lu mean=%luns p50=%luns p99=%luns max=%luns\n", name,
+		hist->count, hist->count ? hist->sum_ns / hist->count : 0,
+		stats_hist_percentile(hist, 0.5), stats_hist_percentile(hist, 0.99),
+		hist->max_ns);
+}
+
+void stats_print(FILE* file, crawl_stats* stats)
+{
+	fprintf(file, "elapsed %luus, fetched %lu (%lu errors), parsed %lu (%lu streamed), links seen %lu (%lu normalized, %lu filtered), new %lu\n",
+		stats->elapsed_us, stats->pages_fetched, stats->fetch_errors, stats->pages_parsed, stats->pages_streamed,
+		stats->links_seen, stats->links_rewritten, stats->links_filtered, stats->links_new);
+	fprintf(file, "frontier lock acquisitions %lu (%.2f per page)\n", stats->frontier_locks,
+		stats->pages_fetched ? (double)stats->frontier_locks / stats->pages_fetched : 0.0);
+	fprintf(file, "duplicate pages %lu (%lu bytes not parsed)\n", stats->dup_pages, stats->dup_bytes);
+	fprintf(file, "recrawl not modified %lu, unchanged %lu\n", stats->not_modified, stats->unchanged);
+	fprintf(file, "fetch retries %lu (%lu gave up), timeouts %lu, hedged %lu (%lu won)\n", stats->fetch_retries,
+		stats->fetch_gave_up, stats->fetch_timeouts, stats->fetch_hedges, stats->hedge_wins);
+	if (stats->nshards > 1) {
+		fprintf(file, "shard %d of %d, links sent %lu, received %lu, waits for ring space %lu\n", stats->shard,
+			stats->nshards, stats->shard_links_out, stats->shard_links_in, stats->shard_ring_waits);
+	}
+	fprintf(file, "bloom filter %lu bits for %ld URLs, %.1f%% set, queries %lu, positives %lu (%lu hits, %lu false), "
+		"false positive rate %.3f%% (predicted %.3f%%)\n", stats->bloom.nbits, stats->expected_urls,
+		100.0 * stats->bloom.fill, stats->bloom.queries, stats->bloom.positives, stats->bloom.hits,
+		stats->bloom.false_positives, 100.0 * stats->bloom.fp_rate, 100.0 * stats->bloom.est_fp_rate);
+	if (stats->visited_budget > 0) {
+		fprintf(file, "visited store %ld URLs in %d runs (%ld byte budget), run lookups %lu, flushes %lu, merges %lu\n",
+			stats->visited_keys, stats->visited_runs, stats->visited_budget, stats->visited_run_lookups,
+			stats->visited_flushes, stats->visited_merges);
+	}
+	fprintf(file, "waits parked %lu, ended spinning %lu, wakeups %lu\n",
+		stats->parks, stats->spin_wakes, stats->wake_signals);
+	fprintf(file, "frontier %d, parse queue %d (%ld bytes, peak %ld, %lu spilled)\n",
+		stats->frontier, stats->parse_queue, stats->parse_bytes,
+		stats->parse_peak_bytes, stats->parse_spilled);
+	hist_print(file, "fetch", &stats->fetch);
+	hist_print(file, "parse", &stats->parse);
+	hist_print(file, "wait frontier empty", &stats->wait_frontier_empty);
+	hist_print(file, "wait frontier full", &stats->wait_frontier_full);
+	hist_print(file, "wait parse empty", &stats->wait_parse_empty);
+	hist_print(file, "wait parse budget", &stats->wait_parse_full);
+}
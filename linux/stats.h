@@ -0,0 +1,161 @@
+#ifndef __STATS_H
+#define __STATS_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include "bloom.h"
+
+/*
+Crawl metrics. Every worker thread owns one stats_thread, aligned and
+padded to its own cache lines, and only ever writes to that one; readers
+add them up in stats_merge. Latencies go into histograms with one bucket
+per power of two nanoseconds.
+*/
+#define STATS_BUCKETS 48
+#define STATS_MAX_SAMPLES 4096
+
+typedef struct stats_hist stats_hist;
+typedef struct stats_thread stats_thread;
+typedef struct stats_sample stats_sample;
+typedef struct crawl_stats crawl_stats;
+
+/* buckets[i] counts values in [2^i, 2^(i+1)) ns; bucket 0 also holds 0. */
+struct stats_hist {
+	unsigned long buckets[STATS_BUCKETS];
+	unsigned long count;
+	unsigned long sum_ns;
+	unsigned long max_ns;
+};
+
+struct stats_thread {
+	unsigned long pages_fetched;
+	unsigned long pages_parsed;
+	unsigned long pages_streamed;
+	unsigned long fetch_errors;
+	unsigned long links_seen;
+	unsigned long links_new;
+	unsigned long links_rewritten;
+	unsigned long links_filtered;
+	unsigned long frontier_locks;
+	unsigned long dup_pages;
+	unsigned long dup_bytes;
+	unsigned long not_modified;
+	unsigned long unchanged;
+	unsigned long fetch_retries;
+	unsigned long fetch_gave_up;
+	unsigned long fetch_timeouts;
+	unsigned long fetch_hedges;
+	unsigned long hedge_wins;
+	unsigned long shard_links_out;
+	unsigned long shard_links_in;
+	unsigned long shard_ring_waits;
+	stats_hist fetch;
+	stats_hist parse;
+	stats_hist wait_frontier_empty;
+	stats_hist wait_frontier_full;
+	stats_hist wait_parse_empty;
+	stats_hist wait_parse_full;
+} __attribute__((aligned(64)));
+
+/* Queue depths at t_us microseconds into the crawl. */
+struct stats_sample {
+	unsigned long t_us;
+	int frontier;
+	int parse_queue;
+	long parse_bytes;
+};
+
+/*
+What crawl_get_stats() returns. The wait histograms time how long workers
+sat on each queue's condition variable: downloaders on an empty frontier,
+parsers on a full frontier and on an empty parse queue, downloaders on the
+parse queue byte budget. samples is a malloc'd copy the caller frees;
+when the buffer fills up, every other sample is dropped and the interval
+doubles, so it always covers the whole crawl. frontier_locks counts worker
+acquisitions of the frontier lock, to judge frontier batching by. parks
+counts waits that went to sleep on a queue, spin_wakes waits that ended
+while spinning, and wake_signals the wakeups sent to parked threads.
+dup_pages counts fetched pages skipped as copies of earlier ones (see
+crawl_set_dedup) and dup_bytes the page bytes that were not parsed.
+not_modified counts fetches answered "not modified" and unchanged pages
+that came back whole but identical to the last crawl's; both reuse the
+last crawl's links (see crawl_set_recrawl). links_rewritten counts links
+that normalization changed (see crawl_set_normalize) and links_filtered
+links the URL filter skipped (see crawl_set_filter). pages_streamed
+counts the parsed pages that arrived in pieces (see crawl_set_streaming).
+fetch_retries counts failed fetches put back on the frontier for another
+try and fetch_gave_up those that failed their last try (see
+crawl_set_retries); fetch_timeouts, fetch_hedges and hedge_wins are what
+fetch_fn reported with crawl_fetch_report() (see crawl_set_hedge).
+In a sharded crawl (see crawl_set_shards) the stats are those of shard
+number shard of nshards; shard_links_out counts the links it sent to the
+shards that own them, shard_links_in those it got from the others, and
+shard_ring_waits the times a send found the ring full.
+bloom is the visited set's Bloom filter, sized for expected_urls (see
+crawl_set_expected_urls). With a visited store (see
+crawl_set_visited_store), visited_budget is its memory budget,
+visited_keys the URLs in it, visited_runs its run files,
+visited_run_lookups the run searches, and visited_flushes and
+visited_merges the runs written and merged.
+*/
+struct crawl_stats {
+	unsigned long elapsed_us;
+	unsigned long pages_fetched;
+	unsigned long pages_parsed;
+	unsigned long pages_streamed;
+	unsigned long fetch_errors;
+	unsigned long links_seen;
+	unsigned long links_new;
+	unsigned long links_rewritten;
+	unsigned long links_filtered;
+	unsigned long frontier_locks;
+	unsigned long dup_pages;
+	unsigned long dup_bytes;
+	unsigned long not_modified;
+	unsigned long unchanged;
+	unsigned long fetch_retries;
+	unsigned long fetch_gave_up;
+	unsigned long fetch_timeouts;
+	unsigned long fetch_hedges;
+	unsigned long hedge_wins;
+	unsigned long shard_links_out;
+	unsigned long shard_links_in;
+	unsigned long shard_ring_waits;
+	unsigned long parks;
+	unsigned long spin_wakes;
+	unsigned long wake_signals;
+	int shard;
+	int nshards;
+	int frontier;
+	int parse_queue;
+	long parse_bytes;
+	long parse_peak_bytes;
+	unsigned long parse_spilled;
+	long expected_urls;
+	bloom_stats bloom;
+	long visited_budget;
+	long visited_keys;
+	int visited_runs;
+	unsigned long visited_run_lookups;
+	unsigned long visited_flushes;
+	unsigned long visited_merges;
+	stats_hist fetch;
+	stats_hist parse;
+	stats_hist wait_frontier_empty;
+	stats_hist wait_frontier_full;
+	stats_hist wait_parse_empty;
+	stats_hist wait_parse_full;
+	stats_sample* samples;
+	int nsamples;
+	int sample_interval_ms;
+};
+
+uint64_t stats_now_ns(void);
+void stats_hist_add(stats_hist* hist, uint64_t ns);
+void stats_hist_merge(stats_hist* into, stats_hist* from);
+unsigned long stats_hist_percentile(stats_hist* hist, double p);
+stats_thread* stats_alloc(int nthreads);
+void stats_merge(stats_thread* threads, int nthreads, crawl_stats* out);
+void stats_print(FILE* file, crawl_stats* stats);
+
+#endif
@@ -0,0 +1,164 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "topo.h"
+
+static int read_int(char* path, int fallback)
+{
+	FILE* file = fopen(path, "r");
+	int value;
+	if (file == NULL) {
+		return fallback;
+	}
+	if (fscanf(file, "%d", &value) != 1) {
+		value = fallback;
+	}
+	fclose(file);
+	return value;
+}
+
+/*
+Parses a sysfs CPU list such as "0-3,8,10-11" into set.
+
+@return:
+int, 0 on success, -1 if path cannot be read
+*/
+static int read_cpulist(char* path, cpu_set_t* set)
+{
+	FILE* file = fopen(path, "r");
+	int lo;
+	int hi;
+	char sep;
+
+	CPU_ZERO(set);
+	if (file == NULL) {
+		return -1;
+	}
+	while (fscanf(file, "%d", &lo) == 1) {
+		hi = lo;
+		sep = fgetc(file);
+		if (sep == '-') {
+			if (fscanf(file, "%d", &hi) != 1) {
+				break;
+			}
+			sep = fgetc(file);
+		}
+		for (; lo <= hi && lo < CPU_SETSIZE; lo++) {
+			CPU_SET(lo, set);
+		}
+		if (sep != ',') {
+			break;
+		}
+	}
+	fclose(file);
+	return 0;
+}
+
+static int cpu_cmp(const void* a, const void* b)
+{
+	const topo_cpu* x = a;
+	const topo_cpu* y = b;
+	if (x->node != y->node) {
+		return x->node - y->node;
+	}
+	if (x->package != y->package) {
+		return x->package - y->package;
+	}
+	if (x->core != y->core) {
+		return x->core - y->core;
+	}
+	return x->cpu - y->cpu;
+}
+
+/*
+Reads the topology of the CPUs in this process's affinity mask. Missing
+sysfs entries are treated as one core per CPU on a single node.
+
+@return:
+int, 0 on success, -1 if the affinity mask cannot be read
+*/
+int topo_load(cpu_topology* topo)
+{
+	cpu_set_t allowed;
+	cpu_set_t node_cpus;
+	char path[256];
+	int cpu;
+	int node;
+	int n = 0;
+
+	if (sched_getaffinity(0, sizeof(allowed), &allowed) < 0) {
+		perror("topo: sched_getaffinity");
+		return -1;
+	}
+	topo->cpus = malloc(sizeof(topo_cpu) * CPU_COUNT(&allowed));
+	for (cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+		if (!CPU_ISSET(cpu, &allowed)) {
+			continue;
+		}
+		topo->cpus[n].cpu = cpu;
+		snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/core_id", cpu);
+		topo->cpus[n].core = read_int(path, cpu);
+		snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/physical_package_id", cpu);
+		topo->cpus[n].package = read_int(path, 0);
+		topo->cpus[n].node = 0;
+		n++;
+	}
+	topo->ncpus = n;
+	for (node = 0; node < CPU_SETSIZE; node++) {
+		int i;
+		snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+		if (read_cpulist(path, &node_cpus) < 0) {
+			if (node > 0) {
+				break;
+			}
+			continue;
+		}
+		for (i = 0; i < n; i++) {
+			if (CPU_ISSET(topo->cpus[i].cpu, &node_cpus)) {
+				topo->cpus[i].node = node;
+			}
+		}
+	}
+	qsort(topo->cpus, n, sizeof(topo_cpu), cpu_cmp);
+	return 0;
+}
+
+/*
+Works out where worker number index of the given role goes.
+TOPO_COMPACT puts the ndownloaders downloaders on consecutive CPUs, then
+parsers after them.
+TOPO_PAIRED puts downloader k and parser k on neighbouring CPUs, SMT
+siblings where there are any. Which parser gets a page is up to the
+queue, not the placement.
+
+@return:
+int, 0 if out holds the CPUs to pin to, -1 to leave the worker unpinned
+*/
+int topo_place(cpu_topology* topo, int policy, int role, int index, int ndownloaders, cpu_set_t* out)
+{
+	int i;
+
+	CPU_ZERO(out);
+	if (topo->ncpus == 0) {
+		return -1;
+	}
+	switch (policy) {
+	case TOPO_COMPACT:
+		i = role == TOPO_DOWNLOADER ? index : ndownloaders + index;
+		CPU_SET(topo->cpus[i % topo->ncpus].cpu, out);
+		return 0;
+	case TOPO_PAIRED:
+		CPU_SET(topo->cpus[(2 * index + role) % topo->ncpus].cpu, out);
+		return 0;
+	default:
+		return -1;
+	}
+}
+
+void topo_free(cpu_topology* topo)
+{
+	free(topo->cpus);
+	topo->cpus = NULL;
+	topo->ncpus = 0;
+}
@@ -0,0 +1,39 @@
+#ifndef __TOPO_H
+#define __TOPO_H
+
+/* cpu_set_t needs _GNU_SOURCE defined before the first system header. */
+#include <sched.h>
+
+/*
+CPU topology for worker placement, read from sysfs. Only CPUs the process
+may run on are included. cpus is sorted by NUMA node, then package, then
+core, then CPU number, so SMT siblings end up next to each other and a
+node's CPUs form one run.
+*/
+#define TOPO_NONE 0
+#define TOPO_COMPACT 1
+#define TOPO_PAIRED 2
+
+#define TOPO_DOWNLOADER 0
+#define TOPO_PARSER 1
+
+typedef struct topo_cpu topo_cpu;
+typedef struct cpu_topology cpu_topology;
+
+struct topo_cpu {
+	int cpu;
+	int core;
+	int package;
+	int node;
+};
+
+struct cpu_topology {
+	topo_cpu* cpus;
+	int ncpus;
+};
+
+int topo_load(cpu_topology* topo);
+int topo_place(cpu_topology* topo, int policy, int role, int index, int ndownloaders, cpu_set_t* out);
+void topo_free(cpu_topology* topo);
+
+#endif
@@ -0,0 +1,141 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include "trace.h"
+
+static char* trace_names[TRACE_NTYPES] = {
+	"dequeue frontier",
+	"dequeue parse queue",
+	"fetch",
+	"parse",
+	"wait frontier empty",
+	"wait frontier full",
+	"wait parse empty",
+	"wait parse budget",
+	"lock visited"
+};
+
+/*
+Allocates one zeroed ring per thread, each holding events rounded up to a
+power of two.
+
+@return:
+trace_ring*, the rings, or NULL on allocation failure
+*/
+trace_ring* trace_alloc(int nthreads, int events)
+{
+	trace_ring* rings;
+	unsigned long cap = 1;
+	int i;
+
+	while (cap < (unsigned long)events) {
+		cap <<= 1;
+	}
+	if (posix_memalign((void**)&rings, 64, sizeof(trace_ring) * nthreads) != 0) {
+		return NULL;
+	}
+	memset(rings, 0, sizeof(trace_ring) * nthreads);
+	for (i = 0; i < nthreads; i++) {
+		rings[i].events = malloc(sizeof(trace_event) * cap);
+		if (rings[i].events == NULL) {
+			return NULL;
+		}
+		rings[i].mask = cap - 1;
+	}
+	return rings;
+}
+
+/*
+Records one span. Only the thread owning ring may call this; head is
+published with release so a reader that loads it with acquire sees the
+event filled in.
+*/
+void trace_add(trace_ring* ring, int type, uint64_t start_ns, uint64_t end_ns, char* url)
+{
+	trace_event* ev = &ring->events[ring->head & ring->mask];
+	ev->start_ns = start_ns;
+	ev->dur_ns = end_ns - start_ns;
+	ev->type = type;
+	if (url != NULL) {
+		strncpy(ev->url, url, TRACE_URL_BYTES - 1);
+		ev->url[TRACE_URL_BYTES - 1] = '\0';
+	}
+	else {
+		ev->url[0] = '\0';
+	}
+	__atomic_store_n(&ring->head, ring->head + 1, __ATOMIC_RELEASE);
+}
+
+static void put_json_string(FILE* file, char* str)
+{
+	fputc('"', file);
+	for (; *str; str++) {
+		unsigned char c = *str;
+		if (c == '"' || c == '\\') {
+			fprintf(file, "\\%c", c);
+		}
+		else if (c < 0x20 || c >= 0x7f) {
+			fprintf(file, "\\u%04x", c);
+		}
+		else {
+			fputc(c, file);
+		}
+	}
+	fputc('"', file);
+}
+
+/*
+Writes the rings to path as a Chrome trace. Timestamps are microseconds
+since base_ns. Threads may still be adding events; each ring is read up to
+the head seen when it is reached.
+
+@return:
+int, the number of events written, or -1 if path cannot be written
+*/
+int trace_write(trace_ring* rings, int nthreads, uint64_t base_ns, char* path)
+{
+	FILE* file = fopen(path, "w");
+	unsigned long dropped = 0;
+	int written = 0;
+	int i;
+
+	if (file == NULL) {
+		perror("trace: open");
+		return -1;
+	}
+	fprintf(file, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+	for (i = 0; i < nthreads; i++) {
+		unsigned long head = __atomic_load_n(&rings[i].head, __ATOMIC_ACQUIRE);
+		unsigned long first = head > rings[i].mask + 1 ? head - rings[i].mask - 1 : 0;
+		unsigned long j;
+
+		dropped += first;
+		fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":",
+			i ? ",\n" : "", i);
+		put_json_string(file, rings[i].name[0] ? rings[i].name : "worker");
+		fprintf(file, "}}");
+		for (j = first; j < head; j++) {
+			trace_event* ev = &rings[i].events[j & rings[i].mask];
+			if (ev->start_ns < base_ns || ev->type >= TRACE_NTYPES) {
+				continue;
+			}
+			fprintf(file, ",\n{\"name\":\"%s\",\"cat\":\"crawl\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,"
+				"\"ts\":%.3f,\"dur\":%.3f", trace_names[ev->type], i,
+				(ev->start_ns - base_ns) / 1000.0, ev->dur_ns / 1000.0);
+			if (ev->url[0]) {
+				fprintf(file, ",\"args\":{\"url\":");
+				put_json_string(file, ev->url);
+				fputc('}', file);
+			}
+			fputc('}', file);
+			written++;
+		}
+	}
+	fprintf(file, "\n],\"otherData\":{\"dropped_events\":%lu}}\n", dropped);
+	if (fclose(file) != 0) {
+		perror("trace: write");
+		return -1;
+	}
+	return written;
+}
@@ -0,0 +1,53 @@
+#ifndef __TRACE_H
+#define __TRACE_H
+
+#include <stdint.h>
+
+/*
+Crawl timeline tracing. Every worker thread owns a ring of fixed size
+events and is its only writer, so recording an event is two clock reads and
+a few stores, with no lock. When a ring fills up the oldest events are
+overwritten. At the end of the crawl the rings are written out in the
+Chrome trace event format (chrome://tracing, Perfetto), one track per
+worker.
+*/
+#define TRACE_DEFAULT_EVENTS 65536
+#define TRACE_URL_BYTES 44
+
+typedef struct trace_event trace_event;
+typedef struct trace_ring trace_ring;
+
+enum {
+	TRACE_DEQUEUE_FRONTIER,
+	TRACE_DEQUEUE_PARSE,
+	TRACE_FETCH,
+	TRACE_PARSE,
+	TRACE_WAIT_FRONTIER_EMPTY,
+	TRACE_WAIT_FRONTIER_FULL,
+	TRACE_WAIT_PARSE_EMPTY,
+	TRACE_WAIT_PARSE_FULL,
+	TRACE_LOCK_VISITED,
+	TRACE_NTYPES
+};
+
+/* One span; url holds the start of the URL involved, if any. 64 bytes. */
+struct trace_event {
+	uint64_t start_ns;
+	uint64_t dur_ns;
+	uint32_t type;
+	char url[TRACE_URL_BYTES];
+};
+
+/* head counts every event ever added; the last mask + 1 are kept. */
+struct trace_ring {
+	trace_event* events;
+	unsigned long mask;
+	unsigned long head;
+	char name[32];
+} __attribute__((aligned(64)));
+
+trace_ring* trace_alloc(int nthreads, int events);
+void trace_add(trace_ring* ring, int type, uint64_t start_ns, uint64_t end_ns, char* url);
+int trace_write(trace_ring* rings, int nthreads, uint64_t base_ns, char* path);
+
+#endif
@@ -0,0 +1,276 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include "urlnorm.h"
+#include "urlfilter.h"
+
+/*
+Checks url_normalize against the examples of RFC 3986 section 5.4 and the
+crawler's own page names, then times it on a mix of link spellings and
+prints URLs per second for each.
+
+Then checks urlfilter_match on a small rule set, and times it with -r
+rules (half disallowed prefixes, half excluded substrings) against testing
+each rule in turn, which must give the same answers. Exits 1 if any check
+fails.
+*/
+
+typedef struct {
+  char *base;
+  char *link;
+  char *expect;
+} check;
+
+/* RFC 3986 5.4, except that an empty path after a host becomes "/". */
+#define RFC_BASE "http://a/b/c/d;p?q"
+
+check checks[] = {
+  { RFC_BASE, "g:h", "g:h" },
+  { RFC_BASE, "g", "http://a/b/c/g" },
+  { RFC_BASE, "./g", "http://a/b/c/g" },
+  { RFC_BASE, "g/", "http://a/b/c/g/" },
+  { RFC_BASE, "/g", "http://a/g" },
+  { RFC_BASE, "//g", "http://g/" },
+  { RFC_BASE, "?y", "http://a/b/c/d;p?y" },
+  { RFC_BASE, "g?y", "http://a/b/c/g?y" },
+  { RFC_BASE, "#s", "http://a/b/c/d;p?q" },
+  { RFC_BASE, "g#s", "http://a/b/c/g" },
+  { RFC_BASE, "g?y#s", "http://a/b/c/g?y" },
+  { RFC_BASE, ";x", "http://a/b/c/;x" },
+  { RFC_BASE, "g;x", "http://a/b/c/g;x" },
+  { RFC_BASE, "g;x?y#s", "http://a/b/c/g;x?y" },
+  { RFC_BASE, "", "http://a/b/c/d;p?q" },
+  { RFC_BASE, ".", "http://a/b/c/" },
+  { RFC_BASE, "./", "http://a/b/c/" },
+  { RFC_BASE, "..", "http://a/b/" },
+  { RFC_BASE, "../", "http://a/b/" },
+  { RFC_BASE, "../g", "http://a/b/g" },
+  { RFC_BASE, "../..", "http://a/" },
+  { RFC_BASE, "../../", "http://a/" },
+  { RFC_BASE, "../../g", "http://a/g" },
+  { RFC_BASE, "../../../g", "http://a/g" },
+  { RFC_BASE, "../../../../g", "http://a/g" },
+  { RFC_BASE, "/./g", "http://a/g" },
+  { RFC_BASE, "/../g", "http://a/g" },
+  { RFC_BASE, "g.", "http://a/b/c/g." },
+  { RFC_BASE, ".g", "http://a/b/c/.g" },
+  { RFC_BASE, "g..", "http://a/b/c/g.." },
+  { RFC_BASE, "..g", "http://a/b/c/..g" },
+  { RFC_BASE, "./../g", "http://a/b/g" },
+  { RFC_BASE, "./g/.", "http://a/b/c/g/" },
+  { RFC_BASE, "g/./h", "http://a/b/c/g/h" },
+  { RFC_BASE, "g/../h", "http://a/b/c/h" },
+  { RFC_BASE, "g;x=1/./y", "http://a/b/c/g;x=1/y" },
+  { RFC_BASE, "g;x=1/../y", "http://a/b/c/y" },
+  { RFC_BASE, "g?y/./x", "http://a/b/c/g?y/./x" },
+  { RFC_BASE, "g?y/../x", "http://a/b/c/g?y/../x" },
+  { RFC_BASE, "g#s/./x", "http://a/b/c/g" },
+  { RFC_BASE, "http:g", "http:g" },
+  { NULL, "HTTP://Example.COM:80/a/./b/../c", "http://example.com/a/c" },
+  { NULL, "https://User@Example.com:443", "https://User@example.com/" },
+  { NULL, "http://example.com:8080/", "http://example.com:8080/" },
+  { "pagea", "pageb", "pageb" },
+  { "pagea", "./pageb", "pageb" },
+  { "pagea", "pageb#x", "pageb" },
+  { "pagea", "#top", "pagea" },
+  { "dir/pagea", "pageb", "dir/pageb" },
+  { "dir/pagea", "../pageb", "pageb" },
+  { "dir/pagea", "../../pageb", "pageb" },
+  { "dir/pagea", "/pageb", "/pageb" },
+};
+
+typedef struct {
+  char *name;
+  char *base;
+  char *links[4];
+} workload;
+
+workload workloads[] = {
+  { "names", "p123", { "p4567", "p89", "p1234567", "p0" } },
+  { "relative", "dir/sub/p123", { "./p4567", "../p89", "p1#frag", "../../x/./p0" } },
+  { "absolute", "http://Example.com/a/b", { "HTTP://Example.COM:80/a/./b", "//other.org/x/../y",
+					    "/root/p1?q=1", "https://x.org:443" } },
+};
+
+typedef struct {
+  char *url;
+  int excluded;
+} filter_check;
+
+filter_check filter_checks[] = {
+  { "/private/a", 1 },
+  { "/private/ok/b", 0 },
+  { "http://Host/private/a", 1 },
+  { "/public/private", 0 },
+  { "/a?sessionid=3", 1 },
+  { "/x", 1 },
+  { "/xy", 0 },
+  { "p1", 1 },
+  { "p12", 1 },
+  { "q1p1", 0 },
+  { "/doc.pdf", 1 },
+  { "/doc.pdfx", 0 },
+};
+
+double now() {
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+/* The rules one at a time, with the same precedence as urlfilter_match. */
+int naive_match(urlfilter *filter, char *url) {
+  size_t n = strlen(url);
+  size_t path = 0;
+  char *host = strstr(url, "://");
+  int best = 0, allow = 1;
+  int r;
+
+  if (host != NULL)
+    path = host + 3 - url + strcspn(host + 3, "/?");
+  for (r = 0; r < filter->nrules; r++) {
+    urlfilter_rule *rule = &filter->rules[r];
+    size_t len = rule->length;
+    int hit = 0;
+    if (rule->anchor == URLFILTER_PREFIX) {
+      hit = (strncmp(url, rule->pattern, len) == 0 && (!rule->at_end || n == len)) ||
+	(path > 0 && strncmp(url + path, rule->pattern, len) == 0 && (!rule->at_end || n == path + len));
+    }
+    else if (rule->at_end) {
+      hit = n >= len && strcmp(url + n - len, rule->pattern) == 0;
+    }
+    else {
+      hit = strstr(url, rule->pattern) != NULL;
+    }
+    if (hit && ((int)len > best || ((int)len == best && rule->allow))) {
+      best = len;
+      allow = rule->allow;
+    }
+  }
+  return !allow;
+}
+
+int check_filter() {
+  urlfilter filter;
+  int failed = 0;
+  size_t i;
+
+  urlfilter_init(&filter);
+  urlfilter_add(&filter, URLFILTER_DENY, URLFILTER_PREFIX, "/private");
+  urlfilter_add(&filter, URLFILTER_ALLOW, URLFILTER_PREFIX, "/private/ok");
+  urlfilter_add(&filter, URLFILTER_DENY, URLFILTER_SUBSTRING, "?sessionid=");
+  urlfilter_add(&filter, URLFILTER_DENY, URLFILTER_PREFIX, "/x$");
+  urlfilter_add(&filter, URLFILTER_DENY, URLFILTER_PREFIX, "p1");
+  urlfilter_add(&filter, URLFILTER_DENY, URLFILTER_SUBSTRING, ".pdf$");
+  urlfilter_compile(&filter);
+  for (i = 0; i < sizeof(filter_checks) / sizeof(filter_checks[0]); i++) {
+    if (urlfilter_match(&filter, filter_checks[i].url) != filter_checks[i].excluded ||
+	naive_match(&filter, filter_checks[i].url) != filter_checks[i].excluded) {
+      fprintf(stderr, "FAIL filter %s: want %s\n", filter_checks[i].url,
+	      filter_checks[i].excluded ? "excluded" : "crawled");
+      failed = 1;
+    }
+  }
+  urlfilter_free(&filter);
+  printf("%zu filter checks %s\n", sizeof(filter_checks) / sizeof(filter_checks[0]), failed ? "FAILED" : "passed");
+  return failed;
+}
+
+int bench_filter(int nrules, long iterations) {
+  char pattern[64];
+  char **urls = malloc(sizeof(char *) * 1024);
+  urlfilter filter;
+  long excluded = 0;
+  long k;
+  int failed = 0;
+  int i;
+  double t0, t1, t2;
+
+  urlfilter_init(&filter);
+  for (i = 0; i < nrules; i++) {
+    if (i % 2 == 0) {
+      snprintf(pattern, sizeof(pattern), "/dir%d/", i);
+      urlfilter_add(&filter, URLFILTER_DENY, URLFILTER_PREFIX, pattern);
+    }
+    else {
+      snprintf(pattern, sizeof(pattern), "session%d=", i);
+      urlfilter_add(&filter, URLFILTER_DENY, URLFILTER_SUBSTRING, pattern);
+    }
+  }
+  t0 = now();
+  urlfilter_compile(&filter);
+  t1 = now();
+  for (i = 0; i < 1024; i++) {
+    urls[i] = malloc(128);
+    snprintf(urls[i], 128, "http://example.com/dir%d/page%d.html?session%d=x&ref=p%d",
+	     (i * 7) % (2 * nrules), i, (i * 13) % (2 * nrules), i);
+    if (urlfilter_match(&filter, urls[i]) != naive_match(&filter, urls[i])) {
+      fprintf(stderr, "FAIL filter %s: automaton and naive disagree\n", urls[i]);
+      failed = 1;
+    }
+  }
+  printf("%d rules compiled in %.2fms: %d states, %d byte classes\n", filter.nrules, (t1 - t0) * 1e3,
+	 filter.nstates, filter.nclasses);
+  t0 = now();
+  for (k = 0; k < iterations; k++)
+    excluded += urlfilter_match(&filter, urls[k & 1023]);
+  t1 = now();
+  for (k = 0; k < iterations / 64; k++)
+    excluded += naive_match(&filter, urls[k & 1023]);
+  t2 = now();
+  printf("%-10s %.2fM URLs/s\n%-10s %.2fM URLs/s\n", "automaton", iterations / (t1 - t0) / 1e6,
+	 "naive", iterations / 64 / (t2 - t1) / 1e6);
+  for (i = 0; i < 1024; i++)
+    free(urls[i]);
+  free(urls);
+  urlfilter_free(&filter);
+  return failed || excluded == 0;
+}
+
+int main(int argc, char *argv[]) {
+  char out[URLNORM_MAX];
+  long iterations = 4000000;
+  int nrules = 500;
+  unsigned long sink = 0;
+  int failed = 0;
+  size_t i, w;
+  long k;
+  int c;
+  double t0, t1;
+
+  while ((c = getopt(argc, argv, "n:r:")) != -1) {
+    switch (c) {
+    case 'n': iterations = atol(optarg); break;
+    case 'r': nrules = atoi(optarg); break;
+    default:
+      fprintf(stderr, "usage: %s [-n iterations] [-r filter_rules]\n", argv[0]);
+      return 1;
+    }
+  }
+  for (i = 0; i < sizeof(checks) / sizeof(checks[0]); i++) {
+    if (url_normalize(checks[i].base, checks[i].link, out, sizeof(out)) < 0 ||
+	strcmp(out, checks[i].expect) != 0) {
+      fprintf(stderr, "FAIL %s + %s: got %s, want %s\n", checks[i].base ? checks[i].base : "(none)",
+	      checks[i].link, out, checks[i].expect);
+      failed = 1;
+    }
+  }
+  if (url_normalize("p0", "p1", out, 2) != -1) {
+    fprintf(stderr, "FAIL: no overflow reported\n");
+    failed = 1;
+  }
+  printf("%zu checks %s\n", sizeof(checks) / sizeof(checks[0]), failed ? "FAILED" : "passed");
+
+  for (w = 0; w < sizeof(workloads) / sizeof(workloads[0]); w++) {
+    t0 = now();
+    for (k = 0; k < iterations; k++)
+      sink += url_normalize(workloads[w].base, workloads[w].links[k & 3], out, sizeof(out));
+    t1 = now();
+    printf("%-10s %.1fM URLs/s\n", workloads[w].name, iterations / (t1 - t0) / 1e6);
+  }
+  failed |= check_filter();
+  failed |= bench_filter(nrules, iterations / 4);
+  return failed || sink == 0;
+}
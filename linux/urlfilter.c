@@ -0,0 +1,256 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <stdint.h>
+#include "urlfilter.h"
+
+void urlfilter_init(urlfilter* filter)
+{
+	memset(filter, 0, sizeof(urlfilter));
+}
+
+/*
+Adds a rule; call urlfilter_compile() once all are added. A trailing '$'
+anchors the pattern to the end of the URL. Empty patterns are ignored.
+
+@return:
+int, 0 on success, -1 on allocation failure
+*/
+int urlfilter_add(urlfilter* filter, int allow, int anchor, char* pattern)
+{
+	urlfilter_rule* rule;
+	int length = strlen(pattern);
+	int at_end = length > 0 && pattern[length - 1] == '$';
+
+	if (length - at_end == 0) {
+		return 0;
+	}
+	if (filter->nrules == filter->size) {
+		int size = filter->size > 0 ? filter->size * 2 : 16;
+		urlfilter_rule* rules = realloc(filter->rules, sizeof(urlfilter_rule) * size);
+		if (rules == NULL) {
+			return -1;
+		}
+		filter->rules = rules;
+		filter->size = size;
+	}
+	rule = &filter->rules[filter->nrules];
+	rule->pattern = strndup(pattern, length - at_end);
+	if (rule->pattern == NULL) {
+		return -1;
+	}
+	rule->length = length - at_end;
+	rule->allow = allow;
+	rule->anchor = anchor;
+	rule->at_end = at_end;
+	rule->next = -1;
+	filter->nrules++;
+	return 0;
+}
+
+/*
+Builds the automaton: a trie of all patterns, then failure links breadth
+first, filling in every missing transition from the failure state's so
+that matching never follows a failure link.
+
+@return:
+int, 0 on success, -1 on allocation failure
+*/
+int urlfilter_compile(urlfilter* filter)
+{
+	int max_states = 1;
+	int nc;
+	int32_t* fail;
+	int32_t* queue;
+	int head = 0;
+	int tail = 0;
+	int i;
+	int j;
+	int c;
+
+	memset(filter->classes, 0, sizeof(filter->classes));
+	filter->nclasses = 1;
+	for (i = 0; i < filter->nrules; i++) {
+		for (j = 0; j < filter->rules[i].length; j++) {
+			unsigned char b = filter->rules[i].pattern[j];
+			if (filter->classes[b] == 0) {
+				filter->classes[b] = filter->nclasses++;
+			}
+		}
+		max_states += filter->rules[i].length;
+	}
+	nc = filter->nclasses;
+	filter->next = malloc(sizeof(int32_t) * max_states * nc);
+	filter->out = malloc(sizeof(int32_t) * max_states);
+	filter->dict = malloc(sizeof(int32_t) * max_states);
+	fail = malloc(sizeof(int32_t) * max_states);
+	queue = malloc(sizeof(int32_t) * max_states);
+	if (filter->next == NULL || filter->out == NULL || filter->dict == NULL || fail == NULL || queue == NULL) {
+		free(fail);
+		free(queue);
+		return -1;
+	}
+	memset(filter->next, 0xff, sizeof(int32_t) * max_states * nc);
+	memset(filter->out, 0xff, sizeof(int32_t) * max_states);
+	memset(filter->dict, 0xff, sizeof(int32_t) * max_states);
+
+	filter->nstates = 1;
+	for (i = 0; i < filter->nrules; i++) {
+		int32_t s = 0;
+		for (j = 0; j < filter->rules[i].length; j++) {
+			int32_t* t = &filter->next[s * nc + filter->classes[(unsigned char)filter->rules[i].pattern[j]]];
+			if (*t < 0) {
+				*t = filter->nstates++;
+			}
+			s = *t;
+		}
+		filter->rules[i].next = filter->out[s];
+		filter->out[s] = i;
+	}
+
+	for (c = 0; c < nc; c++) {
+		int32_t t = filter->next[c];
+		if (t < 0) {
+			filter->next[c] = 0;
+		}
+		else {
+			fail[t] = 0;
+			queue[tail++] = t;
+		}
+	}
+	while (head < tail) {
+		int32_t s = queue[head++];
+		for (c = 0; c < nc; c++) {
+			int32_t t = filter->next[s * nc + c];
+			int32_t f = filter->next[fail[s] * nc + c];
+			if (t < 0) {
+				filter->next[s * nc + c] = f;
+			}
+			else {
+				fail[t] = f;
+				filter->dict[t] = filter->out[f] >= 0 ? f : filter->dict[f];
+				queue[tail++] = t;
+			}
+		}
+	}
+	free(fail);
+	free(queue);
+	return 0;
+}
+
+/*
+Loads and compiles the rules in path, see urlfilter.h.
+
+@return:
+int, 0 on success, -1 if path cannot be read or on allocation failure
+*/
+int urlfilter_load(urlfilter* filter, char* path)
+{
+	char line[4096];
+	FILE* file = fopen(path, "r");
+
+	urlfilter_init(filter);
+	if (file == NULL) {
+		perror("urlfilter: open");
+		return -1;
+	}
+	while (fgets(line, sizeof(line), file) != NULL) {
+		char* name = line;
+		char* value;
+		char* end;
+		line[strcspn(line, "#\r\n")] = '\0';
+		while (isspace((unsigned char)*name)) {
+			name++;
+		}
+		value = strchr(name, ':');
+		if (value == NULL) {
+			continue;
+		}
+		for (end = value; end > name && isspace((unsigned char)end[-1]); end--)
+			;
+		*end = '\0';
+		for (value++; isspace((unsigned char)*value); value++)
+			;
+		for (end = value + strlen(value); end > value && isspace((unsigned char)end[-1]); end--)
+			;
+		*end = '\0';
+		if ((strcasecmp(name, "disallow") == 0 && urlfilter_add(filter, URLFILTER_DENY, URLFILTER_PREFIX, value) < 0) ||
+		    (strcasecmp(name, "allow") == 0 && urlfilter_add(filter, URLFILTER_ALLOW, URLFILTER_PREFIX, value) < 0) ||
+		    (strcasecmp(name, "exclude") == 0 && urlfilter_add(filter, URLFILTER_DENY, URLFILTER_SUBSTRING, value) < 0)) {
+			fclose(file);
+			return -1;
+		}
+	}
+	fclose(file);
+	return urlfilter_compile(filter);
+}
+
+/*
+@return:
+int, the index where the path of url starts if it has a host, 0 otherwise
+*/
+static int path_start(char* url)
+{
+	int i = 0;
+	if (!isalpha((unsigned char)url[0])) {
+		return 0;
+	}
+	while (isalnum((unsigned char)url[i]) || url[i] == '+' || url[i] == '-' || url[i] == '.') {
+		i++;
+	}
+	if (strncmp(url + i, "://", 3) != 0) {
+		return 0;
+	}
+	return i + 3 + strcspn(url + i + 3, "/?");
+}
+
+/*
+Runs url through the automaton and weighs every rule that matches.
+
+@return:
+int, 1 if the rules exclude url, 0 if it may be crawled
+*/
+int urlfilter_match(urlfilter* filter, char* url)
+{
+	unsigned char* p = (unsigned char*)url;
+	int path = path_start(url);
+	int best = 0;
+	int allow = 1;
+	int32_t s = 0;
+	int i;
+
+	for (i = 0; p[i] != '\0'; i++) {
+		int32_t t;
+		s = filter->next[s * filter->nclasses + filter->classes[p[i]]];
+		for (t = filter->out[s] >= 0 ? s : filter->dict[s]; t >= 0; t = filter->dict[t]) {
+			int r;
+			for (r = filter->out[t]; r >= 0; r = filter->rules[r].next) {
+				urlfilter_rule* rule = &filter->rules[r];
+				int start = i + 1 - rule->length;
+				if ((rule->anchor == URLFILTER_PREFIX && start != 0 && start != path) ||
+				    (rule->at_end && p[i + 1] != '\0')) {
+					continue;
+				}
+				if (rule->length > best || (rule->length == best && rule->allow)) {
+					best = rule->length;
+					allow = rule->allow;
+				}
+			}
+		}
+	}
+	return !allow;
+}
+
+void urlfilter_free(urlfilter* filter)
+{
+	int i;
+	for (i = 0; i < filter->nrules; i++) {
+		free(filter->rules[i].pattern);
+	}
+	free(filter->rules);
+	free(filter->next);
+	free(filter->out);
+	free(filter->dict);
+}
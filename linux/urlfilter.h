@@ -0,0 +1,70 @@
+#ifndef __URLFILTER_H
+#define __URLFILTER_H
+
+#include <stdint.h>
+
+/*
+URL exclusion rules, compiled into one automaton so that a link is tested
+against all of them in a single pass over its bytes. A rules file has one
+rule per line, robots.txt style ('#' starts a comment, directive names
+are case insensitive, other directives are ignored):
+
+  disallow: <prefix>     skip URLs that start with prefix
+  allow: <prefix>        but crawl these
+  exclude: <substring>   skip URLs that contain substring anywhere
+
+A prefix matches at the start of the URL and, for a URL with a host, at
+the start of its path, so "disallow: /private" works for "/private/x"
+and "http://host/private/x" alike. A pattern ending in '$' must match at
+the end of the URL. When several rules match, the longest wins and allow
+wins a tie, as with robots.txt.
+
+The patterns are compiled into an Aho-Corasick automaton, turned into a
+DFA over byte classes: bytes that occur in no pattern share one class, so
+the transition table has a column per distinct pattern byte, not per
+byte value. Matching takes one table lookup per URL byte however many
+rules there are.
+*/
+#define URLFILTER_DENY 0
+#define URLFILTER_ALLOW 1
+#define URLFILTER_PREFIX 0
+#define URLFILTER_SUBSTRING 1
+
+typedef struct urlfilter_rule urlfilter_rule;
+typedef struct urlfilter urlfilter;
+
+/* next chains the rules that end at the same automaton state. */
+struct urlfilter_rule {
+	char* pattern;
+	int length;
+	int allow;
+	int anchor;
+	int at_end;
+	int next;
+};
+
+/*
+next is the DFA, nclasses entries per state. out is the first rule that
+ends at a state (-1: none) and dict the nearest state down its failure
+chain where a rule ends (-1: none).
+*/
+struct urlfilter {
+	urlfilter_rule* rules;
+	int nrules;
+	int size;
+	unsigned char classes[256];
+	int nclasses;
+	int nstates;
+	int32_t* next;
+	int32_t* out;
+	int32_t* dict;
+};
+
+void urlfilter_init(urlfilter* filter);
+int urlfilter_add(urlfilter* filter, int allow, int anchor, char* pattern);
+int urlfilter_compile(urlfilter* filter);
+int urlfilter_load(urlfilter* filter, char* path);
+int urlfilter_match(urlfilter* filter, char* url);
+void urlfilter_free(urlfilter* filter);
+
+#endif
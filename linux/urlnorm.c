@@ -0,0 +1,215 @@
+#include <string.h>
+#include <ctype.h>
+#include "urlnorm.h"
+
+/*
+Where the parts of a URL start: scheme is the length of "scheme:" (0 if
+there is none), path the index after the authority, query the index of
+'?' (end if none) and end the index of '#' (the length if none).
+*/
+typedef struct url_parts url_parts;
+
+struct url_parts {
+	int scheme;
+	int path;
+	int query;
+	int end;
+};
+
+static int find(char* s, int from, int to, char* stops)
+{
+	while (from < to && strchr(stops, s[from]) == NULL) {
+		from++;
+	}
+	return from;
+}
+
+static void split(char* s, url_parts* p)
+{
+	int i;
+	p->end = strcspn(s, "#");
+	p->scheme = 0;
+	if (p->end > 0 && isalpha((unsigned char)s[0])) {
+		for (i = 1; i < p->end && (isalnum((unsigned char)s[i]) || s[i] == '+' || s[i] == '-' || s[i] == '.'); i++)
+			;
+		if (i < p->end && s[i] == ':') {
+			p->scheme = i + 1;
+		}
+	}
+	p->path = p->scheme;
+	if (p->end - p->path >= 2 && s[p->path] == '/' && s[p->path + 1] == '/') {
+		p->path = find(s, p->path + 2, p->end, "/?");
+	}
+	p->query = find(s, p->path, p->end, "?");
+}
+
+/*
+Appends n bytes of s to the len bytes in out, leaving room for a NUL.
+
+@return:
+int, the new length, or -1 if len was -1 or s does not fit
+*/
+static int append(char* out, int len, int size, char* s, int n)
+{
+	if (len < 0 || len + n >= size) {
+		return -1;
+	}
+	memcpy(out + len, s, n);
+	return len + n;
+}
+
+/*
+Removes "." and ".." segments from the n byte path p in place, as RFC 3986
+section 5.2.4 does. ".." never climbs above the start of the path.
+
+@return:
+int, the new length
+*/
+static int remove_dots(char* p, int n)
+{
+	int root = n > 0 && p[0] == '/';
+	int r = root;
+	int w = root;
+
+	while (r <= n) {
+		int e = find(p, r, n, "/");
+		int len = e - r;
+		if (len == 1 && p[r] == '.') {
+			/* Nothing to write: what came before already ends in '/'. */
+		}
+		else if (len == 2 && p[r] == '.' && p[r + 1] == '.') {
+			if (w > root) {
+				w--;
+				while (w > root && p[w - 1] != '/') {
+					w--;
+				}
+			}
+		}
+		else {
+			memmove(p + w, p + r, len);
+			w += len;
+			if (e < n) {
+				p[w++] = '/';
+			}
+		}
+		r = e + 1;
+	}
+	return w;
+}
+
+/*
+Normalizes the len byte URL in out in place. Only an empty path after a
+host makes it longer, by one byte.
+
+@return:
+int, the new length, or -1 if it does not fit in size bytes
+*/
+static int clean(char* out, int len, int size)
+{
+	url_parts p;
+	int host;
+	int colon;
+	int i;
+	int n;
+
+	split(out, &p);
+	for (i = 0; i < p.scheme; i++) {
+		out[i] = tolower((unsigned char)out[i]);
+	}
+	if (p.path > p.scheme) {
+		host = p.scheme + 2;
+		for (i = host; i < p.path; i++) {
+			if (out[i] == '@') {
+				host = i + 1;
+			}
+		}
+		for (i = host; i < p.path; i++) {
+			out[i] = tolower((unsigned char)out[i]);
+		}
+		colon = p.path;
+		for (i = p.path - 1; i >= host && isdigit((unsigned char)out[i]); i--)
+			;
+		if (i >= host && out[i] == ':') {
+			colon = i;
+		}
+		if ((p.path - colon == 3 && p.scheme == 5 && strncmp(out, "http:", 5) == 0 &&
+		     strncmp(out + colon, ":80", 3) == 0) ||
+		    (p.path - colon == 4 && p.scheme == 6 && strncmp(out, "https:", 6) == 0 &&
+		     strncmp(out + colon, ":443", 4) == 0)) {
+			memmove(out + colon, out + p.path, len - p.path + 1);
+			len -= p.path - colon;
+			p.query -= p.path - colon;
+			p.path = colon;
+		}
+		if (p.query == p.path) {
+			if (len + 1 >= size) {
+				return -1;
+			}
+			memmove(out + p.path + 1, out + p.path, len - p.path + 1);
+			out[p.path] = '/';
+			len++;
+			p.query++;
+		}
+	}
+	n = remove_dots(out + p.path, p.query - p.path);
+	memmove(out + p.path + n, out + p.query, len - p.query + 1);
+	return len - (p.query - p.path - n);
+}
+
+/*
+Resolves link, found on the page base (NULL: link is already absolute),
+and normalizes the result into out, as described in urlnorm.h.
+
+@return:
+int, the length of the URL in out, or -1 if it needs more than size bytes
+*/
+int url_normalize(char* base, char* link, char* out, int size)
+{
+	url_parts b;
+	url_parts l;
+	int len = 0;
+	int dir;
+
+	/* The common case, a bare page name found on another: nothing to do. */
+	if (strpbrk(link, "./:?#") == NULL && (base == NULL || strchr(base, '/') == NULL)) {
+		len = append(out, len, size, link, strlen(link));
+		if (len >= 0) {
+			out[len] = '\0';
+		}
+		return len;
+	}
+	split(link, &l);
+	if (l.scheme > 0 || base == NULL) {
+		len = append(out, len, size, link, l.end);
+	}
+	else {
+		split(base, &b);
+		if (l.end >= 2 && link[0] == '/' && link[1] == '/') {
+			len = append(out, len, size, base, b.scheme);
+		}
+		else if (l.end >= 1 && link[0] == '/') {
+			len = append(out, len, size, base, b.path);
+		}
+		else if (l.end == 0) {
+			len = append(out, len, size, base, b.end);
+		}
+		else if (link[0] == '?') {
+			len = append(out, len, size, base, b.query);
+		}
+		else {
+			/* Merge: the base path up to its last '/', then link. */
+			for (dir = b.query; dir > b.path && base[dir - 1] != '/'; dir--)
+				;
+			len = append(out, len, size, base, dir);
+			if (dir == b.path && b.path > b.scheme) {
+				len = append(out, len, size, "/", 1);
+			}
+		}
+		len = append(out, len, size, link, l.end);
+	}
+	if (len < 0) {
+		return -1;
+	}
+	out[len] = '\0';
+	return clean(out, len, size);
+}
@@ -0,0 +1,25 @@
+#ifndef __URLNORM_H
+#define __URLNORM_H
+
+/*
+URL normalization, so that different spellings of one URL are fetched
+once. url_normalize resolves link against the URL of the page it was found
+on, as RFC 3986 section 5.2 does for a relative reference, then:
+
+  - drops the fragment
+  - lowercases the scheme and the host
+  - drops the port when it is the scheme's default (http 80, https 443)
+  - gives an empty path after a host "/"
+  - removes "." and ".." path segments
+
+Page names without a scheme, such as the crawler's file names, resolve
+like paths: "./pageb" and "pageb#x" found on "pagea" are both "pageb",
+and "../pageb" found on "dir/pagea" is "pageb" too.
+
+It works in the caller's buffer and never allocates.
+*/
+#define URLNORM_MAX 2048
+
+int url_normalize(char* base, char* link, char* out, int size);
+
+#endif
@@ -0,0 +1,607 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "visited.h"
+
+/* Rough resident cost of one hot key: bucket, string and malloc headers. */
+#define VISITED_KEY_OVERHEAD (sizeof(bucket) + 32)
+
+typedef struct {
+	FILE* file;
+	visited_run* run;
+	uint64_t off;
+	uint64_t* fences;
+	uint64_t cap;
+} run_writer;
+
+static hashtable* visited_hot_new(visited_store* store)
+{
+	hashtable* tbl = malloc(sizeof(hashtable));
+	long size = store->max_resident / 2 / 128;
+	if (size < 1024) {
+		size = 1024;
+	}
+	hash_init(tbl, (int)size);
+	return tbl;
+}
+
+/*
+Compares the key of the record at off in run against link using the same
+order as strcmp, so tables sorted with strcmp can be searched here.
+*/
+static int run_cmp(visited_run* run, uint64_t off, char* link, size_t len)
+{
+	uint32_t rlen;
+	int c;
+	memcpy(&rlen, run->map + off, sizeof(rlen));
+	c = memcmp(run->map + off + sizeof(rlen), link, rlen < len ? rlen : len);
+	if (c != 0) {
+		return c;
+	}
+	return (rlen > len) - (rlen < len);
+}
+
+static uint64_t run_next(visited_run* run, uint64_t off)
+{
+	uint32_t rlen;
+	memcpy(&rlen, run->map + off, sizeof(rlen));
+	return off + sizeof(rlen) + rlen;
+}
+
+/*
+Searches one run. Binary search over the fence pointers picks the block the
+key must be in, then at most VISITED_FENCE_EVERY records are scanned.
+
+@return:
+int, 1 if link is in run, 0 otherwise
+*/
+static int run_find(visited_run* run, char* link)
+{
+	size_t len = strlen(link);
+	uint64_t lo = 0;
+	uint64_t hi = run->nfences;
+	uint64_t off;
+	uint64_t end;
+	int i;
+
+	if (run->nkeys == 0) {
+		return 0;
+	}
+	while (hi - lo > 1) {
+		uint64_t mid = lo + (hi - lo) / 2;
+		if (run_cmp(run, run->fences[mid], link, len) <= 0) {
+			lo = mid;
+		} else {
+			hi = mid;
+		}
+	}
+	off = run->fences[lo];
+	end = (uint64_t)((char*)run->fences - run->map);
+	for (i = 0; i < VISITED_FENCE_EVERY && off < end; i++) {
+		int c = run_cmp(run, off, link, len);
+		if (c == 0) {
+			return 1;
+		}
+		if (c > 0) {
+			return 0;
+		}
+		off = run_next(run, off);
+	}
+	return 0;
+}
+
+static void run_path(visited_store* store, int id, char* buf, size_t size)
+{
+	snprintf(buf, size, "%s/visited-%06d.run", store->dir, id);
+}
+
+/*
+Maps a finished run file read-only and points its fence array at the
+fences stored in the file.
+
+@return:
+visited_run*, the opened run, or NULL on failure
+*/
+static visited_run* run_open(visited_store* store, int id)
+{
+	char path[4096];
+	struct stat st;
+	visited_footer footer;
+	visited_run* run;
+	int fd;
+
+	run_path(store, id, path, sizeof(path));
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		perror("visited: open run");
+		return NULL;
+	}
+	if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(footer)) {
+		fprintf(stderr, "visited: bad run %s\n", path);
+		close(fd);
+		return NULL;
+	}
+	run = malloc(sizeof(visited_run));
+	run->path = strdup(path);
+	run->id = id;
+	run->size = st.st_size;
+	run->map = mmap(NULL, run->size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (run->map == MAP_FAILED) {
+		perror("visited: mmap run");
+		free(run->path);
+		free(run);
+		return NULL;
+	}
+	memcpy(&footer, run->map + run->size - sizeof(footer), sizeof(footer));
+	if (footer.magic != VISITED_MAGIC) {
+		fprintf(stderr, "visited: bad magic in %s\n", path);
+		munmap(run->map, run->size);
+		free(run->path);
+		free(run);
+		return NULL;
+	}
+	run->nkeys = footer.nkeys;
+	run->nfences = footer.nfences;
+	run->fences = (uint64_t*)(run->map + footer.fence_off);
+	madvise(run->map, footer.fence_off, MADV_RANDOM);
+	return run;
+}
+
+static void run_close(visited_run* run, int remove)
+{
+	munmap(run->map, run->size);
+	if (remove) {
+		unlink(run->path);
+	}
+	free(run->path);
+	free(run);
+}
+
+static int run_writer_open(visited_store* store, run_writer* w, int id)
+{
+	char path[4096];
+	run_path(store, id, path, sizeof(path));
+	w->file = fopen(path, "w");
+	if (w->file == NULL) {
+		perror("visited: create run");
+		return -1;
+	}
+	w->off = 0;
+	w->cap = 64;
+	w->fences = malloc(sizeof(uint64_t) * w->cap);
+	w->run = malloc(sizeof(visited_run));
+	w->run->id = id;
+	w->run->nkeys = 0;
+	w->run->nfences = 0;
+	return 0;
+}
+
+static void run_writer_add(run_writer* w, char* key, uint32_t len)
+{
+	if (w->run->nkeys % VISITED_FENCE_EVERY == 0) {
+		if (w->run->nfences == w->cap) {
+			w->cap *= 2;
+			w->fences = realloc(w->fences, sizeof(uint64_t) * w->cap);
+		}
+		w->fences[w->run->nfences++] = w->off;
+	}
+	fwrite(&len, sizeof(len), 1, w->file);
+	fwrite(key, 1, len, w->file);
+	w->off += sizeof(len) + len;
+	w->run->nkeys++;
+}
+
+/*
+Appends the fences and footer, closes the file and maps it back in.
+
+@return:
+visited_run*, the finished run, or NULL on failure
+*/
+static visited_run* run_writer_finish(visited_store* store, run_writer* w)
+{
+	visited_footer footer;
+	int id = w->run->id;
+	int failed;
+
+	footer.magic = VISITED_MAGIC;
+	footer.nkeys = w->run->nkeys;
+	footer.nfences = w->run->nfences;
+	footer.fence_off = w->off;
+	fwrite(w->fences, sizeof(uint64_t), w->run->nfences, w->file);
+	fwrite(&footer, sizeof(footer), 1, w->file);
+	failed = ferror(w->file);
+	if (fclose(w->file) != 0) {
+		failed = 1;
+	}
+	free(w->fences);
+	free(w->run);
+	if (failed) {
+		fprintf(stderr, "visited: failed to write run %d\n", id);
+		return NULL;
+	}
+	return run_open(store, id);
+}
+
+static int key_cmp(const void* a, const void* b)
+{
+	return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+/*
+Sorts every key of a frozen hot table and writes them out as a new run.
+*/
+static visited_run* run_write_table(visited_store* store, hashtable* tbl, int id)
+{
+	run_writer w;
+	char** keys;
+	long n = 0;
+	long i;
+	int b;
+
+	for (b = 0; b < tbl->max; b++) {
+		bucket* copy;
+		for (copy = tbl->table[b]; copy != NULL; copy = copy->next) {
+			n++;
+		}
+	}
+	keys = malloc(sizeof(char*) * (n ? n : 1));
+	n = 0;
+	for (b = 0; b < tbl->max; b++) {
+		bucket* copy;
+		for (copy = tbl->table[b]; copy != NULL; copy = copy->next) {
+			keys[n++] = copy->link;
+		}
+	}
+	qsort(keys, n, sizeof(char*), key_cmp);
+
+	if (run_writer_open(store, &w, id) < 0) {
+		free(keys);
+		return NULL;
+	}
+	for (i = 0; i < n; i++) {
+		run_writer_add(&w, keys[i], (uint32_t)strlen(keys[i]));
+	}
+	free(keys);
+	return run_writer_finish(store, &w);
+}
+
+/*
+Merges two runs into a new one. Runs are immutable, so this runs without
+the store lock; only the swap of the run list needs it.
+*/
+static visited_run* run_merge(visited_store* store, visited_run* a, visited_run* b, int id)
+{
+	run_writer w;
+	uint64_t aoff = 0;
+	uint64_t boff = 0;
+	uint64_t aend = (uint64_t)((char*)a->fences - a->map);
+	uint64_t bend = (uint64_t)((char*)b->fences - b->map);
+	uint32_t alen;
+	uint32_t blen;
+
+	if (run_writer_open(store, &w, id) < 0) {
+		return NULL;
+	}
+	madvise(a->map, aend, MADV_SEQUENTIAL);
+	madvise(b->map, bend, MADV_SEQUENTIAL);
+	while (aoff < aend || boff < bend) {
+		int c;
+		if (aoff >= aend) {
+			c = 1;
+		} else if (boff >= bend) {
+			c = -1;
+		} else {
+			memcpy(&blen, b->map + boff, sizeof(blen));
+			c = run_cmp(a, aoff, b->map + boff + sizeof(blen), blen);
+		}
+		if (c <= 0) {
+			memcpy(&alen, a->map + aoff, sizeof(alen));
+			run_writer_add(&w, a->map + aoff + sizeof(alen), alen);
+			aoff = run_next(a, aoff);
+			if (c == 0) {
+				boff = run_next(b, boff);
+			}
+		} else {
+			memcpy(&blen, b->map + boff, sizeof(blen));
+			run_writer_add(&w, b->map + boff + sizeof(blen), blen);
+			boff = run_next(b, boff);
+		}
+	}
+	return run_writer_finish(store, &w);
+}
+
+/*
+Background thread. Writes frozen hot tables out as runs and merges the two
+newest runs whenever the older one is no more than VISITED_MERGE_RATIO
+times the size of the newer one.
+*/
+static void* visited_worker(void* arg)
+{
+	visited_store* store = arg;
+
+	LOCKPROF_LOCK(store->prof, store->lock);
+	while (!store->stop) {
+		if (store->frozen != NULL) {
+			hashtable* tbl = store->frozen;
+			int id = store->next_id++;
+			visited_run* run;
+
+			LOCKPROF_UNLOCK(store->prof, store->lock);
+			run = run_write_table(store, tbl, id);
+			if (run == NULL) {
+				fprintf(stderr, "visited: cannot spill visited set, giving up\n");
+				exit(1);
+			}
+			LOCKPROF_LOCK(store->prof, store->lock);
+			pthread_rwlock_wrlock(store->tiers);
+			store->runs = realloc(store->runs, sizeof(visited_run*) * (store->nruns + 1));
+			store->runs[store->nruns++] = run;
+			store->frozen = NULL;
+			pthread_rwlock_unlock(store->tiers);
+			store->flushes++;
+			pthread_cond_broadcast(store->done);
+			LOCKPROF_UNLOCK(store->prof, store->lock);
+			/* No reader can still be in it: they all let go of tiers first. */
+			hash_free(tbl);
+			free(tbl);
+			LOCKPROF_LOCK(store->prof, store->lock);
+		} else if (store->nruns >= 2 &&
+			   store->runs[store->nruns - 2]->nkeys <=
+			   VISITED_MERGE_RATIO * store->runs[store->nruns - 1]->nkeys) {
+			int n = store->nruns;
+			visited_run* a = store->runs[n - 2];
+			visited_run* b = store->runs[n - 1];
+			int id = store->next_id++;
+			visited_run* merged;
+			int i;
+
+			LOCKPROF_UNLOCK(store->prof, store->lock);
+			merged = run_merge(store, a, b, id);
+			if (merged == NULL) {
+				fprintf(stderr, "visited: cannot merge runs, giving up\n");
+				exit(1);
+			}
+			LOCKPROF_LOCK(store->prof, store->lock);
+			pthread_rwlock_wrlock(store->tiers);
+			/* Only this thread changes the run list, and only by appending. */
+			store->runs[n - 2] = merged;
+			for (i = n - 1; i < store->nruns - 1; i++) {
+				store->runs[i] = store->runs[i + 1];
+			}
+			store->nruns--;
+			pthread_rwlock_unlock(store->tiers);
+			store->merges++;
+			LOCKPROF_UNLOCK(store->prof, store->lock);
+			run_close(a, 1);
+			run_close(b, 1);
+			LOCKPROF_LOCK(store->prof, store->lock);
+		} else {
+			LOCKPROF_WAIT_BEGIN(store->prof);
+			pthread_cond_wait(store->work, store->lock);
+			LOCKPROF_WAIT_END(store->prof);
+		}
+	}
+	LOCKPROF_UNLOCK(store->prof, store->lock);
+	return NULL;
+}
+
+/*
+Deletes the run files an earlier crawl left in dir. Runs only mean
+something to the store that wrote them, and ids start again at 0.
+*/
+static void remove_stale_runs(char* dir)
+{
+	char path[4096];
+	struct dirent* ent;
+	DIR* d = opendir(dir);
+	int id;
+	char end;
+
+	if (d == NULL) {
+		return;
+	}
+	while ((ent = readdir(d)) != NULL) {
+		if (sscanf(ent->d_name, "visited-%d.ru%c", &id, &end) == 2 && end == 'n') {
+			snprintf(path, sizeof(path), "%s/%s", dir, ent->d_name);
+			unlink(path);
+		}
+	}
+	closedir(d);
+}
+
+/*
+Initializes store to keep its runs in dir and at most max_resident bytes of
+keys in memory (hot plus frozen tier). Runs left in dir by an earlier crawl
+are deleted. If filter is not NULL it is used to skip the run search for
+links that are certainly new and must be sized for the whole crawl.
+
+@return:
+int, 0 on success, -1 if dir cannot be used
+*/
+int visited_store_init(visited_store* store, char* dir, long max_resident, bloom_filter* filter)
+{
+	pthread_rwlockattr_t attr;
+
+	if (mkdir(dir, 0755) < 0 && errno != EEXIST) {
+		perror("visited: mkdir");
+		return -1;
+	}
+	remove_stale_runs(dir);
+	store->dir = strdup(dir);
+	store->max_resident = max_resident;
+	store->hot = visited_hot_new(store);
+	store->hot_bytes = 0;
+	store->nkeys = 0;
+	store->frozen = NULL;
+	store->runs = NULL;
+	store->nruns = 0;
+	store->next_id = 0;
+	store->generation = 0;
+	store->run_lookups = 0;
+	store->flushes = 0;
+	store->merges = 0;
+	store->filter = filter;
+	store->stop = 0;
+	store->lock = malloc(sizeof(pthread_mutex_t));
+	pthread_mutex_init(store->lock, NULL);
+	store->prof = NULL;
+	/* Lookups hold it all the time; the worker must still get its turn. */
+	store->tiers = malloc(sizeof(pthread_rwlock_t));
+	pthread_rwlockattr_init(&attr);
+	pthread_rwlockattr_setkind_np(&attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+	pthread_rwlock_init(store->tiers, &attr);
+	pthread_rwlockattr_destroy(&attr);
+	store->work = malloc(sizeof(pthread_cond_t));
+	pthread_cond_init(store->work, NULL);
+	store->done = malloc(sizeof(pthread_cond_t));
+	pthread_cond_init(store->done, NULL);
+	pthread_create(&store->worker, NULL, visited_worker, store);
+	return 0;
+}
+
+/*
+Stops and joins the background thread, then deletes the runs and frees
+everything. No lookup may be running.
+*/
+void visited_store_free(visited_store* store)
+{
+	int i;
+
+	LOCKPROF_LOCK(store->prof, store->lock);
+	store->stop = 1;
+	pthread_cond_signal(store->work);
+	LOCKPROF_UNLOCK(store->prof, store->lock);
+	pthread_join(store->worker, NULL);
+	for (i = 0; i < store->nruns; i++) {
+		run_close(store->runs[i], 1);
+	}
+	free(store->runs);
+	if (store->frozen != NULL) {
+		hash_free(store->frozen);
+		free(store->frozen);
+	}
+	hash_free(store->hot);
+	free(store->hot);
+	free(store->dir);
+	pthread_mutex_destroy(store->lock);
+	free(store->lock);
+	pthread_rwlock_destroy(store->tiers);
+	free(store->tiers);
+	pthread_cond_destroy(store->work);
+	free(store->work);
+	pthread_cond_destroy(store->done);
+	free(store->done);
+}
+
+static int runs_find(visited_store* store, char* link)
+{
+	int i;
+
+	for (i = store->nruns - 1; i >= 0; i--) {
+		__atomic_fetch_add(&store->run_lookups, 1, __ATOMIC_RELAXED);
+		if (run_find(store->runs[i], link)) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/*
+Same contract as hash_find_insert, but the set may live mostly on disk.
+Does its own locking.
+
+Lookups only take tiers for reading: the hot table can be searched while
+an insert goes on (see hash_find), and runs never change once written.
+tiers only keeps the worker from freeing a table or a run under them.
+store->lock is only taken to insert, for new links and Bloom false
+positives. A link inserted since the tiers were searched is in the hot
+table, unless that was frozen in the meantime, which bumps the generation;
+only then are the runs searched again. The same goes for a Bloom negative,
+which means the link cannot be in any run if the generation still holds.
+
+@return:
+int, 1 if link was already in the set, 0 if this call inserted it
+*/
+int visited_find_insert(visited_store* store, char* link)
+{
+	unsigned long gen = __atomic_load_n(&store->generation, __ATOMIC_ACQUIRE);
+	uint64_t h = 0;
+	int maybe = 1;
+	int found;
+
+	if (store->filter != NULL) {
+		h = bloom_hash(link);
+		maybe = bloom_query(store->filter, h);
+	}
+	if (maybe) {
+		pthread_rwlock_rdlock(store->tiers);
+		found = hash_find(store->hot, link) ||
+			(store->frozen != NULL && hash_find(store->frozen, link)) ||
+			runs_find(store, link);
+		pthread_rwlock_unlock(store->tiers);
+		if (found) {
+			if (store->filter != NULL) {
+				__atomic_fetch_add(&store->filter->hits, 1, __ATOMIC_RELAXED);
+			}
+			return 1;
+		}
+	}
+
+	LOCKPROF_LOCK(store->prof, store->lock);
+	found = hash_find(store->hot, link) ||
+		(store->frozen != NULL && hash_find(store->frozen, link)) ||
+		(gen != store->generation && runs_find(store, link));
+	if (store->filter != NULL && maybe) {
+		if (found) {
+			__atomic_fetch_add(&store->filter->hits, 1, __ATOMIC_RELAXED);
+		} else {
+			__atomic_fetch_add(&store->filter->false_positives, 1, __ATOMIC_RELAXED);
+		}
+	}
+	if (!found) {
+		hash_find_insert(store->hot, link);
+		store->hot_bytes += strlen(link) + 1 + VISITED_KEY_OVERHEAD;
+		store->nkeys++;
+		if (store->filter != NULL) {
+			bloom_add(store->filter, h);
+		}
+		if (store->hot_bytes > store->max_resident / 2) {
+			/* Backpressure: at most one frozen table may be waiting. */
+			while (store->frozen != NULL) {
+				LOCKPROF_WAIT_BEGIN(store->prof);
+				pthread_cond_wait(store->done, store->lock);
+				LOCKPROF_WAIT_END(store->prof);
+			}
+			if (store->hot_bytes > store->max_resident / 2) {
+				pthread_rwlock_wrlock(store->tiers);
+				store->frozen = store->hot;
+				store->hot = visited_hot_new(store);
+				pthread_rwlock_unlock(store->tiers);
+				store->hot_bytes = 0;
+				__atomic_store_n(&store->generation, store->generation + 1, __ATOMIC_RELEASE);
+				pthread_cond_signal(store->work);
+			}
+		}
+	}
+	LOCKPROF_UNLOCK(store->prof, store->lock);
+	return found;
+}
+
+long visited_store_keys(visited_store* store)
+{
+	long n;
+	LOCKPROF_LOCK(store->prof, store->lock);
+	n = store->nkeys;
+	LOCKPROF_UNLOCK(store->prof, store->lock);
+	return n;
+}
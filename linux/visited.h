@@ -0,0 +1,85 @@
+#ifndef __VISITED_H
+#define __VISITED_H
+
+#include <stdint.h>
+#include <pthread.h>
+#include "hashtable.h"
+#include "bloom.h"
+#include "lockprof.h"
+
+/*
+Out-of-core visited set. New links go into an in-memory hot hashtable; once
+it outgrows half of the resident budget it is frozen and a background thread
+writes it out as a sorted run file. Runs are mmap'd read-only and searched
+through fence pointers (the offset of every VISITED_FENCE_EVERY-th key,
+stored at the end of the run). The background thread also merges runs of
+similar size so a lookup only ever touches a logarithmic number of them.
+
+lock serializes inserts and the hand-offs to the background thread. tiers
+is a reader-writer lock over which tables and runs the set is made of:
+lookups hold it for reading, and changing hot, frozen or the run list
+takes it for writing, so nothing is freed while a lookup is looking at it.
+prof, NULL after visited_store_init, is where lock is profiled.
+
+Run file layout:
+  records:  uint32 length, key bytes   (sorted, no terminator)
+  fences:   uint64 offset per VISITED_FENCE_EVERY records
+  footer:   visited_footer
+*/
+#define VISITED_FENCE_EVERY 64
+#define VISITED_MERGE_RATIO 2
+#define VISITED_MAGIC 0x5649534954454431ULL
+
+struct visited_run;
+struct visited_store;
+
+typedef struct visited_run visited_run;
+typedef struct visited_store visited_store;
+
+typedef struct {
+	uint64_t magic;
+	uint64_t nkeys;
+	uint64_t nfences;
+	uint64_t fence_off;
+} visited_footer;
+
+struct visited_run {
+	char* path;
+	int id;
+	char* map;
+	size_t size;
+	uint64_t nkeys;
+	uint64_t nfences;
+	uint64_t* fences;
+};
+
+struct visited_store {
+	char* dir;
+	long max_resident;
+	hashtable* hot;
+	long hot_bytes;
+	long nkeys;
+	hashtable* frozen;
+	visited_run** runs;
+	int nruns;
+	int next_id;
+	unsigned long generation;
+	unsigned long run_lookups;
+	unsigned long flushes;
+	unsigned long merges;
+	bloom_filter* filter;
+	int stop;
+	pthread_t worker;
+	pthread_mutex_t* lock;
+	lockprof* prof;
+	pthread_rwlock_t* tiers;
+	pthread_cond_t* work;
+	pthread_cond_t* done;
+};
+
+int visited_store_init(visited_store* store, char* dir, long max_resident, bloom_filter* filter);
+void visited_store_free(visited_store* store);
+int visited_find_insert(visited_store* store, char* link);
+long visited_store_keys(visited_store* store);
+
+#endif
@@ -0,0 +1,116 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include "wake.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define cpu_relax() __asm__ __volatile__("pause" ::: "memory")
+#elif defined(__aarch64__)
+#define cpu_relax() __asm__ __volatile__("yield" ::: "memory")
+#else
+#define cpu_relax() __asm__ __volatile__("" ::: "memory")
+#endif
+
+void waitq_init(waitq* q)
+{
+	memset(q, 0, sizeof(*q));
+	pthread_cond_init(&q->cond, NULL);
+}
+
+/*
+Waits for a wake on q. Called with mutex held, in a loop that rechecks the
+condition, since it may return without the condition being true: after a
+spin that saw a wake meant for somebody else, or spuriously.
+
+@params:
+int spin, how many times to poll seq with the mutex dropped before parking
+*/
+void waitq_wait(waitq* q, pthread_mutex_t* mutex, int spin)
+{
+	unsigned long seq = q->seq;
+	int i;
+
+	if (spin > 0) {
+		pthread_mutex_unlock(mutex);
+		for (i = 0; i < spin && __atomic_load_n(&q->seq, __ATOMIC_ACQUIRE) == seq; i++) {
+			cpu_relax();
+		}
+		pthread_mutex_lock(mutex);
+		if (q->seq != seq) {
+			q->spin_wakes++;
+			return;
+		}
+	}
+	/* Wakers take their count back off waiters, see waitq_wake. */
+	q->waiters++;
+	q->parks++;
+	pthread_cond_wait(&q->cond, mutex);
+}
+
+/*
+Like waitq_wait, but gives up at deadline (CLOCK_REALTIME). A waiter that
+times out takes itself back off waiters unless a wake came in meanwhile,
+which may have done that for it; at worst a later wake then signals one
+thread too many, never one too few.
+
+@return:
+int, 1 if it timed out, 0 otherwise
+*/
+int waitq_timedwait(waitq* q, pthread_mutex_t* mutex, int spin, struct timespec* deadline)
+{
+	unsigned long seq = q->seq;
+	int i;
+
+	if (spin > 0) {
+		pthread_mutex_unlock(mutex);
+		for (i = 0; i < spin && __atomic_load_n(&q->seq, __ATOMIC_ACQUIRE) == seq; i++) {
+			cpu_relax();
+		}
+		pthread_mutex_lock(mutex);
+		if (q->seq != seq) {
+			q->spin_wakes++;
+			return 0;
+		}
+	}
+	q->waiters++;
+	q->parks++;
+	if (pthread_cond_timedwait(&q->cond, mutex, deadline) == ETIMEDOUT) {
+		if (q->seq == seq && q->waiters > 0) {
+			q->waiters--;
+		}
+		return 1;
+	}
+	return 0;
+}
+
+/*
+Makes n units of work visible: spinners see seq move, and up to n parked
+threads are signalled. Each signal takes its thread off waiters right away,
+so a second wake before the first thread runs goes to somebody else or to
+nobody. Called with the mutex held.
+*/
+void waitq_wake(waitq* q, int n)
+{
+	__atomic_store_n(&q->seq, q->seq + 1, __ATOMIC_RELEASE);
+	while (n > 0 && q->waiters > 0) {
+		q->waiters--;
+		q->signals++;
+		pthread_cond_signal(&q->cond);
+		n--;
+	}
+}
+
+/*
+Wakes every parked thread, for state changes that any of them might care
+about. Called with the mutex held.
+*/
+void waitq_wake_all(waitq* q)
+{
+	__atomic_store_n(&q->seq, q->seq + 1, __ATOMIC_RELEASE);
+	if (q->waiters > 0) {
+		q->waiters = 0;
+		q->signals++;
+		pthread_cond_broadcast(&q->cond);
+	}
+}
@@ -0,0 +1,35 @@
+#ifndef __WAKE_H
+#define __WAKE_H
+
+#include <pthread.h>
+
+/*
+Wait queues for the crawler's queue conditions. A waitq is a condition
+variable that knows how many threads are parked on it, so waking is free
+when nobody waits: a waker signals at most as many threads as it has work
+for, and only threads that are actually parked. Before parking, a waiter
+drops the mutex and spins for a while watching seq, which every wake bumps,
+so short waits never reach the kernel.
+
+All fields except seq are protected by the mutex the waitq is used with.
+*/
+#define WAKE_DEFAULT_SPIN 200
+
+typedef struct waitq waitq;
+
+struct waitq {
+	pthread_cond_t cond;
+	int waiters;
+	unsigned long seq;
+	unsigned long parks;
+	unsigned long spin_wakes;
+	unsigned long signals;
+};
+
+void waitq_init(waitq* q);
+void waitq_wait(waitq* q, pthread_mutex_t* mutex, int spin);
+int waitq_timedwait(waitq* q, pthread_mutex_t* mutex, int spin, struct timespec* deadline);
+void waitq_wake(waitq* q, int n);
+void waitq_wake_all(waitq* q);
+
+#endif
@@ -0,0 +1,283 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <time.h>
+#include <netinet/tcp.h>
+#include "cs537.h"
+#include "memfetch.h"
+
+/*
+Local HTTP/1.1 stand-in for pages.cs.wisc.edu, so web_tester can be run
+and load tested offline. Serves a generated page corpus from memory: a
+request for any path ending in /pN (or just pN) gets page N. Connections
+are kept alive unless the client asks otherwise. Every accepting thread
+serves one connection at a time, so -t bounds the concurrent connections.
+
+usage: web_server [-p port] [-t threads] [-n pages] [-s page_bytes]
+                  [-l latency] [-e error_rate] [-x drop_rate] [-c chunk_bytes]
+                  [-v revision] [-u revised_fraction] [-E] [-H]
+
+-l delays every response (see memfetch.h for the spec), -e answers that
+fraction of requests with a 500, -x closes that fraction of connections
+without answering, and -c sends bodies chunked in pieces of chunk_bytes
+instead of with a Content-Length.
+
+Pages carry an ETag (a hash of the body) and a Last-Modified date, and
+conditional GETs that still match get a 304. To stand in for the site
+changing between crawls, -v and -u revise a fraction of the pages: which
+ones depends on the revision number (the server prints how many), and a
+revised page gets a line naming its revision and a Last-Modified that many
+days later. -E leaves the validators out, so every page is sent in full.
+-H serves the pages as HTML (see webgraph.h).
+*/
+
+int listenfd;
+double error_rate = 0;
+double drop_rate = 0;
+int chunk_bytes = 0;
+int revision = 0;
+double revised_fraction = 0;
+int validators = 1;
+
+__thread unsigned int seed;
+
+double coin() {
+  return rand_r(&seed) / (RAND_MAX + 1.0);
+}
+
+/*
+Writes a full response, with the extra header lines in headers. Returns -1
+once the client is gone.
+*/
+int respond(int fd, int status, char *reason, char *headers, char *body, long length, int keep) {
+  char buf[MAXLINE];
+  int n;
+  long pos;
+
+  n = snprintf(buf, MAXLINE, "HTTP/1.1 %d %s\r\nServer: web_server\r\n"
+	       "Content-Type: text/plain\r\nConnection: %s\r\n%s",
+	       status, reason, keep ? "keep-alive" : "close", headers);
+  if (chunk_bytes > 0 && length > 0) {
+    n += snprintf(buf + n, MAXLINE - n, "Transfer-Encoding: chunked\r\n\r\n");
+    if (rio_writen(fd, buf, n) < 0)
+      return -1;
+    for (pos = 0; pos < length; pos += chunk_bytes) {
+      long len = length - pos < chunk_bytes ? length - pos : chunk_bytes;
+      n = snprintf(buf, MAXLINE, "%lx\r\n", len);
+      if (rio_writen(fd, buf, n) < 0 || rio_writen(fd, body + pos, len) < 0 ||
+	  rio_writen(fd, "\r\n", 2) < 0)
+	return -1;
+    }
+    return rio_writen(fd, "0\r\n\r\n", 5) < 0 ? -1 : 0;
+  }
+  n += snprintf(buf + n, MAXLINE - n, "Content-Length: %ld\r\n\r\n", length);
+  if (rio_writen(fd, buf, n) < 0)
+    return -1;
+  return rio_writen(fd, body, length) < 0 ? -1 : 0;
+}
+
+/*
+Copies a header's value, without the surrounding white space, into out.
+*/
+void header_value(char *value, char *out) {
+  int n;
+  value += strspn(value, " \t");
+  n = strcspn(value, "\r\n");
+  while (n > 0 && (value[n - 1] == ' ' || value[n - 1] == '\t'))
+    n--;
+  memcpy(out, value, n);
+  out[n] = '\0';
+}
+
+/*
+Whether page i is revised in this revision; a fixed pseudo-random choice
+of revised_fraction of the pages.
+*/
+int revised(long i) {
+  uint64_t z = (uint64_t)(i + 1) * 0x9e3779b97f4a7c15ULL ^ (uint64_t)revision * 0xbf58476d1ce4e5b9ULL;
+  if (revision == 0 || revised_fraction <= 0)
+    return 0;
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+  z ^= z >> 31;
+  return (z >> 11) / 9007199254740992.0 < revised_fraction;
+}
+
+/*
+Fills in the validators of a page (64 bytes each): a quoted FNV-1a hash of
+the body, and a fixed date, a day later per revision for revised pages.
+*/
+void page_validators(char *page, long length, int rev, char *etag, char *modified) {
+  uint64_t h = 0xcbf29ce484222325ULL;
+  time_t t = 1700000000 + (time_t)rev * 86400;
+  struct tm tm;
+  long k;
+  for (k = 0; k < length; k++)
+    h = (h ^ (unsigned char)page[k]) * 0x100000001b3ULL;
+  sprintf(etag, "\"%016lx\"", (unsigned long)h);
+  gmtime_r(&t, &tm);
+  strftime(modified, 64, "%a, %d %b %Y %H:%M:%S GMT", &tm);
+}
+
+/*
+Serves requests on one connection until the client closes it, asks for
+close, or a drop is injected.
+*/
+void serve(int fd) {
+  rio_t rio;
+  char line[MAXLINE];
+  char method[MAXLINE], path[MAXLINE], version[MAXLINE];
+  char if_none_match[MAXLINE], if_modified_since[MAXLINE];
+  char etag[64], modified[64], headers[MAXLINE];
+  int keep = 1;
+
+  rio_readinitb(&rio, fd);
+  while (keep) {
+    if (rio_readlineb(&rio, line, MAXLINE) <= 0)
+      return;
+    if (sscanf(line, "%s %s %s", method, path, version) != 3) {
+      respond(fd, 400, "Bad Request", "", "", 0, 0);
+      return;
+    }
+    keep = strcasecmp(version, "HTTP/1.0") != 0;
+    if_none_match[0] = '\0';
+    if_modified_since[0] = '\0';
+    /* Headers end at an empty line; accept bare \n line ends too. */
+    while (rio_readlineb(&rio, line, MAXLINE) > 0 && strcmp(line, "\r\n") && strcmp(line, "\n")) {
+      if (strncasecmp(line, "Connection:", 11) == 0) {
+	if (strcasestr(line + 11, "close"))
+	  keep = 0;
+	else if (strcasestr(line + 11, "keep-alive"))
+	  keep = 1;
+      } else if (strncasecmp(line, "If-None-Match:", 14) == 0) {
+	header_value(line + 14, if_none_match);
+      } else if (strncasecmp(line, "If-Modified-Since:", 18) == 0) {
+	header_value(line + 18, if_modified_since);
+      }
+    }
+
+    if (drop_rate > 0 && coin() < drop_rate)
+      return;
+    if (strcasecmp(method, "GET") != 0) {
+      respond(fd, 501, "Not Implemented", "", "", 0, 0);
+      return;
+    }
+    char *name = strrchr(path, '/');
+    name = name ? name + 1 : path;
+    char *page = memfetch_fetch(name);
+    long length = 0;
+    int rc;
+    headers[0] = '\0';
+    if (page != NULL) {
+      int rev = revised(webgraph_index(name)) ? revision : 0;
+      length = strlen(page);
+      if (rev) {
+	page = realloc(page, length + 32);
+	length += sprintf(page + length, "revised in %d\n", rev);
+      }
+      page_validators(page, length, rev, etag, modified);
+      if (validators)
+	snprintf(headers, MAXLINE, "ETag: %s\r\nLast-Modified: %s\r\n", etag, modified);
+    }
+    if (error_rate > 0 && coin() < error_rate)
+      rc = respond(fd, 500, "Internal Server Error", "", "", 0, keep);
+    else if (page == NULL)
+      rc = respond(fd, 404, "Not Found", "", "", 0, keep);
+    else if (validators && (if_none_match[0] ? strcmp(if_none_match, etag) == 0 :
+			    strcmp(if_modified_since, modified) == 0))
+      rc = respond(fd, 304, "Not Modified", headers, "", 0, keep);
+    else
+      rc = respond(fd, 200, "OK", headers, page, length, keep);
+    free(page);
+    if (rc < 0)
+      return;
+  }
+}
+
+void *acceptor(void *arg) {
+  seed = (unsigned int)(long)arg * 2654435761u + 1;
+  while (1) {
+    struct sockaddr_in addr;
+    socklen_t len = sizeof(addr);
+    int fd = accept(listenfd, (SA *)&addr, &len);
+    if (fd < 0) {
+      if (errno == EINTR || errno == ECONNABORTED || errno == EMFILE)
+	continue;
+      unix_error("accept");
+    }
+    /* Headers, chunks and bodies go out in separate writes; don't let Nagle hold them back. */
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    serve(fd);
+    close(fd);
+  }
+  return NULL;
+}
+
+int main(int argc, char *argv[]) {
+  int port = 8080, threads = 128;
+  webgraph_params params;
+  memfetch_latency latency;
+  int c;
+  long i;
+
+  webgraph_defaults(&params);
+  memfetch_parse_latency("none", &latency);
+  while ((c = getopt(argc, argv, "p:t:n:s:l:e:x:c:v:u:EH")) != -1) {
+    switch (c) {
+    case 'p': port = atoi(optarg); break;
+    case 't': threads = atoi(optarg); break;
+    case 'n': params.pages = atol(optarg); break;
+    case 's': params.page_bytes = atol(optarg); break;
+    case 'l':
+      if (memfetch_parse_latency(optarg, &latency) < 0) {
+	fprintf(stderr, "bad latency %s\n", optarg);
+	return 1;
+      }
+      break;
+    case 'e': error_rate = atof(optarg); break;
+    case 'x': drop_rate = atof(optarg); break;
+    case 'c': chunk_bytes = atoi(optarg); break;
+    case 'v': revision = atoi(optarg); break;
+    case 'u': revised_fraction = atof(optarg); break;
+    case 'E': validators = 0; break;
+    case 'H': params.html = 1; break;
+    default:
+      fprintf(stderr, "usage: %s [-p port] [-t threads] [-n pages] [-s page_bytes]\n"
+	      "       [-l latency] [-e error_rate] [-x drop_rate] [-c chunk_bytes]\n"
+	      "       [-v revision] [-u revised_fraction] [-E] [-H]\n", argv[0]);
+      return 1;
+    }
+  }
+  assert(threads > 0 && params.pages > 0);
+
+  signal(SIGPIPE, SIG_IGN);
+  if (memfetch_init(&params, &latency) < 0)
+    app_error("cannot generate the pages");
+  listenfd = Open_listenfd(port);
+  fprintf(stderr, "serving p0 .. p%ld on port %d with %d threads\n",
+	  params.pages - 1, port, threads);
+  if (revision > 0 && revised_fraction > 0) {
+    long n = 0;
+    for (i = 0; i < params.pages; i++)
+      n += revised(i);
+    fprintf(stderr, "revision %d: %ld of %ld pages revised\n", revision, n, params.pages);
+  }
+
+  pthread_t tid;
+  for (i = 1; i < threads; i++) {
+    int rc = pthread_create(&tid, NULL, acceptor, (void *)i);
+    if (rc != 0)
+      posix_error(rc, "pthread_create");
+  }
+  acceptor((void *)0);
+  return 0;
+}
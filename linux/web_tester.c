@@ -5,9 +5,13 @@
 #include <unistd.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <strings.h>
+#include <signal.h>
+#include <poll.h>
+#include <pthread.h>
 #include "crawler.h"
 #include "cs537.h"
-#include "cs537.h"
+#include "pagecache.h"
 
 void *Malloc(size_t size) {
   void *r = malloc(size);
@@ -22,77 +26,400 @@ char *Strdup(const char *s) {
 }
 
 /*
- * Send an HTTP request for the specified file 
+Where to crawl. Defaults to the course site; point -h/-p at a local
+web_server to test offline.
+*/
+char *host = "pages.cs.wisc.edu";
+int port = 80;
+char *prefix = "/~harter/537/p4/";
+
+/*
+Each download worker keeps one connection open and reuses it for all of
+its fetches, reconnecting when the server closes it.
+*/
+__thread int conn_fd = -1;
+__thread rio_t *conn_rio;
+pthread_mutex_t dns_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+With -C, pages are looked up in an on-disk cache (see pagecache.h) before
+going to the network, and stored there after, keyed by host, port and
+path. -M caps its size in MB.
+*/
+pagecache *cache = NULL;
+long cache_mb = 256;
+
+/*
+Connecting gives up after connect_ms (-t), and so does every read and write
+on a connection after read_ms. A fetch that fails in a way that may not
+happen again (a timeout, a dropped connection, a 5xx or 429 answer)
+returns CRAWL_RETRY, so with -r the crawler tries the page again later.
+*/
+int connect_ms = 5000;
+int read_ms = 10000;
+
+/*
+ * Send an HTTP request for the specified file, conditional on the
+ * validators that are not NULL
  */
-void clientSend(int fd, char *filename)
+int clientSend(int fd, char *filename, char *etag, char *modified)
 {
   char buf[MAXLINE];
-  char hostname[MAXLINE];
-
-  Gethostname(hostname, MAXLINE);
 
   /* Form and send the HTTP request */
-  sprintf(buf, "GET %s HTTP/1.1\n", filename);
-  sprintf(buf, "%shost: %s\n\r\n", buf, hostname);
-  Rio_writen(fd, buf, strlen(buf));
+  int n = snprintf(buf, MAXLINE, "GET %s HTTP/1.1\r\nHost: %.256s\r\nConnection: keep-alive\r\n",
+		   filename, host);
+  if (etag != NULL)
+    n += snprintf(buf + n, MAXLINE - n, "If-None-Match: %.256s\r\n", etag);
+  if (modified != NULL)
+    n += snprintf(buf + n, MAXLINE - n, "If-Modified-Since: %.256s\r\n", modified);
+  n += snprintf(buf + n, MAXLINE - n, "\r\n");
+  return rio_writen(fd, buf, n) < 0 ? -1 : 0;
 }
 
-char *grab_page(int fd)
-{
-  rio_t rio;
-  char buf[MAXBUF];  
-  int length = 0;
+/*
+Copies a header's value, without the surrounding white space, into out.
+*/
+void header_value(char *value, char *out) {
   int n;
-  
-  Rio_readinitb(&rio, fd);
-
-  /* Read and display the HTTP Header */
-  n = Rio_readlineb(&rio, buf, MAXBUF);
-  while (strcmp(buf, "\r\n") && (n > 0)) {
-    n = Rio_readlineb(&rio, buf, MAXBUF);
+  value += strspn(value, " \t");
+  n = strcspn(value, "\r\n");
+  while (n > 0 && (value[n - 1] == ' ' || value[n - 1] == '\t'))
+    n--;
+  memcpy(out, value, n);
+  out[n] = '\0';
+}
 
-    /* If you want to look for certain HTTP tags... */
-    if (sscanf(buf, "Content-Length: %d ", &length) == 1) {
-      // pass
+/*
+Reads n more body bytes into the page or, when streaming, hands them to
+the crawler a buffer at a time (see crawl_set_streaming).
+*/
+int read_body(rio_t *rio, char **page, int *pos, int n, int stream) {
+  char buf[MAXBUF];
+  if (stream) {
+    while (n > 0) {
+      int m = n < MAXBUF ? n : MAXBUF;
+      if (rio_readnb(rio, buf, m) != m)
+	return -1;
+      crawl_fetch_chunk(buf, m);
+      n -= m;
     }
+    return 0;
   }
+  *page = realloc(*page, *pos + n + 1);
+  assert(*page);
+  if (rio_readnb(rio, *page + *pos, n) != n)
+    return -1;
+  *pos += n;
+  return 0;
+}
+
+/*
+Reads one response, framed by Content-Length, chunked encoding, or the
+connection closing. *status gets the HTTP status, *keep whether the
+connection can be reused, and etag and modified (MAXBUF bytes each) the
+validators, "" when the server sent none. With stream set, the body of a
+200 response goes to the crawler as it arrives instead, and *streamed is
+set once any of it may have.
 
-  /* Read and display the HTTP Body */
-  int page_len = 1;
-  char *page = Malloc(page_len);
+@return:
+char*, the body ("" if streamed), or NULL if the connection failed before
+a full response
+*/
+char *grab_page(rio_t *rio, int *status, int *keep, char *etag, char *modified, int stream, int *streamed)
+{
+  char buf[MAXBUF];
+  int length = -1;
+  int chunked = 0;
+  int n;
+
+  /* Read the status line and the HTTP Header */
+  if (rio_readlineb(rio, buf, MAXBUF) <= 0 || sscanf(buf, "HTTP/1.%*d %d", status) != 1)
+    return NULL;
+  *keep = strncmp(buf, "HTTP/1.0", 8) != 0;
+  etag[0] = '\0';
+  modified[0] = '\0';
+  while ((n = rio_readlineb(rio, buf, MAXBUF)) > 0 && strcmp(buf, "\r\n") && strcmp(buf, "\n")) {
+    if (strncasecmp(buf, "Content-Length:", 15) == 0)
+      length = atoi(buf + 15);
+    else if (strncasecmp(buf, "Transfer-Encoding:", 18) == 0 && strstr(buf, "chunked"))
+      chunked = 1;
+    else if (strncasecmp(buf, "Connection:", 11) == 0 && strstr(buf, "close"))
+      *keep = 0;
+    else if (strncasecmp(buf, "ETag:", 5) == 0)
+      header_value(buf + 5, etag);
+    else if (strncasecmp(buf, "Last-Modified:", 14) == 0)
+      header_value(buf + 14, modified);
+  }
+  if (n <= 0)
+    return NULL;
+
+  /* Read the HTTP Body; a 304 never has one */
+  char *page = Malloc(1);
   int pos = 0;
-  n = Rio_readlineb(&rio, buf, MAXBUF);
-  while (n > 0) {
-    if (&page[pos]+n+1 > page+page_len) {
-      page_len += n;
-      page = realloc(page, page_len);
+  if (*status == 304) {
+    page[0] = '\0';
+    return page;
+  }
+  stream = stream && *status == 200;
+  *streamed = stream;
+  if (chunked) {
+    while (1) {
+      if (rio_readlineb(rio, buf, MAXBUF) <= 0)
+	goto fail;
+      int size = strtol(buf, NULL, 16);
+      if (size == 0)
+	break;
+      if (read_body(rio, &page, &pos, size, stream) < 0 || rio_readlineb(rio, buf, MAXBUF) <= 0)
+	goto fail;
+    }
+    /* Trailers */
+    while ((n = rio_readlineb(rio, buf, MAXBUF)) > 0 && strcmp(buf, "\r\n") && strcmp(buf, "\n"))
+      ;
+    if (n <= 0)
+      goto fail;
+  } else if (length >= 0) {
+    if (read_body(rio, &page, &pos, length, stream) < 0)
+      goto fail;
+  } else {
+    while ((n = rio_readnb(rio, buf, MAXBUF)) > 0) {
+      if (stream) {
+	crawl_fetch_chunk(buf, n);
+	continue;
+      }
+      page = realloc(page, pos + n + 1);
       assert(page);
+      memcpy(page + pos, buf, n);
+      pos += n;
     }
-    pos += sprintf(&page[pos], "%s", buf);
-    n = Rio_readlineb(&rio, buf, MAXBUF);
+    *keep = 0;
   }
-
+  page[pos] = '\0';
   return page;
+
+ fail:
+  free(page);
+  return NULL;
+}
+
+/*
+Connects to host:port within connect_ms and sets read_ms as the timeout
+of reads and writes on the socket.
+
+@return:
+int, the socket, or -1 if the connection failed
+*/
+int connect_server() {
+  struct sockaddr_in addr;
+  struct hostent *hp;
+  struct timeval tv = { read_ms / 1000, (read_ms % 1000) * 1000 };
+  struct pollfd pfd;
+  int fd, err = 0, n;
+  socklen_t len = sizeof(err);
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  pthread_mutex_lock(&dns_lock);
+  if ((hp = gethostbyname(host)) != NULL)
+    memcpy(&addr.sin_addr.s_addr, hp->h_addr, hp->h_length);
+  pthread_mutex_unlock(&dns_lock);
+  if (hp == NULL || (fd = socket(AF_INET, SOCK_STREAM, 0)) < 0)
+    return -1;
+  fcntl(fd, F_SETFL, O_NONBLOCK);
+  if (connect(fd, (SA *)&addr, sizeof(addr)) < 0) {
+    if (errno != EINPROGRESS)
+      goto fail;
+    pfd.fd = fd;
+    pfd.events = POLLOUT;
+    if ((n = poll(&pfd, 1, connect_ms)) == 0)
+      crawl_fetch_report(CRAWL_FETCH_TIMEOUT);
+    if (n <= 0 || getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0 || err != 0)
+      goto fail;
+  }
+  fcntl(fd, F_SETFL, 0);
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+  setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+  return fd;
+
+ fail:
+  close(fd);
+  return -1;
 }
 
+/*
+With -e, waits up to the crawler's hedge delay (see crawl_set_hedge) for
+the answer to the request just sent on conn_fd. If none has started to
+arrive by then, sends the same request on a second connection and keeps
+whichever connection answers first; the other is closed.
+*/
+void hedge(char *url, char *etag, char *modified) {
+  unsigned long delay_ns = crawl_fetch_hedge_ns();
+  struct pollfd fds[2];
+  int fd;
+
+  if (delay_ns == 0 || conn_rio->rio_cnt > 0)
+    return;
+  fds[0].fd = conn_fd;
+  fds[0].events = POLLIN;
+  if (poll(fds, 1, (delay_ns + 999999) / 1000000) != 0)
+    return;
+  if ((fd = connect_server()) < 0)
+    return;
+  if (clientSend(fd, url, etag, modified) < 0) {
+    close(fd);
+    return;
+  }
+  crawl_fetch_report(CRAWL_FETCH_HEDGED);
+  fds[1].fd = fd;
+  fds[1].events = POLLIN;
+  if (poll(fds, 2, read_ms) > 0 && fds[0].revents == 0) {
+    crawl_fetch_report(CRAWL_FETCH_HEDGE_WON);
+    close(conn_fd);
+    conn_fd = fd;
+    rio_readinitb(conn_rio, conn_fd);
+    return;
+  }
+  close(fd);
+}
+
+void disconnect() {
+  close(conn_fd);
+  conn_fd = -1;
+}
+
+/*
+Fetches a page, conditionally when the crawler has validators for it from
+a previous crawl (see -R). With -S and no cache, a page is streamed to the
+crawler as it arrives; a connection that fails partway is not retried,
+since the crawler already has part of the page. A request that fails on a
+kept-alive connection is sent again at once on a new one, since the server
+may just have closed the old one; other failures are left to the crawler.
+*/
 char *fetch(char *link) {
   char url[256];
-  snprintf(url, 256, "/~harter/537/p4/%s", link);
-  int clientfd = Open_clientfd("pages.cs.wisc.edu", 80);
-  ///~harter/537/  clientSend(clientfd, "/~harter/537/slides.html");
-  clientSend(clientfd, url);
-  char *page = grab_page(clientfd);
-  Close(clientfd);
+  char etag[MAXBUF], modified[MAXBUF];
+  char *old_etag = NULL, *old_modified = NULL;
+  char key[512];
+  int status = 0, keep = 0;
+  int stream = cache == NULL && crawl_fetch_streaming(), streamed = 0;
+  int attempt, reused, timed_out = 0;
+  char *page = NULL;
+
+  snprintf(url, 256, "%s%s", prefix, link);
+  if (cache != NULL) {
+    snprintf(key, sizeof(key), "%s:%d%s", host, port, url);
+    if ((page = pagecache_get(cache, key)) != NULL)
+      return page;
+  }
+  crawl_fetch_validators(&old_etag, &old_modified);
+  if (conn_rio == NULL)
+    conn_rio = Malloc(sizeof(rio_t));
+  /* A kept-alive connection may have been closed under us; retry once on a fresh one. */
+  for (attempt = 0; attempt < 2 && page == NULL && !streamed; attempt++) {
+    reused = conn_fd >= 0;
+    if (!reused) {
+      if ((conn_fd = connect_server()) < 0)
+	break;
+      rio_readinitb(conn_rio, conn_fd);
+    }
+    errno = 0;
+    if (clientSend(conn_fd, url, old_etag, old_modified) == 0) {
+      hedge(url, old_etag, old_modified);
+      page = grab_page(conn_rio, &status, &keep, etag, modified, stream, &streamed);
+    }
+    timed_out = page == NULL && (errno == EAGAIN || errno == EWOULDBLOCK);
+    if (page == NULL || !keep)
+      disconnect();
+    if (page == NULL && (timed_out || !reused))
+      break;
+  }
+  if (timed_out)
+    crawl_fetch_report(CRAWL_FETCH_TIMEOUT);
+  if (streamed) {
+    if (page == NULL)
+      return NULL;
+    free(page);
+    return CRAWL_STREAMED;
+  }
+  if (page == NULL)
+    return CRAWL_RETRY;
+  if (status == 304 && (old_etag != NULL || old_modified != NULL)) {
+    free(page);
+    return CRAWL_NOT_MODIFIED;
+  }
+  if (status != 200) {
+    free(page);
+    return status >= 500 || status == 429 ? CRAWL_RETRY : NULL;
+  }
+  crawl_fetch_set_validators(etag[0] ? etag : NULL, modified[0] ? modified : NULL);
+  if (cache != NULL)
+    pagecache_put(cache, key, page, strlen(page));
   return page;
 }
 
+/* With -G the links go to a graph file instead (see crawl_set_graph). */
+int print_edges = 1;
+
 void edge(char *from, char *to) {
-  printf("%s -> %s\n", from, to);
+  if (print_edges)
+    printf("%s -> %s\n", from, to);
+}
+
+void print_stats(crawl_stats *stats) {
+  stats_print(stderr, stats);
+  if (cache != NULL) {
+    pagecache_stats cs;
+    pagecache_get_stats(cache, &cs);
+    fprintf(stderr, "page cache hits %lu, misses %lu, stored %lu (%lu shared), evictions %lu, %lu bytes\n",
+	    cs.hits, cs.misses, cs.stores, cs.shared, cs.evictions, cs.bytes);
+  }
 }
 
 int main(int argc, char *argv[]) {
-  assert(argc == 2);
-  int rc = crawl(argv[1], 1, 1, 1, fetch, edge);
-  assert(rc == 0);
-  return 0;
+  int download_workers = 1, parse_workers = 1, queue_size = 1;
+  int retries = 0, retry_ms = 100;
+  int c;
+
+  while ((c = getopt(argc, argv, "h:p:P:d:w:q:R:C:M:G:F:t:r:e:N:E:HSs")) != -1) {
+    switch (c) {
+    case 'h': host = optarg; break;
+    case 'p': port = atoi(optarg); break;
+    case 'P': prefix = optarg; break;
+    case 'd': download_workers = atoi(optarg); break;
+    case 'w': parse_workers = atoi(optarg); break;
+    case 'q': queue_size = atoi(optarg); break;
+    case 'R': crawl_set_recrawl(optarg); break;
+    case 's': crawl_set_stats(0, print_stats); break;
+    case 'C':
+      cache = Malloc(sizeof(pagecache));
+      cache->dir = optarg;
+      break;
+    case 'M': cache_mb = atol(optarg); break;
+    case 'F': crawl_set_filter(optarg); break;
+    case 'H': crawl_set_extractor(extract_html_hrefs); break;
+    case 'S': crawl_set_streaming(1); break;
+    case 't': sscanf(optarg, "%d:%d", &connect_ms, &read_ms); break;
+    case 'r': sscanf(optarg, "%d:%d", &retries, &retry_ms); break;
+    case 'e': crawl_set_hedge(atof(optarg)); break;
+    case 'N': crawl_set_shards(atoi(optarg)); break;
+    case 'E': crawl_set_expected_urls(atol(optarg)); break;
+    case 'G':
+      crawl_set_graph(optarg);
+      print_edges = 0;
+      break;
+    default:
+      fprintf(stderr, "usage: %s [-h host] [-p port] [-P path_prefix] "
+	      "[-d download_workers] [-w parse_workers] [-q queue_size] [-R recrawl_store] [-C cache_dir] [-M cache_mb] [-G graph_file] [-F filter_rules] [-H] [-S] "
+	      "[-t connect_ms:read_ms] [-r retries[:backoff_ms]] [-e hedge_percentile] [-N shards] [-E expected_urls] [-s] start_url\n", argv[0]);
+      return 1;
+    }
+  }
+  if (cache != NULL && pagecache_open(cache, cache->dir, cache_mb << 20) < 0)
+    cache = NULL;
+  assert(optind == argc - 1);
+  crawl_set_retries(retries, retry_ms, 100 * retry_ms);
+  signal(SIGPIPE, SIG_IGN);
+  int rc = crawl(argv[optind], download_workers, parse_workers, queue_size, fetch, edge);
+  return rc == 0 ? 0 : 1;
 }
@@ -0,0 +1,264 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include "webgraph.h"
+
+static char* filler[] = { "lorem", "ipsum", "dolor", "sit", "amet", "consectetur" };
+
+void webgraph_defaults(webgraph_params* params)
+{
+	params->pages = 10000;
+	params->alpha = 2.1;
+	params->min_degree = 2;
+	params->max_degree = 200;
+	params->page_bytes = 4096;
+	params->back_fraction = 0.5;
+	params->cycle_len = 0;
+	params->mirror_fraction = 0;
+	params->html = 0;
+	params->seed = 537;
+}
+
+/*
+xorshift64* seeded per page, so pages can be generated in any order.
+*/
+static uint64_t rng_next(uint64_t* state)
+{
+	uint64_t x = *state;
+	x ^= x >> 12;
+	x ^= x << 25;
+	x ^= x >> 27;
+	*state = x;
+	return x * 0x2545f4914f6cdd1dULL;
+}
+
+static double rng_unit(uint64_t* state)
+{
+	return ((rng_next(state) >> 11) + 0.5) / 9007199254740992.0;
+}
+
+static uint64_t page_seed(webgraph_params* params, long i)
+{
+	uint64_t z = params->seed + (uint64_t)i * 0x9e3779b97f4a7c15ULL;
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+	z ^= z >> 31;
+	return z ? z : 1;
+}
+
+static int page_degree(webgraph_params* params, uint64_t* state)
+{
+	double d = params->min_degree / pow(rng_unit(state), 1.0 / (params->alpha - 1.0));
+	if (d > params->max_degree) {
+		d = params->max_degree;
+	}
+	return (int)d;
+}
+
+/*
+Decides from its own seed, not the page's, so setting mirror_fraction leaves
+every other link in the graph where it was.
+*/
+static int page_mirrored(webgraph_params* params, long i)
+{
+	uint64_t state = page_seed(params, i) ^ 0x6d6972726f72ULL;
+	if (params->mirror_fraction <= 0) {
+		return 0;
+	}
+	return rng_unit(&state) < params->mirror_fraction;
+}
+
+/*
+Maps a page name back to its index. A mirror m<i> maps to the index of the
+page it copies.
+
+@return:
+int, the index, or -1 if name is not a generated page name
+*/
+int webgraph_index(char* name)
+{
+	char* end;
+	long i;
+	if ((name[0] != 'p' && name[0] != 'm') || name[1] < '0' || name[1] > '9') {
+		return -1;
+	}
+	i = strtol(name + 1, &end, 10);
+	if (*end != '\0') {
+		return -1;
+	}
+	return (int)i;
+}
+
+/*
+Appends sep and a link to the page named kind<target>: a link: token, or
+for HTML pages an <a> tag in one of four spellings picked by style.
+
+@return:
+long, the new length of page
+*/
+static long put_link(webgraph_params* params, char* page, long cap, long pos, char* sep, char kind, long target,
+		     int style)
+{
+	if (!params->html) {
+		return pos + snprintf(page + pos, cap - pos, "%slink:%c%ld", sep, kind, target);
+	}
+	switch (style % 4) {
+	case 0:
+		return pos + snprintf(page + pos, cap - pos, "%s<a href=\"%c%ld\">%c%ld</a>", sep, kind, target, kind, target);
+	case 1:
+		return pos + snprintf(page + pos, cap - pos, "%s<a class='nav' HREF='./%c%ld#top'>more</a>", sep, kind, target);
+	case 2:
+		return pos + snprintf(page + pos, cap - pos, "%s<A href=%c%ld>%c%ld</A>", sep, kind, target, kind, target);
+	default:
+		return pos + snprintf(page + pos, cap - pos, "%s<a title=\"x &amp; y\" href=\"&#%d;%ld\">%c%ld</a>", sep,
+				      kind, target, kind, target);
+	}
+}
+
+/*
+Builds page i.
+
+@return:
+char*, a malloc'd, NUL terminated page of *length bytes
+*/
+char* webgraph_page(webgraph_params* params, long i, long* length)
+{
+	uint64_t state = page_seed(params, i);
+	int degree = page_degree(params, &state);
+	long cap = params->html ? (degree + 4) * 96 + 512 : (degree + 4) * 32 + 64;
+	char* page = malloc(cap);
+	long pos;
+	int k;
+
+	if (params->html) {
+		pos = snprintf(page, cap, "<!DOCTYPE html>\n<html><head><title>p%ld</title>\n"
+			       "<style>a { color: #a00 } /* <a href=\"nowhere\"> */</style>\n</head>\n"
+			       "<body>\n<h1>Welcome to p%ld!</h1>\n<!-- <a href=\"hidden\">draft</a> -->\n", i, i);
+	}
+	else {
+		pos = snprintf(page, cap, "Welcome to p%ld!\n", i);
+	}
+	pos = put_link(params, page, cap, pos, "", 'p', (i + 1) % params->pages, 0);
+	page[pos++] = '\n';
+	if (page_mirrored(params, i)) {
+		pos = put_link(params, page, cap, pos, "", 'm', i, 1);
+		page[pos++] = '\n';
+	}
+	if (params->cycle_len > 1 && i % params->cycle_len != 0) {
+		pos = put_link(params, page, cap, pos, "", 'p', i - i % params->cycle_len, 2);
+		page[pos++] = '\n';
+	}
+	for (k = 0; k < degree; k++) {
+		long target;
+		if (rng_unit(&state) < params->back_fraction || i == params->pages - 1) {
+			target = i ? (long)(rng_next(&state) % i) : 0;
+		} else {
+			target = i + 1 + (long)(rng_next(&state) % (params->pages - i - 1));
+		}
+		pos = put_link(params, page, cap, pos, k % 8 ? " " : "\n", 'p', target, k);
+	}
+	page[pos++] = '\n';
+	if (params->html) {
+		pos += snprintf(page + pos, cap - pos, "<script>document.write('<a href=\"nowhere\">');</script>\n<p>");
+	}
+	if (pos < params->page_bytes) {
+		long line = 0;
+		page = realloc(page, params->page_bytes + 1);
+		while (pos < params->page_bytes) {
+			char* word = filler[rng_next(&state) % 6];
+			long n = strlen(word);
+			if (n > params->page_bytes - pos) {
+				n = params->page_bytes - pos;
+			}
+			memcpy(page + pos, word, n);
+			pos += n;
+			line += n;
+			if (line > 64 && pos < params->page_bytes) {
+				page[pos++] = '\n';
+				line = 0;
+			}
+			else if (pos < params->page_bytes) {
+				page[pos++] = ' ';
+			}
+		}
+	}
+	page[pos] = '\0';
+	*length = pos;
+	return page;
+}
+
+/*
+@return:
+long, the total number of links in the graph (duplicates included), mirrors
+counted once
+*/
+long webgraph_edges(webgraph_params* params)
+{
+	long edges = 0;
+	long i;
+	for (i = 0; i < params->pages; i++) {
+		uint64_t state = page_seed(params, i);
+		edges += 1 + page_degree(params, &state) + page_mirrored(params, i);
+		if (params->cycle_len > 1 && i % params->cycle_len != 0) {
+			edges++;
+		}
+	}
+	return edges;
+}
+
+/*
+@return:
+long, the number of pages that have a mirror
+*/
+long webgraph_mirrors(webgraph_params* params)
+{
+	long mirrors = 0;
+	long i;
+	for (i = 0; i < params->pages; i++) {
+		mirrors += page_mirrored(params, i);
+	}
+	return mirrors;
+}
+
+/*
+Writes every page, and every mirror, to a file of the same name in dir.
+
+@return:
+int, 0 on success, -1 on failure
+*/
+int webgraph_write(webgraph_params* params, char* dir)
+{
+	char path[4096];
+	long i;
+
+	if (mkdir(dir, 0755) < 0 && errno != EEXIST) {
+		perror("webgraph: mkdir");
+		return -1;
+	}
+	for (i = 0; i < params->pages; i++) {
+		long length;
+		char* page = webgraph_page(params, i, &length);
+		int copies = 1 + page_mirrored(params, i);
+		int k;
+		for (k = 0; k < copies; k++) {
+			FILE* file;
+			snprintf(path, sizeof(path), "%s/%c%ld", dir, k ? 'm' : 'p', i);
+			file = fopen(path, "w");
+			if (file == NULL || fwrite(page, 1, length, file) != (size_t)length) {
+				perror("webgraph: write");
+				free(page);
+				if (file != NULL) {
+					fclose(file);
+				}
+				return -1;
+			}
+			fclose(file);
+		}
+		free(page);
+	}
+	return 0;
+}
@@ -0,0 +1,53 @@
+#ifndef __WEBGRAPH_H
+#define __WEBGRAPH_H
+
+/*
+Synthetic web graphs for benchmarking. Pages are named p0 .. p<pages-1> and
+use the same link: syntax as the hand written test pages. Every page is a
+pure function of the parameters and its index, so a corpus can be written
+to disk, held in memory or generated on demand and always comes out the
+same.
+
+Out-degrees follow a power law: min_degree / U^(1/(alpha-1)), capped at
+max_degree. Each page also links to the next one (the last to p0), so the
+whole graph is reachable from p0 and forms one long cycle. Of the random
+links, back_fraction point to earlier pages, closing cycles, and the rest
+point forward. With cycle_len set, each page also links to the first page
+of its block of cycle_len pages, adding many short cycles. Pages are padded
+with filler words to page_bytes.
+
+A mirror_fraction of the pages also have a byte for byte copy named m<i>
+instead of p<i>, linked from the original, as mirrors and duplicate URLs
+are on the real web. A crawl reaches the copy and finds only links it has
+seen already.
+
+With html set, pages are HTML documents instead, with the same links as
+<a href> tags in a few spellings (quoted, single quoted, bare, relative
+with a fragment, with a character reference) and decoy links in a
+comment, a <style> and a <script> that a crawler must not follow. Crawl
+them with extract_html_hrefs (see extract.h).
+*/
+
+typedef struct webgraph_params webgraph_params;
+
+struct webgraph_params {
+	long pages;
+	double alpha;
+	int min_degree;
+	int max_degree;
+	long page_bytes;
+	double back_fraction;
+	long cycle_len;
+	double mirror_fraction;
+	int html;
+	unsigned long seed;
+};
+
+void webgraph_defaults(webgraph_params* params);
+int webgraph_index(char* name);
+char* webgraph_page(webgraph_params* params, long i, long* length);
+long webgraph_edges(webgraph_params* params);
+long webgraph_mirrors(webgraph_params* params);
+int webgraph_write(webgraph_params* params, char* dir);
+
+#endif